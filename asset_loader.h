@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "splashkit.h"
+#include "level_cache.h"
+
+/*
+Startup asset loader. The manifest (resources/json/assets.json) lists the
+sounds, music and levels the game uses and the group that needs each:
+
+  {"assets": [{"name": "background_music", "kind": "music",
+               "path": "./SoundEffects/cinematic-time-lapse.mp3", "group": "title"},
+              {"name": "level_1.json", "kind": "level", "group": "game"}, ...]}
+
+asset_loader_start hands the assets to worker threads in manifest order
+and returns straight away. The main thread polls asset_loader_ready and
+asset_loader_progress per group, so each screen opens as soon as its own
+group is in. With up to ASSET_MAX_WORKERS assets loading at once,
+startup takes about as long as the slowest asset rather than the sum.
+
+SplashKit keeps sounds and music in maps it does not lock, so the
+load_sound_effect and load_music calls themselves run under audio_mutex.
+A worker reads the whole file first, which is the slow part of a cold
+start, and takes the lock once the file is in the page cache. Levels
+parse outside the lock and go into the level cache, unless it already
+has them.
+*/
+
+const string ASSET_MANIFEST = "assets.json";
+const int ASSET_MAX_WORKERS = 8;
+
+enum AssetKind
+{
+    ASSET_SOUND,
+    ASSET_MUSIC,
+    ASSET_LEVEL
+};
+
+enum AssetState : int
+{
+    ASSET_QUEUED,
+    ASSET_LOADING,
+    ASSET_READY,
+    ASSET_FAILED
+};
+
+struct Asset
+{
+    string name;  // SplashKit resource name, or the level name
+    AssetKind kind = ASSET_SOUND;
+    string path;  // file for sounds and music, levels load by name
+    string group;
+    std::atomic<int> state{ASSET_QUEUED};
+    double load_ms = 0; // written by the worker before state leaves ASSET_LOADING
+};
+
+struct AssetLoader
+{
+    std::vector<Asset> assets; // sized once by asset_loader_start
+    std::atomic<int> next{0};  // next asset a worker takes
+    std::vector<std::thread> workers;
+    std::mutex audio_mutex;
+    LevelCache *levels = nullptr;
+    std::chrono::steady_clock::time_point started;
+    bool reported = false;
+};
+
+inline bool asset_kind_from_string(const string &text, AssetKind &kind)
+{
+    if (text == "sound")
+    {
+        kind = ASSET_SOUND;
+    }
+    else if (text == "music")
+    {
+        kind = ASSET_MUSIC;
+    }
+    else if (text == "level")
+    {
+        kind = ASSET_LEVEL;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// Reads the file through once so SplashKit finds it in the page cache. False if it cannot be opened.
+inline bool asset_read_file(const string &path)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        return false;
+    }
+    static thread_local std::vector<char> buffer(1 << 16);
+    while (fread(buffer.data(), 1, buffer.size(), file) == buffer.size())
+    {
+    }
+    fclose(file);
+    return true;
+}
+
+inline bool asset_load(AssetLoader &loader, const Asset &asset)
+{
+    if (asset.kind == ASSET_LEVEL)
+    {
+        World world;
+        if (!load_level(asset.name, world))
+        {
+            return false;
+        }
+        if (loader.levels)
+        {
+            level_cache_offer(*loader.levels, asset.name, std::move(world));
+        }
+        return true;
+    }
+
+    if (!asset_read_file(asset.path))
+    {
+        LOG_WARN(LOG_AUDIO, "Asset %s: cannot read %s", asset.name, asset.path);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(loader.audio_mutex);
+    if (asset.kind == ASSET_SOUND)
+    {
+        load_sound_effect(asset.name, asset.path);
+        return has_sound_effect(asset.name);
+    }
+    load_music(asset.name, asset.path);
+    return has_music(asset.name);
+}
+
+inline void asset_loader_worker(AssetLoader &loader)
+{
+    int i;
+    while ((i = loader.next.fetch_add(1)) < (int)loader.assets.size())
+    {
+        Asset &asset = loader.assets[i];
+        if (asset.state.load() != ASSET_QUEUED)
+        {
+            continue; // skipped by the manifest reader
+        }
+        asset.state.store(ASSET_LOADING);
+        auto start = std::chrono::steady_clock::now();
+        bool loaded = asset_load(loader, asset);
+        asset.load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        asset.state.store(loaded ? ASSET_READY : ASSET_FAILED);
+    }
+}
+
+// Reads the manifest and starts loading. levels receives the parsed levels and may be null.
+inline bool asset_loader_start(AssetLoader &loader, const string &manifest, LevelCache *levels)
+{
+    loader.started = std::chrono::steady_clock::now();
+    loader.levels = levels;
+    loader.reported = false;
+    loader.next.store(0);
+
+    json manifest_json = json_from_file(manifest);
+    vector<json> rows;
+    if (json_has_key(manifest_json, "assets"))
+    {
+        json_read_array(manifest_json, "assets", rows);
+    }
+    else
+    {
+        LOG_ERROR(LOG_GAME, "Asset manifest %s has no assets", manifest);
+    }
+
+    loader.assets = std::vector<Asset>(rows.size());
+    for (size_t i = 0; i < rows.size(); ++i)
+    {
+        json row = rows[i];
+        Asset &asset = loader.assets[i];
+        asset.name = json_read_string(row, "name");
+        asset.group = json_read_string(row, "group");
+        if (json_has_key(row, "path"))
+        {
+            asset.path = json_read_string(row, "path");
+        }
+        if (!asset_kind_from_string(json_read_string(row, "kind"), asset.kind))
+        {
+            LOG_WARN(LOG_GAME, "Asset %s has an unknown kind, skipped", asset.name);
+            asset.state.store(ASSET_FAILED);
+        }
+        free_json(row);
+    }
+    free_json(manifest_json);
+
+    int num_workers = std::min((int)loader.assets.size(), ASSET_MAX_WORKERS);
+    for (int i = 0; i < num_workers; ++i)
+    {
+        loader.workers.emplace_back(asset_loader_worker, std::ref(loader));
+    }
+    LOG_INFO(LOG_GAME, "Loading %d assets on %d threads", (int)loader.assets.size(), num_workers);
+    return !rows.empty();
+}
+
+// Assets in group that are done loading, successfully or not. An empty group counts every asset.
+inline void asset_loader_count(const AssetLoader &loader, const string &group, int &done, int &total)
+{
+    done = total = 0;
+    for (const Asset &asset : loader.assets)
+    {
+        if (group.empty() || asset.group == group)
+        {
+            total++;
+            done += asset.state.load() >= ASSET_READY;
+        }
+    }
+}
+
+inline bool asset_loader_ready(const AssetLoader &loader, const string &group = "")
+{
+    int done, total;
+    asset_loader_count(loader, group, done, total);
+    return done == total;
+}
+
+// Fraction of group done, 0 to 1
+inline double asset_loader_progress(const AssetLoader &loader, const string &group = "")
+{
+    int done, total;
+    asset_loader_count(loader, group, done, total);
+    return total == 0 ? 1.0 : (double)done / total;
+}
+
+// Call once per frame. Once everything is in, joins the workers and logs the load times.
+inline void asset_loader_update(AssetLoader &loader)
+{
+    if (loader.reported || !asset_loader_ready(loader))
+    {
+        return;
+    }
+    for (std::thread &worker : loader.workers)
+    {
+        worker.join();
+    }
+    loader.workers.clear();
+    loader.reported = true;
+
+    double total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loader.started).count();
+    double sum_ms = 0;
+    const Asset *slowest = nullptr;
+    for (const Asset &asset : loader.assets)
+    {
+        LOG_DEBUG(LOG_GAME, "Asset %s %s in %.1f ms", asset.name,
+                  asset.state.load() == ASSET_READY ? "loaded" : "failed", asset.load_ms);
+        sum_ms += asset.load_ms;
+        if (!slowest || asset.load_ms > slowest->load_ms)
+        {
+            slowest = &asset;
+        }
+    }
+    if (slowest)
+    {
+        LOG_INFO(LOG_GAME, "Assets loaded in %.1f ms (%.1f ms one after another), slowest %s at %.1f ms",
+                 total_ms, sum_ms, slowest->name, slowest->load_ms);
+    }
+}
+
+// Stops handing out assets and waits for the ones in flight
+inline void asset_loader_stop(AssetLoader &loader)
+{
+    loader.next.store((int)loader.assets.size());
+    for (std::thread &worker : loader.workers)
+    {
+        worker.join();
+    }
+    loader.workers.clear();
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <algorithm>
+
+/*
+The part of the world on screen, in world pixels. Everything drawn in the
+world is shifted by -x, -y; the HUD is drawn without the shift.
+*/
+
+struct Camera
+{
+    int x = 0; // world pixel at the left edge of the screen
+    int y = 0; // world pixel at the top edge of the screen
+};
+
+// Keeps the view inside the world. A world smaller than the screen sits at the top left.
+inline void camera_clamp(Camera &camera, int view_width, int view_height, int world_width, int world_height)
+{
+    camera.x = std::max(0, std::min(camera.x, world_width - view_width));
+    camera.y = std::max(0, std::min(camera.y, world_height - view_height));
+}
+
+// Centres the view on a point, such as the middle of the player's tile
+inline void camera_follow(Camera &camera, int target_x, int target_y, int view_width, int view_height, int world_width, int world_height)
+{
+    camera.x = target_x - view_width / 2;
+    camera.y = target_y - view_height / 2;
+    camera_clamp(camera, view_width, view_height, world_width, world_height);
+}
+
+// Whether a world pixel rectangle overlaps the screen
+inline bool camera_sees(const Camera &camera, int x, int y, int width, int height, int view_width, int view_height)
+{
+    return x + width > camera.x && y + height > camera.y && x < camera.x + view_width && y < camera.y + view_height;
+}
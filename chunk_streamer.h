@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "world.h"
+
+/*
+Reads world chunks from disk on a worker thread. The simulation decides
+which chunks are loaded, the same way every run (see sim_stream); the
+streamer only fetches chunks it is told will be wanted soon, so that when
+the simulation asks for one the page faults have already been taken.
+A chunk that is not ready yet is read on the caller instead, which keeps
+the outcome independent of timing.
+*/
+
+struct StreamedChunk
+{
+    const LevelSource *source;
+    int chunk;
+};
+
+struct ChunkStreamer
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<StreamedChunk> pending;
+    std::unordered_map<int, std::vector<uint8_t>> ready; // packed chunks by chunk number
+    std::deque<int> ready_order;                         // chunks in ready, oldest fetch first
+    std::shared_ptr<const LevelSource> source;           // kept alive while the worker reads it
+    size_t max_ready = 256; // older fetches are dropped past this
+    std::thread worker;
+    bool stopping = false;
+};
+
+inline void chunk_streamer_worker(ChunkStreamer &streamer)
+{
+    std::unique_lock<std::mutex> lock(streamer.mutex);
+    while (true)
+    {
+        streamer.changed.wait(lock, [&streamer] { return streamer.stopping || !streamer.pending.empty(); });
+        if (streamer.stopping)
+        {
+            return;
+        }
+
+        StreamedChunk request = streamer.pending.front();
+        streamer.pending.pop_front();
+        std::shared_ptr<const LevelSource> source = streamer.source;
+        if (source.get() != request.source || streamer.ready.count(request.chunk))
+        {
+            continue; // stale or already fetched
+        }
+
+        std::vector<uint8_t> packed(CHUNK_TILES);
+        lock.unlock();
+        level_read_chunk(source->tiles, source->width, source->height, request.chunk, packed.data());
+        lock.lock();
+
+        if (streamer.source.get() == request.source)
+        {
+            // Chunks the player walked away from are never collected; make room
+            if (streamer.ready.size() >= streamer.max_ready)
+            {
+                streamer.ready.erase(streamer.ready_order.front());
+                streamer.ready_order.pop_front();
+            }
+            streamer.ready[request.chunk] = std::move(packed);
+            streamer.ready_order.push_back(request.chunk);
+        }
+    }
+}
+
+inline void chunk_streamer_start(ChunkStreamer &streamer)
+{
+    streamer.stopping = false;
+    streamer.worker = std::thread(chunk_streamer_worker, std::ref(streamer));
+}
+
+inline void chunk_streamer_stop(ChunkStreamer &streamer)
+{
+    {
+        std::lock_guard<std::mutex> lock(streamer.mutex);
+        streamer.stopping = true;
+    }
+    streamer.changed.notify_all();
+    if (streamer.worker.joinable())
+    {
+        streamer.worker.join();
+    }
+}
+
+// Caller holds the streamer mutex. Drops everything fetched for a previous source.
+inline void chunk_streamer_use_source(ChunkStreamer &streamer, const std::shared_ptr<const LevelSource> &source)
+{
+    if (streamer.source != source)
+    {
+        streamer.source = source;
+        streamer.pending.clear();
+        streamer.ready.clear();
+        streamer.ready_order.clear();
+    }
+}
+
+// Queues a chunk to be read in the background
+inline void chunk_streamer_prefetch(ChunkStreamer &streamer, const std::shared_ptr<const LevelSource> &source, int chunk)
+{
+    {
+        std::lock_guard<std::mutex> lock(streamer.mutex);
+        chunk_streamer_use_source(streamer, source);
+        if (streamer.ready.count(chunk))
+        {
+            return;
+        }
+        streamer.pending.push_back({source.get(), chunk});
+    }
+    streamer.changed.notify_all();
+}
+
+// Reads a chunk into out, from the prefetched copy when there is one
+inline void chunk_streamer_read(ChunkStreamer *streamer, const std::shared_ptr<const LevelSource> &source, int chunk, uint8_t *out)
+{
+    if (streamer)
+    {
+        std::lock_guard<std::mutex> lock(streamer->mutex);
+        chunk_streamer_use_source(*streamer, source);
+        auto found = streamer->ready.find(chunk);
+        if (found != streamer->ready.end())
+        {
+            memcpy(out, found->second.data(), CHUNK_TILES);
+            streamer->ready.erase(found);
+            streamer->ready_order.erase(std::find(streamer->ready_order.begin(), streamer->ready_order.end(), chunk));
+            return;
+        }
+    }
+    level_read_chunk(source->tiles, source->width, source->height, chunk, out);
+}
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "profiler.h"
+#include "tile_types.h"
+#include "world.h"
+
+/*
+Which parts of a level can reach each other, kept up to date while the
+editor paints. A tile is passable if it is traversable or opens with the
+key (the door), and the largest set of passable tiles joined edge to edge
+is the main area the level is played in. Passable tiles outside it are
+stray: a player or mob spawned there is cut off. The level is only
+finishable if an exit tile is in the main area.
+
+Components are found per chunk. Each resident chunk numbers its own
+components (label, 1-based, 0 for blocked tiles) and records which of
+them touch which components of the chunks to its right and below
+(east_links, south_links). Joining those into whole-level components is
+a union-find over the components rather than the tiles, so it is cheap
+even on a full 1024-chunk level.
+
+connectivity_mark notes that a tile changed; connectivity_update then
+relabels only the chunks that changed (or were loaded into a slot since
+the last update), redoes the links along their edges, and reruns the
+union-find. A paint costs one chunk of flood fill, not a pass over the
+level. Chunks that are not loaded count as blocked.
+*/
+
+struct Connectivity
+{
+    std::vector<uint16_t> label;                    // per world_index: component in its chunk, 0 if not passable
+    std::vector<std::vector<uint16_t>> sizes;       // per slot: tiles in each component, by label - 1
+    std::vector<std::vector<uint16_t>> exits;       // per slot: local index of each exit tile
+    std::vector<std::vector<uint32_t>> east_links;  // per slot: label << 16 | label across the right edge
+    std::vector<std::vector<uint32_t>> south_links; // per slot: the same across the bottom edge
+    std::vector<uint32_t> stamp;                    // world stamp each slot was labelled at
+    std::vector<uint8_t> stale;                     // per slot, relabel on the next update
+    std::vector<int32_t> stale_slots;
+    std::vector<int32_t> base;   // per slot: union-find id of its first component
+    std::vector<int32_t> parent; // union-find over components; roots once an update returns
+    std::vector<int64_t> tiles;  // per root: passable tiles in the component
+    std::vector<int16_t> stack;  // flood fill scratch
+    int main_root = -1;          // the largest component, -1 if nothing is passable
+    int64_t passable_tiles = 0;
+    int64_t main_tiles = 0;
+    int exit_count = 0;
+    int reachable_exits = 0; // exits in the main area
+};
+
+inline bool connectivity_passable(const World &world, size_t index)
+{
+    uint32_t word = world.walkable[index >> CHUNK_SHIFT];
+    return ((word >> (index & CHUNK_MASK)) & 1) || tile_types().info[world.tiles[index]].requires_key;
+}
+
+// Everything is relabelled on the next update
+inline void connectivity_reset(Connectivity &conn, const World &world)
+{
+    size_t slots = world.chunk_of.size();
+    conn.label.assign(world.tiles.size(), 0);
+    conn.sizes.assign(slots, {});
+    conn.exits.assign(slots, {});
+    conn.east_links.assign(slots, {});
+    conn.south_links.assign(slots, {});
+    conn.stamp.assign(slots, 0);
+    conn.stale.assign(slots, 0);
+    conn.stale_slots.clear();
+    for (int slot = 0; slot < (int)slots; ++slot)
+    {
+        conn.stale[slot] = 1;
+        conn.stale_slots.push_back(slot);
+    }
+}
+
+// The tile at (x, y) changed type or traversability
+inline void connectivity_mark(Connectivity &conn, const World &world, int x, int y)
+{
+    if (!world_resident(world, x, y) || conn.stale.size() != world.chunk_of.size())
+    {
+        return;
+    }
+    int slot = world.slot_of[world_chunk(world, x, y)];
+    if (!conn.stale[slot])
+    {
+        conn.stale[slot] = 1;
+        conn.stale_slots.push_back(slot);
+    }
+}
+
+// Numbers the passable components of one chunk by flood fill
+inline void connectivity_label_slot(Connectivity &conn, const World &world, int slot)
+{
+    uint16_t *label = &conn.label[(size_t)slot * CHUNK_TILES];
+    std::fill(label, label + CHUNK_TILES, 0);
+    std::vector<uint16_t> &sizes = conn.sizes[slot];
+    std::vector<uint16_t> &exits = conn.exits[slot];
+    sizes.clear();
+    exits.clear();
+    conn.stamp[slot] = world.stamp[slot];
+    if (world.chunk_of[slot] < 0)
+    {
+        return;
+    }
+
+    const TileTypeRegistry &types = tile_types();
+    size_t first = (size_t)slot * CHUNK_TILES;
+    for (int start = 0; start < CHUNK_TILES; ++start)
+    {
+        if (types.info[world.tiles[first + start]].effects & TILE_EFFECT_EXIT)
+        {
+            exits.push_back((uint16_t)start);
+        }
+        if (label[start] || !connectivity_passable(world, first + start))
+        {
+            continue;
+        }
+        uint16_t id = (uint16_t)(sizes.size() + 1);
+        uint16_t count = 0;
+        label[start] = id;
+        conn.stack.push_back((int16_t)start);
+        while (!conn.stack.empty())
+        {
+            int tile = conn.stack.back();
+            conn.stack.pop_back();
+            count++;
+            int x = tile & CHUNK_MASK;
+            int y = tile >> CHUNK_SHIFT;
+            int next[4] = {x > 0 ? tile - 1 : -1, x < CHUNK_MASK ? tile + 1 : -1,
+                           y > 0 ? tile - CHUNK_SIZE : -1, y < CHUNK_MASK ? tile + CHUNK_SIZE : -1};
+            for (int n : next)
+            {
+                if (n >= 0 && !label[n] && connectivity_passable(world, first + n))
+                {
+                    label[n] = id;
+                    conn.stack.push_back((int16_t)n);
+                }
+            }
+        }
+        sizes.push_back(count);
+    }
+}
+
+// Slot of the chunk dx, dy chunks away from the one in slot, -1 if it is off the level or not loaded
+inline int connectivity_neighbour_slot(const World &world, int slot, int dx, int dy)
+{
+    int chunk = world.chunk_of[slot];
+    if (chunk < 0)
+    {
+        return -1;
+    }
+    int cx = chunk % world.chunks_x + dx;
+    int cy = chunk / world.chunks_x + dy;
+    if ((unsigned)cx >= (unsigned)world.chunks_x || (unsigned)cy >= (unsigned)world.chunks_y)
+    {
+        return -1;
+    }
+    return world.slot_of[cy * world.chunks_x + cx];
+}
+
+// Pairs of components facing each other across the right (east) or bottom edge of slot
+inline void connectivity_link_slot(Connectivity &conn, const World &world, int slot, bool east)
+{
+    std::vector<uint32_t> &links = east ? conn.east_links[slot] : conn.south_links[slot];
+    links.clear();
+    int other = connectivity_neighbour_slot(world, slot, east ? 1 : 0, east ? 0 : 1);
+    if (other < 0)
+    {
+        return;
+    }
+    const uint16_t *here = &conn.label[(size_t)slot * CHUNK_TILES];
+    const uint16_t *there = &conn.label[(size_t)other * CHUNK_TILES];
+    for (int i = 0; i < CHUNK_SIZE; ++i)
+    {
+        int a = east ? (i << CHUNK_SHIFT) + CHUNK_MASK : (CHUNK_MASK << CHUNK_SHIFT) + i;
+        int b = east ? (i << CHUNK_SHIFT) : i;
+        if (here[a] && there[b])
+        {
+            links.push_back((uint32_t)here[a] << 16 | there[b]);
+        }
+    }
+    std::sort(links.begin(), links.end());
+    links.erase(std::unique(links.begin(), links.end()), links.end());
+}
+
+inline int connectivity_find(std::vector<int32_t> &parent, int i)
+{
+    while (parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// Joins the chunk components into level components and finds the main area
+inline void connectivity_join(Connectivity &conn, const World &world)
+{
+    int slots = (int)world.chunk_of.size();
+    conn.base.resize(slots);
+    int count = 0;
+    for (int slot = 0; slot < slots; ++slot)
+    {
+        conn.base[slot] = count;
+        count += (int)conn.sizes[slot].size();
+    }
+    conn.parent.resize(count);
+    for (int i = 0; i < count; ++i)
+    {
+        conn.parent[i] = i;
+    }
+
+    for (int slot = 0; slot < slots; ++slot)
+    {
+        for (int east = 0; east < 2; ++east)
+        {
+            int other = connectivity_neighbour_slot(world, slot, east, 1 - east);
+            if (other < 0)
+            {
+                continue;
+            }
+            for (uint32_t link : east ? conn.east_links[slot] : conn.south_links[slot])
+            {
+                int a = connectivity_find(conn.parent, conn.base[slot] + (int)(link >> 16) - 1);
+                int b = connectivity_find(conn.parent, conn.base[other] + (int)(link & 0xFFFF) - 1);
+                conn.parent[std::max(a, b)] = std::min(a, b);
+            }
+        }
+    }
+
+    conn.tiles.assign(count, 0);
+    conn.passable_tiles = 0;
+    conn.main_root = -1;
+    for (int slot = 0; slot < slots; ++slot)
+    {
+        for (int i = 0; i < (int)conn.sizes[slot].size(); ++i)
+        {
+            int id = conn.base[slot] + i;
+            int root = connectivity_find(conn.parent, id);
+            conn.parent[id] = root;
+            conn.tiles[root] += conn.sizes[slot][i];
+            conn.passable_tiles += conn.sizes[slot][i];
+            if (conn.main_root < 0 || conn.tiles[root] > conn.tiles[conn.main_root])
+            {
+                conn.main_root = root;
+            }
+        }
+    }
+    conn.main_tiles = conn.main_root < 0 ? 0 : conn.tiles[conn.main_root];
+
+    conn.exit_count = 0;
+    conn.reachable_exits = 0;
+    for (int slot = 0; slot < slots; ++slot)
+    {
+        for (uint16_t tile : conn.exits[slot])
+        {
+            uint16_t id = conn.label[(size_t)slot * CHUNK_TILES + tile];
+            conn.exit_count++;
+            conn.reachable_exits += id && conn.parent[conn.base[slot] + id - 1] == conn.main_root;
+        }
+    }
+}
+
+// Relabels the chunks changed since the last update and rejoins. Returns
+// false, doing nothing, when nothing changed.
+inline bool connectivity_update(Connectivity &conn, const World &world)
+{
+    if (conn.label.size() != world.tiles.size())
+    {
+        connectivity_reset(conn, world);
+    }
+    for (int slot = 0; slot < (int)world.chunk_of.size(); ++slot)
+    {
+        bool moved = conn.stamp[slot] != world.stamp[slot] || (world.chunk_of[slot] < 0 && !conn.sizes[slot].empty());
+        if (moved && !conn.stale[slot])
+        {
+            conn.stale[slot] = 1;
+            conn.stale_slots.push_back(slot);
+        }
+    }
+    if (conn.stale_slots.empty())
+    {
+        return false;
+    }
+
+    PROFILE_ZONE("connectivity");
+    for (int slot : conn.stale_slots)
+    {
+        connectivity_label_slot(conn, world, slot);
+    }
+    // A chunk's links change with its own labels and with those of the chunk to its right or below
+    for (int slot : conn.stale_slots)
+    {
+        connectivity_link_slot(conn, world, slot, true);
+        connectivity_link_slot(conn, world, slot, false);
+        int west = connectivity_neighbour_slot(world, slot, -1, 0);
+        int north = connectivity_neighbour_slot(world, slot, 0, -1);
+        if (west >= 0 && !conn.stale[west])
+        {
+            connectivity_link_slot(conn, world, west, true);
+        }
+        if (north >= 0 && !conn.stale[north])
+        {
+            connectivity_link_slot(conn, world, north, false);
+        }
+    }
+    for (int slot : conn.stale_slots)
+    {
+        conn.stale[slot] = 0;
+    }
+    conn.stale_slots.clear();
+    connectivity_join(conn, world);
+    return true;
+}
+
+// Passable but cut off from the main area. Valid after connectivity_update.
+inline bool connectivity_stray(const Connectivity &conn, const World &world, int x, int y)
+{
+    if (!world_resident(world, x, y))
+    {
+        return false;
+    }
+    size_t index = world_index(world, x, y);
+    uint16_t id = conn.label[index];
+    return id && conn.parent[conn.base[index / CHUNK_TILES] + id - 1] != conn.main_root;
+}
+
+// Calls fn(x, y, reachable) for every exit tile of every loaded chunk
+template <typename Fn>
+inline void connectivity_for_each_exit(const Connectivity &conn, const World &world, Fn fn)
+{
+    for (int slot = 0; slot < (int)conn.exits.size(); ++slot)
+    {
+        for (uint16_t tile : conn.exits[slot])
+        {
+            size_t index = (size_t)slot * CHUNK_TILES + tile;
+            uint16_t id = conn.label[index];
+            fn(world_index_x(world, index), world_index_y(world, index),
+               id && conn.parent[conn.base[slot] + id - 1] == conn.main_root);
+        }
+    }
+}
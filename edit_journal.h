@@ -0,0 +1,366 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include "sim.h"
+#include "tile_types.h"
+
+/*
+Editor history and brushes. Every edit, from one click to a flood fill
+across the level, is one EditBatch in the journal: the tiles it changed
+as runs along rows, the packed tile (level_format.h) it wrote over all
+of them, and what each changed tile held before, run-length encoded in
+the same order. Tiles that already held the new tile are not recorded,
+so the runs never overlap. A fill of a million grass tiles with water is
+a few hundred runs and a single (GRASS, 1000000) span, which is why the
+history has no limit, and undoing it is one pass writing the old bytes
+back.
+
+The journal also counts the tiles of each type, kept in step by every
+write, so the UNIQUE edit rule (one door per level) is a lookup rather
+than a scan of the level. Counts cover the loaded chunks.
+
+Large batches rebuild the simulation's tile indexes once at the end
+instead of tile by tile, see EDIT_REFRESH_TILES.
+*/
+
+const int64_t EDIT_REFRESH_TILES = 4096; // batches bigger than this rebuild the free tile index in one go
+
+struct EditRun
+{
+    int32_t x = 0;
+    int32_t y = 0;
+    int32_t length = 0;
+};
+
+// count consecutive changed tiles, in run order, that held tile before the batch
+struct EditSpan
+{
+    uint8_t tile = 0;
+    uint32_t count = 0;
+};
+
+struct EditBatch
+{
+    uint8_t tile = 0; // packed tile written over every run
+    std::vector<EditRun> runs;
+    std::vector<EditSpan> before;
+    int64_t tiles = 0; // changed
+    int x0 = 0, y0 = 0, x1 = -1, y1 = -1; // bounds of the changed tiles, inclusive
+};
+
+struct EditJournal
+{
+    std::vector<EditBatch> done;   // undo takes from the back
+    std::vector<EditBatch> undone; // redo takes from the back; a new edit clears it
+    EditBatch open;                // the batch being written
+    int64_t type_count[TILE_TYPE_LIMIT] = {};
+};
+
+// Forgets the history and counts the tiles of the level now in world
+inline void edit_journal_reset(EditJournal &journal, const World &world)
+{
+    journal.done.clear();
+    journal.undone.clear();
+    journal.open = EditBatch();
+    std::fill(std::begin(journal.type_count), std::end(journal.type_count), 0);
+    world_for_each_tile(world, [&](int, int, size_t index) {
+        journal.type_count[world.tiles[index] & TILE_TYPE_MASK]++;
+    });
+}
+
+// Whether the type's edit rules let it go at (x, y)
+inline bool edit_allowed(const EditJournal &journal, const World &world, int type, int x, int y)
+{
+    const TileTypeInfo &info = tile_type_info(type);
+    if ((info.edit_rules & TILE_EDIT_INTERIOR_ONLY) && (x == 0 || y == 0 || x == world.width - 1 || y == world.height - 1))
+    {
+        return false;
+    }
+    return !(info.edit_rules & TILE_EDIT_UNIQUE) || journal.type_count[type] == 0 || world_tile(world, x, y) == type;
+}
+
+inline uint8_t edit_tile_at(const World &world, int x, int y)
+{
+    return pack_tile(world_tile(world, x, y), world_traversable(world, x, y));
+}
+
+// Writes a packed tile and keeps the type counts in step. The caller
+// brings the simulation up to date afterwards, see edit_refresh.
+inline void edit_put(EditJournal &journal, World &world, int x, int y, uint8_t tile)
+{
+    journal.type_count[world_tile(world, x, y)]--;
+    journal.type_count[tile_byte_type(tile)]++;
+    world_set_tile(world, x, y, (TileType)tile_byte_type(tile), tile_byte_traversable(tile));
+}
+
+inline void edit_begin(EditJournal &journal, TileType type, bool traversable)
+{
+    journal.open = EditBatch();
+    journal.open.tile = pack_tile(type, traversable);
+}
+
+// Writes the open batch's tile at (x, y) if the edit rules allow it and
+// the tile differs. Returns whether it was written.
+inline bool edit_write(EditJournal &journal, Game &game, int x, int y)
+{
+    EditBatch &batch = journal.open;
+    if (!world_resident(game.world, x, y) || !edit_allowed(journal, game.world, tile_byte_type(batch.tile), x, y))
+    {
+        return false;
+    }
+    uint8_t old = edit_tile_at(game.world, x, y);
+    if (old == batch.tile)
+    {
+        return false;
+    }
+    edit_put(journal, game.world, x, y, batch.tile);
+
+    if (!batch.runs.empty() && batch.runs.back().y == y && batch.runs.back().x + batch.runs.back().length == x)
+    {
+        batch.runs.back().length++;
+    }
+    else
+    {
+        batch.runs.push_back({x, y, 1});
+    }
+    if (!batch.before.empty() && batch.before.back().tile == old)
+    {
+        batch.before.back().count++;
+    }
+    else
+    {
+        batch.before.push_back({old, 1});
+    }
+    if (batch.tiles++ == 0)
+    {
+        batch.x0 = batch.x1 = x;
+        batch.y0 = batch.y1 = y;
+    }
+    batch.x0 = std::min(batch.x0, x);
+    batch.x1 = std::max(batch.x1, x);
+    batch.y0 = std::min(batch.y0, y);
+    batch.y1 = std::max(batch.y1, y);
+    return true;
+}
+
+// Brings the simulation's indexes up to date with a batch just written or undone
+inline void edit_refresh(Game &game, const EditBatch &batch)
+{
+    if (batch.tiles > EDIT_REFRESH_TILES)
+    {
+        reset_occupancy(game);
+    }
+    else if (!game.free_slot.empty())
+    {
+        for (const EditRun &run : batch.runs)
+        {
+            for (int i = 0; i < run.length; ++i)
+            {
+                free_tile_refresh(game, run.x + i, run.y);
+            }
+        }
+    }
+    game.flow.dirty = true;
+}
+
+// Files the open batch in the history. Returns it, or null if it changed nothing.
+inline const EditBatch *edit_commit(EditJournal &journal, Game &game)
+{
+    if (journal.open.tiles == 0)
+    {
+        return nullptr;
+    }
+    edit_refresh(game, journal.open);
+    journal.done.push_back(std::move(journal.open));
+    journal.open = EditBatch();
+    journal.undone.clear();
+    return &journal.done.back();
+}
+
+// Writes a batch's old tiles back (undo) or its tile again (redo). Runs
+// are written a chunk row at a time, straight into the tile bytes and the
+// row's traversable word.
+inline void edit_apply(EditJournal &journal, Game &game, const EditBatch &batch, bool undo)
+{
+    PROFILE_ZONE("edit_apply");
+    World &world = game.world;
+    size_t span = 0;
+    uint32_t left = 0;
+    for (const EditRun &run : batch.runs)
+    {
+        int end = run.x + run.length;
+        for (int x = run.x; x < end;)
+        {
+            int row_end = std::min(end, (x | CHUNK_MASK) + 1);
+            bool resident = world_resident(world, x, run.y);
+            size_t index = resident ? world_index(world, x, run.y) : 0;
+            uint32_t *word = resident ? &world.walkable[index >> CHUNK_SHIFT] : nullptr;
+            for (; x < row_end; ++x, ++index)
+            {
+                uint8_t tile = batch.tile;
+                if (undo)
+                {
+                    while (left == 0)
+                    {
+                        left = batch.before[span++].count;
+                    }
+                    tile = batch.before[span - 1].tile;
+                    left--;
+                }
+                if (!resident)
+                {
+                    continue;
+                }
+                journal.type_count[world.tiles[index]]--;
+                journal.type_count[tile_byte_type(tile)]++;
+                world.tiles[index] = tile_byte_type(tile);
+                uint32_t bit = (uint32_t)1 << (x & CHUNK_MASK);
+                *word = tile_byte_traversable(tile) ? (*word | bit) : (*word & ~bit);
+            }
+            if (resident)
+            {
+                world.edited[(index - 1) / CHUNK_TILES] = 1;
+            }
+        }
+    }
+    edit_refresh(game, batch);
+}
+
+// Undoes the last batch and returns it, null if there is nothing to undo
+inline const EditBatch *edit_undo(EditJournal &journal, Game &game)
+{
+    if (journal.done.empty())
+    {
+        return nullptr;
+    }
+    journal.undone.push_back(std::move(journal.done.back()));
+    journal.done.pop_back();
+    edit_apply(journal, game, journal.undone.back(), true);
+    return &journal.undone.back();
+}
+
+inline const EditBatch *edit_redo(EditJournal &journal, Game &game)
+{
+    if (journal.undone.empty())
+    {
+        return nullptr;
+    }
+    journal.done.push_back(std::move(journal.undone.back()));
+    journal.undone.pop_back();
+    edit_apply(journal, game, journal.done.back(), false);
+    return &journal.done.back();
+}
+
+// Paints every tile in the rectangle with corners (x0, y0) and (x1, y1) as one batch
+inline const EditBatch *edit_rect(EditJournal &journal, Game &game, int x0, int y0, int x1, int y1, TileType type, bool traversable)
+{
+    PROFILE_ZONE("edit_rect");
+    edit_begin(journal, type, traversable);
+    for (int y = std::max(0, std::min(y0, y1)); y <= std::min(game.world.height - 1, std::max(y0, y1)); ++y)
+    {
+        for (int x = std::max(0, std::min(x0, x1)); x <= std::min(game.world.width - 1, std::max(x0, x1)); ++x)
+        {
+            edit_write(journal, game, x, y);
+        }
+    }
+    return edit_commit(journal, game);
+}
+
+// Paints a one tile wide line from (x0, y0) to (x1, y1) as one batch
+inline const EditBatch *edit_line(EditJournal &journal, Game &game, int x0, int y0, int x1, int y1, TileType type, bool traversable)
+{
+    edit_begin(journal, type, traversable);
+    int dx = std::abs(x1 - x0);
+    int dy = -std::abs(y1 - y0);
+    int sx = x0 < x1 ? 1 : -1;
+    int sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+    while (true)
+    {
+        edit_write(journal, game, x0, y0);
+        if (x0 == x1 && y0 == y1)
+        {
+            break;
+        }
+        int e2 = 2 * err;
+        if (e2 >= dy)
+        {
+            err += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx)
+        {
+            err += dx;
+            y0 += sy;
+        }
+    }
+    return edit_commit(journal, game);
+}
+
+// Paints the area of tiles matching the one at (x, y) that joins it edge
+// to edge, as one batch. Scanline fill: each step fills a whole row span
+// and queues the spans above and below it.
+inline const EditBatch *edit_flood(EditJournal &journal, Game &game, int x, int y, TileType type, bool traversable)
+{
+    PROFILE_ZONE("edit_flood");
+    const World &world = game.world;
+    edit_begin(journal, type, traversable);
+    if (!world_resident(world, x, y))
+    {
+        return nullptr;
+    }
+    uint8_t target = edit_tile_at(world, x, y);
+    if (target == journal.open.tile)
+    {
+        return nullptr;
+    }
+    // Tiles the rules refuse are left as they are and bound the fill like any other tile
+    auto matches = [&](int tx, int ty) {
+        return world_resident(world, tx, ty) && edit_tile_at(world, tx, ty) == target &&
+               edit_allowed(journal, world, type, tx, ty);
+    };
+
+    std::vector<std::pair<int, int>> seeds = {{x, y}};
+    while (!seeds.empty())
+    {
+        int sx = seeds.back().first;
+        int sy = seeds.back().second;
+        seeds.pop_back();
+        if (!matches(sx, sy))
+        {
+            continue;
+        }
+        int left = sx;
+        while (matches(left - 1, sy))
+        {
+            left--;
+        }
+        int right = sx;
+        while (matches(right + 1, sy))
+        {
+            right++;
+        }
+        for (int fx = left; fx <= right; ++fx)
+        {
+            edit_write(journal, game, fx, sy);
+        }
+        // One seed per run of matching tiles along the rows above and below
+        for (int ny = sy - 1; ny <= sy + 1; ny += 2)
+        {
+            bool in_run = false;
+            for (int fx = left; fx <= right; ++fx)
+            {
+                bool match = matches(fx, ny);
+                if (match && !in_run)
+                {
+                    seeds.push_back({fx, ny});
+                }
+                in_run = match;
+            }
+        }
+    }
+    return edit_commit(journal, game);
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "level_format.h"
+
+/*
+Edit log (.edl), the editor's changes since the level was last saved:
+
+  EditLogHeader (32 bytes, little endian)
+  records: EditLogRun (12 bytes) then length packed tile bytes
+
+A record is a run of tiles along a row, as the editor journal keeps them
+(edit_journal.h). The log only ever grows by appending, so an autosave
+writes a few hundred bytes however big the level is. base is the
+checksum of the .lvl file the log applies to: a full save writes a new
+.lvl and starts an empty log, and a log whose base does not match the
+.lvl beside it (the save finished but the log was not reset yet) is
+ignored. A record cut short by a crash mid-append ends the replay.
+*/
+
+const char EDIT_LOG_MAGIC[4] = {'D', 'E', 'D', 'L'};
+const uint16_t EDIT_LOG_VERSION = 1;
+
+struct EditLogHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t base; // checksum of the .lvl the records apply to
+    uint32_t reserved[3];
+};
+static_assert(sizeof(EditLogHeader) == 32, "EditLogHeader must stay 32 bytes");
+
+struct EditLogRun
+{
+    int32_t x;
+    int32_t y;
+    int32_t length;
+};
+static_assert(sizeof(EditLogRun) == 12, "EditLogRun must stay 12 bytes");
+
+// Maps "level_1.json" to "resources/levels/level_1.edl"
+inline std::string edit_log_path(const std::string &level_name)
+{
+    std::string path = binary_level_path(level_name);
+    return path.substr(0, path.size() - 4) + ".edl";
+}
+
+// Appends a record for tiles x to x + length - 1 of row y to out
+inline void edit_log_encode(std::vector<uint8_t> &out, int x, int y, int length, const uint8_t *tiles)
+{
+    EditLogRun run = {x, y, length};
+    const uint8_t *bytes = (const uint8_t *)&run;
+    out.insert(out.end(), bytes, bytes + sizeof(run));
+    out.insert(out.end(), tiles, tiles + length);
+}
+
+// The checksum in a .lvl header, without checking the tiles. False if there is no usable file.
+inline bool level_file_checksum(const std::string &path, uint32_t &checksum)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        return false;
+    }
+    LevelHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, LEVEL_MAGIC, sizeof(LEVEL_MAGIC)) == 0;
+    fclose(file);
+    checksum = header.checksum;
+    return ok;
+}
+
+// Replaces the log with an empty one for the level saved with checksum base
+inline bool edit_log_reset(const std::string &path, int width, int height, uint32_t base)
+{
+    EditLogHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EDIT_LOG_MAGIC, sizeof(header.magic));
+    header.version = EDIT_LOG_VERSION;
+    header.header_size = sizeof(EditLogHeader);
+    header.width = width;
+    header.height = height;
+    header.base = base;
+
+    FILE *file = fopen((path + ".tmp").c_str(), "wb");
+    if (!file)
+    {
+        LOG_ERROR(LOG_LEVEL, "Could not open %s for writing", path);
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+    ok = ok && rename((path + ".tmp").c_str(), path.c_str()) == 0;
+    if (!ok)
+    {
+        LOG_ERROR(LOG_LEVEL, "Failed writing edit log %s", path);
+    }
+    return ok;
+}
+
+// Reads the header of an existing log. False if there is none or it is not a log.
+inline bool edit_log_header(const std::string &path, EditLogHeader &header)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        return false;
+    }
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, EDIT_LOG_MAGIC, sizeof(EDIT_LOG_MAGIC)) == 0 &&
+              header.version <= EDIT_LOG_VERSION && header.header_size >= sizeof(EditLogHeader);
+    fclose(file);
+    return ok;
+}
+
+// Adds encoded records to the end of the log, which must exist
+inline bool edit_log_append(const std::string &path, const std::vector<uint8_t> &records)
+{
+    FILE *file = fopen(path.c_str(), "ab");
+    if (!file)
+    {
+        LOG_ERROR(LOG_LEVEL, "Could not open %s for appending", path);
+        return false;
+    }
+    bool ok = fwrite(records.data(), 1, records.size(), file) == records.size();
+    ok = (fclose(file) == 0) && ok;
+    return ok;
+}
+
+// Applies the log for a level to its packed tiles, if the log was written
+// against a .lvl with checksum base. Returns the number of records applied.
+inline int edit_log_replay(const std::string &path, int width, int height, uint32_t base, uint8_t *tiles)
+{
+    EditLogHeader header;
+    if (!edit_log_header(path, header) || header.base != base || (int)header.width != width || (int)header.height != height)
+    {
+        return 0;
+    }
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file || fseek(file, header.header_size, SEEK_SET) != 0)
+    {
+        if (file)
+        {
+            fclose(file);
+        }
+        return 0;
+    }
+
+    int applied = 0;
+    EditLogRun run;
+    std::vector<uint8_t> bytes;
+    while (fread(&run, sizeof(run), 1, file) == 1)
+    {
+        if (run.y < 0 || run.y >= height || run.x < 0 || run.length <= 0 || run.x + run.length > width)
+        {
+            LOG_WARN(LOG_LEVEL, "Edit log %s has a bad record, replayed %d", path, applied);
+            break;
+        }
+        bytes.resize(run.length);
+        if (fread(bytes.data(), 1, run.length, file) != (size_t)run.length)
+        {
+            break; // cut short mid-append
+        }
+        memcpy(tiles + (size_t)run.y * width + run.x, bytes.data(), run.length);
+        applied++;
+    }
+    fclose(file);
+    return applied;
+}
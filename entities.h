@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/*
+Entity storage. Entities that share the same set of components live in one
+Archetype, stored structure-of-arrays: one tightly packed column per
+component, all indexed by the entity's slot. Loops that only need
+positions stream through x and y without dragging health or damage
+through the cache, and batches of slots line up for SIMD.
+
+Slots are dense, [0, count). Removing an entity moves the last one into
+its slot.
+*/
+
+enum Component : uint32_t
+{
+    COMPONENT_POSITION = 1 << 0, // x, y in tiles
+    COMPONENT_HEALTH = 1 << 1,
+    COMPONENT_DAMAGE = 1 << 2
+};
+
+const uint32_t MOB_COMPONENTS = COMPONENT_POSITION | COMPONENT_HEALTH | COMPONENT_DAMAGE;
+const uint32_t PICKUP_COMPONENTS = COMPONENT_POSITION;
+
+struct Archetype
+{
+    uint32_t components = 0;
+    int count = 0;
+    std::vector<int32_t> x, y;   // COMPONENT_POSITION
+    std::vector<int32_t> health; // COMPONENT_HEALTH
+    std::vector<int32_t> damage; // COMPONENT_DAMAGE
+};
+
+inline bool archetype_has(const Archetype &archetype, uint32_t components)
+{
+    return (archetype.components & components) == components;
+}
+
+// Sets the component set and reserves room for capacity entities. Existing entities are dropped.
+inline void archetype_init(Archetype &archetype, uint32_t components, int capacity)
+{
+    archetype.components = components;
+    archetype.count = 0;
+    auto column = [&](std::vector<int32_t> &values, uint32_t component) {
+        values.clear();
+        if (components & component)
+        {
+            values.reserve(capacity);
+        }
+    };
+    column(archetype.x, COMPONENT_POSITION);
+    column(archetype.y, COMPONENT_POSITION);
+    column(archetype.health, COMPONENT_HEALTH);
+    column(archetype.damage, COMPONENT_DAMAGE);
+}
+
+inline void archetype_clear(Archetype &archetype)
+{
+    archetype.count = 0;
+    archetype.x.clear();
+    archetype.y.clear();
+    archetype.health.clear();
+    archetype.damage.clear();
+}
+
+// Appends a zeroed entity and returns its slot
+inline int archetype_add(Archetype &archetype)
+{
+    if (archetype.components & COMPONENT_POSITION)
+    {
+        archetype.x.push_back(0);
+        archetype.y.push_back(0);
+    }
+    if (archetype.components & COMPONENT_HEALTH)
+    {
+        archetype.health.push_back(0);
+    }
+    if (archetype.components & COMPONENT_DAMAGE)
+    {
+        archetype.damage.push_back(0);
+    }
+    return archetype.count++;
+}
+
+// Moves the last entity into slot i. Returns the slot it came from, which is now gone.
+inline int archetype_swap_remove(Archetype &archetype, int i)
+{
+    int last = archetype.count - 1;
+    auto column = [&](std::vector<int32_t> &values) {
+        if (!values.empty())
+        {
+            values[i] = values[last];
+            values.pop_back();
+        }
+    };
+    column(archetype.x);
+    column(archetype.y);
+    column(archetype.health);
+    column(archetype.damage);
+    archetype.count--;
+    return last;
+}
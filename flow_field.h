@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "profiler.h"
+#include "tile_types.h"
+#include "world.h"
+
+/*
+Distance field toward the player, shared by every mob. flow_field_build
+runs Dijkstra outward from the target over the loaded tiles, entering a
+tile costing its type's path_cost (water is dearer than grass), and a mob
+then steps to whichever neighbour has the lowest cost: one lookup per mob
+however many there are. The field is only rebuilt when the target moves
+or a tile or chunk changes, see flow_field_update.
+
+Path costs are small integers, so the frontier is a ring of
+FLOW_BUCKETS buckets (Dial's algorithm) and a build is linear in the
+tiles reached. Costs stop at FLOW_MAX_COST; mobs further away than that,
+or cut off from the player, are not in the field and wander instead.
+
+cost is indexed by world_index, so it covers the resident chunks only.
+*/
+
+const uint16_t FLOW_UNREACHED = 0xFFFF;
+const uint32_t FLOW_MAX_COST = 128; // furthest path cost mobs chase from, bounds the work per build
+const int FLOW_BUCKETS = TILE_MAX_PATH_COST + 1;
+
+struct FlowField
+{
+    std::vector<uint16_t> cost; // path cost to the target per tile, FLOW_UNREACHED if not in the field
+    int target_x = -1;
+    int target_y = -1;
+    bool dirty = true; // the world changed since the last build
+    std::vector<int32_t> buckets[FLOW_BUCKETS]; // frontier by cost % FLOW_BUCKETS, empty between builds
+};
+
+const int FLOW_DX[4] = {0, 0, -1, 1}; // by direction: up, down, left, right
+const int FLOW_DY[4] = {-1, 1, 0, 0};
+
+// world_index of the neighbour of tile in direction dir, -1 if it is not resident.
+// Neighbours in the same chunk are a fixed offset away.
+inline int flow_neighbour_index(const World &world, int tile, int dir)
+{
+    int local = tile & (CHUNK_TILES - 1);
+    int nx = (local & CHUNK_MASK) + FLOW_DX[dir];
+    int ny = (local >> CHUNK_SHIFT) + FLOW_DY[dir];
+    if ((unsigned)nx < (unsigned)CHUNK_SIZE && (unsigned)ny < (unsigned)CHUNK_SIZE)
+    {
+        return tile + FLOW_DX[dir] + FLOW_DY[dir] * CHUNK_SIZE;
+    }
+    int x = world_index_x(world, tile) + FLOW_DX[dir];
+    int y = world_index_y(world, tile) + FLOW_DY[dir];
+    return world_resident(world, x, y) ? (int)world_index(world, x, y) : -1;
+}
+
+// As flow_neighbour_index, but -1 unless the neighbour is traversable too
+inline int flow_neighbour(const World &world, int tile, int dir)
+{
+    int next = flow_neighbour_index(world, tile, dir);
+    if (next < 0)
+    {
+        return -1;
+    }
+    uint32_t word = world.walkable[(size_t)(next >> (2 * CHUNK_SHIFT)) * CHUNK_SIZE + ((next >> CHUNK_SHIFT) & CHUNK_MASK)];
+    return (word >> (next & CHUNK_MASK)) & 1 ? next : -1;
+}
+
+inline void flow_field_build(FlowField &field, const World &world, int target_x, int target_y)
+{
+    PROFILE_ZONE("flow_field");
+    field.cost.assign(world.tiles.size(), FLOW_UNREACHED);
+    field.target_x = target_x;
+    field.target_y = target_y;
+    field.dirty = false;
+    if (!world_resident(world, target_x, target_y))
+    {
+        return;
+    }
+
+    const TileTypeRegistry &types = tile_types();
+    int start = (int)world_index(world, target_x, target_y);
+    field.cost[start] = 0;
+    field.buckets[0].push_back(start);
+    size_t pending = 1;
+    for (uint32_t d = 0; pending > 0 && d <= FLOW_MAX_COST; ++d)
+    {
+        // Every step costs at least 1, so nothing joins this bucket while it is read
+        std::vector<int32_t> &bucket = field.buckets[d % FLOW_BUCKETS];
+        for (int32_t tile : bucket)
+        {
+            if (field.cost[tile] != d)
+            {
+                continue; // reached more cheaply since it was queued
+            }
+            for (int dir = 0; dir < 4; ++dir)
+            {
+                int next = flow_neighbour(world, tile, dir);
+                if (next < 0)
+                {
+                    continue;
+                }
+                uint32_t next_cost = d + types.info[world.tiles[next]].path_cost;
+                if (next_cost < field.cost[next] && next_cost <= FLOW_MAX_COST)
+                {
+                    field.cost[next] = (uint16_t)next_cost;
+                    field.buckets[next_cost % FLOW_BUCKETS].push_back(next);
+                    pending++;
+                }
+            }
+        }
+        pending -= bucket.size();
+        bucket.clear();
+    }
+    for (std::vector<int32_t> &bucket : field.buckets)
+    {
+        bucket.clear();
+    }
+}
+
+// Rebuilds the field if the target moved or the world changed since the last build
+inline void flow_field_update(FlowField &field, const World &world, int target_x, int target_y)
+{
+    if (field.dirty || field.target_x != target_x || field.target_y != target_y || field.cost.size() != world.tiles.size())
+    {
+        flow_field_build(field, world, target_x, target_y);
+    }
+}
+
+// Direction (0 up, 1 down, 2 left, 3 right) of the neighbour closest to the
+// target, ties going to the first one found scanning from first. -1 when no
+// neighbour is closer than (x, y), and first if (x, y) is not in the field.
+inline int flow_field_direction(const FlowField &field, const World &world, int x, int y, int first)
+{
+    int tile = (int)world_index(world, x, y);
+    uint16_t best = field.cost[tile];
+    if (best == FLOW_UNREACHED)
+    {
+        return first;
+    }
+    int dir = -1;
+    for (int k = 0; k < 4; ++k)
+    {
+        int candidate = (first + k) & 3;
+        int next = flow_neighbour_index(world, tile, candidate);
+        if (next >= 0 && field.cost[next] < best)
+        {
+            best = field.cost[next];
+            dir = candidate;
+        }
+    }
+    return dir;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "chunk_streamer.h"
+#include "entities.h"
+#include "flow_field.h"
+#include "thread_pool.h"
+#include "world.h"
+
+/*
+Game state shared by the simulation and the SplashKit front end. Nothing
+here depends on SplashKit. Player and mob positions are in tiles; the
+renderer multiplies by TILE_SIZE.
+*/
+
+enum GameState
+{
+    PLAYING,
+    GAME_OVER,
+    NOT_STARTED,
+    LEVELED,
+    EDITING
+};
+
+struct Para
+{
+    int SCREEN_WIDTH;
+    int SCREEN_HEIGHT;
+    int TILE_SIZE;
+    int NUM_TILES_X;
+    int NUM_TILES_Y;
+    int MAX_MOBS;
+    int TICK_SPEED;
+    int WATER_SPAWN_CHANCE;
+    int MAX_AIR;
+    int MAX_HEALTH;
+    int AIR_GAIN_RATE;
+    int AIR_LOSS_RATE;
+    int DROWN_THRESHOLD;
+    int MOB_MOVE_INTERVAL; // milliseconds
+    int BASE_MOBS_KILLED;
+    std::string FOOTSTEP_FIRST;
+    std::string FOOTSTEP_SECOND;
+    std::string WATER_SOUND_EFFECT;
+};
+
+// Small fast generator (xorshift64*) so runs can be replayed from a seed
+struct Rng
+{
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+};
+
+inline void rng_seed(Rng &rng, uint64_t seed)
+{
+    // splitmix64 step so nearby seeds give unrelated streams, and never zero
+    uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    rng.state = z ? z : 0x9E3779B97F4A7C15ull;
+}
+
+inline uint64_t rng_next(Rng &rng)
+{
+    rng.state ^= rng.state >> 12;
+    rng.state ^= rng.state << 25;
+    rng.state ^= rng.state >> 27;
+    return rng.state * 0x2545F4914F6CDD1Dull;
+}
+
+// Random number in [0, bound)
+inline int rng_range(Rng &rng, int bound)
+{
+    return (int)(((rng_next(rng) >> 32) * (uint64_t)bound) >> 32);
+}
+
+struct Player
+{
+    int x, y; // tile
+    int health;
+    bool has_key;
+    int air;
+    int mobs_killed;
+    int level;
+    int footstepValue;
+};
+
+// Things the simulation reports for the front end to play or print
+enum SimEventType
+{
+    EVENT_FOOTSTEP,    // value: 0 first footstep, 1 second footstep
+    EVENT_AIR_FULL,    // value: current air
+    EVENT_HEALTH_FULL,
+    EVENT_KEY_EARNED,
+    EVENT_LEVELED,     // value: new level
+    EVENT_GAME_WON,
+    EVENT_PLAYER_DIED,
+    EVENT_SPAWN_BLOCKED // value: mobs that could not spawn for lack of free tiles
+};
+
+struct SimEvent
+{
+    SimEventType type;
+    int value;
+};
+
+const int MOB_REGION_SIZE = 64; // mobs are updated in square map regions this many tiles across
+
+// Per-region scratch for move_mobs
+struct MobRegion
+{
+    std::vector<int32_t> mobs;     // mobs standing in the region at the start of the step, in slot order
+    std::vector<int32_t> deferred; // mob, target tile pairs for moves that leave the region
+};
+
+struct Game
+{
+    Player player;
+    World world;
+    Archetype mobs;                  // MOB_COMPONENTS, slot i is mob i
+    std::vector<int32_t> mob_at;     // index of the mob on each tile, -1 if empty
+    std::vector<int32_t> free_tiles; // traversable tiles with no mob on them, in no order
+    std::vector<int32_t> free_slot;  // position of each tile in free_tiles, -1 if not free
+    GameState state = NOT_STARTED;
+    int tick_counter = 0;   // Counter for tick system
+    int mob_move_ticks = 0; // ticks since the mobs last moved
+    std::string map;
+    Rng rng;
+    std::vector<SimEvent> events;        // filled by the simulation, drained by the front end
+    std::vector<MobRegion> regions;      // MOB_REGION_SIZE squares, row-major
+    int regions_x = 0;                   // regions per row
+    std::vector<int32_t> active_regions; // regions with mobs in them this step
+    ThreadPool *pool = nullptr;          // workers for move_mobs, nullptr runs it on the caller
+    ChunkStreamer *streamer = nullptr;   // reads streamed chunks ahead, nullptr reads them on demand
+    FlowField flow;                      // path costs to the player that mobs follow
+    int stream_chunk = -1;               // chunk the player was in when sim_stream last ran
+};
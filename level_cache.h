@@ -0,0 +1,225 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include "level_io.h"
+
+/*
+Keeps parsed levels resident so switching levels does not touch the disk.
+Entries are evicted least recently used first. A worker thread loads
+levels queued with level_cache_prefetch, so the next level can be parsed
+while the LEVELED screen is showing.
+*/
+
+struct CachedLevel
+{
+    string name;
+    World world;
+    bool loading = false; // the worker is still parsing it
+    bool failed = false;  // the last load attempt found no usable level
+    uint64_t last_used = 0;
+    uint64_t generation = 0; // changed by each level_cache_store, so a load started before it is not published
+};
+
+struct LevelCache
+{
+    size_t capacity = 4;
+    vector<CachedLevel> entries;
+    uint64_t clock = 0;  // bumped on every use, for LRU ordering
+    uint64_t stores = 0; // bumped on every level_cache_store, for entry generations
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<string> pending; // names waiting for the worker
+    std::thread worker;
+    bool stopping = false;
+};
+
+// Returns the entry for name or nullptr. Caller holds the cache mutex.
+inline CachedLevel *level_cache_find(LevelCache &cache, const string &name)
+{
+    for (CachedLevel &entry : cache.entries)
+    {
+        if (entry.name == name)
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+// Drops least recently used entries until the cache fits. Caller holds the cache mutex.
+inline void level_cache_evict(LevelCache &cache)
+{
+    while (cache.entries.size() > cache.capacity)
+    {
+        int oldest = -1;
+        for (int i = 0; i < (int)cache.entries.size(); ++i)
+        {
+            if (!cache.entries[i].loading && (oldest < 0 || cache.entries[i].last_used < cache.entries[oldest].last_used))
+            {
+                oldest = i;
+            }
+        }
+        if (oldest < 0)
+        {
+            return; // everything is still loading
+        }
+        LOG_DEBUG(LOG_LEVEL, "Level cache evicted %s", cache.entries[oldest].name);
+        cache.entries.erase(cache.entries.begin() + oldest);
+    }
+}
+
+// Creates an entry marked as loading. Caller holds the cache mutex.
+inline CachedLevel &level_cache_reserve(LevelCache &cache, const string &name)
+{
+    CachedLevel *entry = level_cache_find(cache, name);
+    if (!entry)
+    {
+        cache.entries.push_back(CachedLevel());
+        entry = &cache.entries.back();
+        entry->name = name;
+    }
+    entry->loading = true;
+    entry->failed = false;
+    entry->last_used = ++cache.clock;
+    return *entry;
+}
+
+// Parses name outside the lock and publishes the result into its reserved entry,
+// unless the editor stored a newer copy meanwhile: the file may still be the old level
+inline void level_cache_load(LevelCache &cache, const string &name, std::unique_lock<std::mutex> &lock)
+{
+    CachedLevel *entry = level_cache_find(cache, name);
+    uint64_t generation = entry ? entry->generation : 0;
+    World world;
+    lock.unlock();
+    bool loaded = load_level(name, world);
+    lock.lock();
+
+    entry = level_cache_find(cache, name);
+    if (entry && entry->generation == generation)
+    {
+        entry->world = std::move(world);
+        entry->failed = !loaded;
+        entry->loading = false;
+    }
+    level_cache_evict(cache);
+    cache.changed.notify_all();
+}
+
+inline void level_cache_worker(LevelCache &cache)
+{
+    std::unique_lock<std::mutex> lock(cache.mutex);
+    while (true)
+    {
+        cache.changed.wait(lock, [&cache] { return cache.stopping || !cache.pending.empty(); });
+        if (cache.stopping)
+        {
+            return;
+        }
+
+        string name = cache.pending.front();
+        cache.pending.pop_front();
+
+        CachedLevel *entry = level_cache_find(cache, name);
+        if (entry && !entry->failed)
+        {
+            continue; // already resident, or being loaded on the main thread
+        }
+        level_cache_reserve(cache, name);
+        level_cache_load(cache, name, lock);
+    }
+}
+
+inline void level_cache_start(LevelCache &cache, size_t capacity)
+{
+    cache.capacity = capacity;
+    cache.stopping = false;
+    cache.worker = std::thread(level_cache_worker, std::ref(cache));
+}
+
+inline void level_cache_stop(LevelCache &cache)
+{
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cache.stopping = true;
+    }
+    cache.changed.notify_all();
+    if (cache.worker.joinable())
+    {
+        cache.worker.join();
+    }
+}
+
+// Queues name for the worker and returns straight away
+inline void level_cache_prefetch(LevelCache &cache, const string &name)
+{
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        CachedLevel *entry = level_cache_find(cache, name);
+        if (entry && !entry->failed)
+        {
+            entry->last_used = ++cache.clock;
+            return; // resident or already on its way
+        }
+        cache.pending.push_back(name);
+    }
+    cache.changed.notify_all();
+}
+
+// Copies the cached level into world, waiting for the worker if it is mid-load
+// and loading on this thread on a miss. Returns false if the level cannot be loaded.
+inline bool level_cache_get(LevelCache &cache, const string &name, World &world)
+{
+    std::unique_lock<std::mutex> lock(cache.mutex);
+    CachedLevel *entry = level_cache_find(cache, name);
+    if (!entry || entry->failed)
+    {
+        level_cache_reserve(cache, name);
+        level_cache_load(cache, name, lock);
+    }
+    else
+    {
+        cache.changed.wait(lock, [&cache, &name] {
+            CachedLevel *e = level_cache_find(cache, name);
+            return !e || !e->loading;
+        });
+    }
+
+    entry = level_cache_find(cache, name);
+    if (!entry || entry->failed)
+    {
+        return false;
+    }
+    entry->last_used = ++cache.clock;
+    world = entry->world;
+    return true;
+}
+
+// Replaces the cached copy after the editor saves a level
+inline void level_cache_store(LevelCache &cache, const string &name, const World &world)
+{
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    CachedLevel &entry = level_cache_reserve(cache, name);
+    entry.world = world;
+    entry.loading = false;
+    entry.generation = ++cache.stores;
+    level_cache_evict(cache);
+}
+
+// Adds a level parsed elsewhere unless the cache already has it or is loading it,
+// so a copy the editor stored is never replaced by an older one
+inline void level_cache_offer(LevelCache &cache, const string &name, World &&world)
+{
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if (level_cache_find(cache, name))
+    {
+        return;
+    }
+    CachedLevel &entry = level_cache_reserve(cache, name);
+    entry.world = std::move(world);
+    entry.loading = false;
+    level_cache_evict(cache);
+}
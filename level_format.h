@@ -0,0 +1,316 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log.h"
+
+/*
+Binary level format (.lvl)
+
+  LevelHeader (32 bytes, little endian)
+  width * height tile bytes, row-major (index = y * width + x)
+
+Each tile byte packs the TileType in the low 7 bits and the traversable
+flag in the top bit, so a level round-trips with the JSON layout exactly.
+*/
+
+const char LEVEL_MAGIC[4] = {'D', 'L', 'V', 'L'};
+const uint16_t LEVEL_FORMAT_VERSION = 1;
+const uint8_t TILE_TRAVERSABLE_BIT = 0x80;
+const uint8_t TILE_TYPE_MASK = 0x7F;
+const std::string LEVEL_BINARY_DIR = "resources/levels/";
+const size_t LEVEL_CHECK_WINDOW = 4 << 20; // bytes checksummed at a time
+
+struct LevelHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t checksum; // CRC-32 of the tile bytes
+    uint32_t reserved[3];
+};
+static_assert(sizeof(LevelHeader) == 32, "LevelHeader must stay 32 bytes");
+
+// A level file mapped read-only into memory. tiles points straight into the mapping.
+struct MappedLevel
+{
+    void *base = nullptr;
+    size_t size = 0;
+    int width = 0;
+    int height = 0;
+    const uint8_t *tiles = nullptr;
+};
+
+// Packed tiles for a whole level, either mapped from a .lvl file or held in
+// memory. Shared by every World streaming chunks out of it.
+struct LevelSource
+{
+    int width = 0;
+    int height = 0;
+    const uint8_t *tiles = nullptr; // row-major packed tile bytes
+    MappedLevel mapped;             // set when tiles point into a mapped file
+    std::vector<uint8_t> bytes;     // set when the level was built in memory
+
+    LevelSource() = default;
+    LevelSource(const LevelSource &) = delete;
+    LevelSource &operator=(const LevelSource &) = delete;
+    ~LevelSource();
+};
+
+inline uint8_t pack_tile(int type, bool traversable)
+{
+    return (uint8_t)((type & TILE_TYPE_MASK) | (traversable ? TILE_TRAVERSABLE_BIT : 0));
+}
+
+inline int tile_byte_type(uint8_t tile)
+{
+    return tile & TILE_TYPE_MASK;
+}
+
+inline bool tile_byte_traversable(uint8_t tile)
+{
+    return (tile & TILE_TRAVERSABLE_BIT) != 0;
+}
+
+struct Crc32Table
+{
+    uint32_t entries[256];
+
+    Crc32Table()
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+            {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[i] = c;
+        }
+    }
+};
+
+
+// Maps "level_1.json" (or "level_1") to "resources/levels/level_1.lvl"
+inline std::string binary_level_path(const std::string &level_name)
+{
+    std::string stem = level_name;
+    size_t slash = stem.find_last_of('/');
+    if (slash != std::string::npos)
+    {
+        stem = stem.substr(slash + 1);
+    }
+    size_t dot = stem.rfind('.');
+    if (dot != std::string::npos)
+    {
+        stem = stem.substr(0, dot);
+    }
+    return LEVEL_BINARY_DIR + stem + ".lvl";
+}
+
+// Continues a CRC-32 over more data; start from 0
+inline uint32_t level_checksum_update(uint32_t crc, const uint8_t *data, size_t length)
+{
+    static const Crc32Table table;
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; ++i)
+    {
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Writes a level one row at a time, for levels too big to build in memory.
+// The rows go to a temporary file that replaces path on close, so a world
+// still streaming from the old file never sees it half written.
+struct LevelWriter
+{
+    FILE *file = nullptr;
+    std::string path;
+    LevelHeader header;
+    bool ok = false;
+};
+
+inline bool level_writer_open(LevelWriter &writer, const std::string &path, int width, int height)
+{
+    memset(&writer.header, 0, sizeof(writer.header));
+    memcpy(writer.header.magic, LEVEL_MAGIC, sizeof(writer.header.magic));
+    writer.header.version = LEVEL_FORMAT_VERSION;
+    writer.header.header_size = sizeof(LevelHeader);
+    writer.header.width = width;
+    writer.header.height = height;
+    writer.path = path;
+
+    // Make sure the level directory exists, the first save creates it
+    size_t slash = path.find_last_of('/');
+    if (slash != std::string::npos)
+    {
+        mkdir(path.substr(0, slash).c_str(), 0755);
+    }
+
+    writer.file = fopen((path + ".tmp").c_str(), "wb");
+    if (!writer.file)
+    {
+        LOG_ERROR(LOG_LEVEL, "Could not open %s for writing", path);
+        return false;
+    }
+    // The header is written again with the checksum once every row is in
+    writer.ok = fwrite(&writer.header, sizeof(writer.header), 1, writer.file) == 1;
+    return writer.ok;
+}
+
+inline void level_writer_row(LevelWriter &writer, const uint8_t *tiles, size_t count)
+{
+    writer.header.checksum = level_checksum_update(writer.header.checksum, tiles, count);
+    writer.ok = writer.ok && fwrite(tiles, 1, count, writer.file) == count;
+}
+
+inline bool level_writer_close(LevelWriter &writer)
+{
+    writer.ok = writer.ok && fseek(writer.file, 0, SEEK_SET) == 0 &&
+                fwrite(&writer.header, sizeof(writer.header), 1, writer.file) == 1;
+    writer.ok = (fclose(writer.file) == 0) && writer.ok;
+    writer.file = nullptr;
+    writer.ok = writer.ok && rename((writer.path + ".tmp").c_str(), writer.path.c_str()) == 0;
+    if (!writer.ok)
+    {
+        LOG_ERROR(LOG_LEVEL, "Failed writing level %s", writer.path);
+    }
+    return writer.ok;
+}
+
+inline bool write_level_binary(const std::string &path, int width, int height, const uint8_t *tiles)
+{
+    LevelWriter writer;
+    if (!level_writer_open(writer, path, width, height))
+    {
+        return false;
+    }
+    level_writer_row(writer, tiles, (size_t)width * height);
+    return level_writer_close(writer);
+}
+
+// Table driven CRC-32 (IEEE polynomial)
+inline uint32_t level_checksum(const uint8_t *data, size_t length)
+{
+    return level_checksum_update(0, data, length);
+}
+
+inline void unmap_level(MappedLevel &level)
+{
+    if (level.base)
+    {
+        munmap(level.base, level.size);
+    }
+    level = MappedLevel();
+}
+
+// Maps a .lvl file and validates its header and checksum. No per-tile parsing is done.
+inline bool map_level_binary(const std::string &path, MappedLevel &level)
+{
+    level = MappedLevel();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(LevelHeader))
+    {
+        close(fd);
+        LOG_WARN(LOG_LEVEL, "Level %s is too small to be a level file", path);
+        return false;
+    }
+
+    void *base = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping stays valid after the descriptor is closed
+    if (base == MAP_FAILED)
+    {
+        LOG_ERROR(LOG_LEVEL, "Could not map level %s", path);
+        return false;
+    }
+
+    level.base = base;
+    level.size = info.st_size;
+
+    const LevelHeader *header = (const LevelHeader *)base;
+    if (memcmp(header->magic, LEVEL_MAGIC, sizeof(LEVEL_MAGIC)) != 0)
+    {
+        LOG_WARN(LOG_LEVEL, "Level %s has a bad magic number", path);
+        unmap_level(level);
+        return false;
+    }
+    if (header->version > LEVEL_FORMAT_VERSION || header->header_size < sizeof(LevelHeader))
+    {
+        LOG_WARN(LOG_LEVEL, "Level %s has unsupported version %d", path, header->version);
+        unmap_level(level);
+        return false;
+    }
+
+    size_t tile_count = (size_t)header->width * header->height;
+    if (header->header_size + tile_count > level.size)
+    {
+        LOG_WARN(LOG_LEVEL, "Level %s is truncated", path);
+        unmap_level(level);
+        return false;
+    }
+
+    // Levels bigger than one window are checked a window at a time and
+    // each window's pages handed back, so checking a huge level does not
+    // pull all of it into memory
+    const uint8_t *tiles = (const uint8_t *)base + header->header_size;
+    uint32_t checksum = 0;
+    for (size_t offset = 0; offset < tile_count; offset += LEVEL_CHECK_WINDOW)
+    {
+        size_t length = std::min(LEVEL_CHECK_WINDOW, tile_count - offset);
+        checksum = level_checksum_update(checksum, tiles + offset, length);
+        if (tile_count > LEVEL_CHECK_WINDOW)
+        {
+            size_t page = sysconf(_SC_PAGESIZE);
+            uintptr_t start = ((uintptr_t)tiles + offset) & ~(uintptr_t)(page - 1);
+            madvise((void *)start, (uintptr_t)tiles + offset + length - start, MADV_DONTNEED);
+        }
+    }
+    if (checksum != header->checksum)
+    {
+        LOG_WARN(LOG_LEVEL, "Level %s failed its checksum", path);
+        unmap_level(level);
+        return false;
+    }
+
+    level.width = header->width;
+    level.height = header->height;
+    level.tiles = tiles;
+    return true;
+}
+
+inline LevelSource::~LevelSource()
+{
+    unmap_level(mapped);
+}
+
+// Maps a .lvl file for streaming. Only the chunks actually read stay in memory.
+inline bool open_level_source(const std::string &path, LevelSource &source)
+{
+    if (!map_level_binary(path, source.mapped))
+    {
+        return false;
+    }
+    source.width = source.mapped.width;
+    source.height = source.mapped.height;
+    source.tiles = source.mapped.tiles;
+    return true;
+}
@@ -0,0 +1,449 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "game.h"
+#include "level_format.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+/*
+Seeded procedural levels, written straight as packed tile bytes (see
+level_format.h). The same options and seed always give the same level.
+
+The level is cut into LEVEL_GEN_SECTOR square sectors, the last one in
+each row and column taking the remainder, and every sector is generated
+on its own from a seed of its own, so sectors run in parallel and a level
+of any size is written a band of sectors at a time. Two neighbouring
+sectors agree on a gate, a tile pair across their shared edge picked from
+the level seed. Inside a sector:
+
+  rooms  random rooms joined in order by L-shaped corridors
+  caves  random fill smoothed by a cellular automaton
+
+then a corridor is carved from every gate to the sector's anchor, and
+floor not joined to the anchor is walled up. Every sector is one area
+touching all of its gates, so the whole level is one area: the player
+spawns on the first sector's anchor, mobs only ever spawn where the
+player can reach, and the door goes on a wall beside the floor tile of
+the last sector that is furthest from its anchor, so it is reachable and
+never blocks a passage.
+*/
+
+enum LevelGenMode
+{
+    LEVEL_GEN_ROOMS,
+    LEVEL_GEN_CAVES
+};
+
+const int LEVEL_GEN_SECTOR = 64; // sector side in tiles
+const int LEVEL_GEN_MIN_SIZE = 5;
+const int LEVEL_GEN_CAVE_FILL = 45; // percent of a cave sector that starts as wall
+const int LEVEL_GEN_CAVE_STEPS = 4;
+
+struct LevelGenOptions
+{
+    int width = 0;
+    int height = 0;
+    uint64_t seed = 0;
+    LevelGenMode mode = LEVEL_GEN_ROOMS;
+    int water_chance = 3; // in ten, per floor tile, like Para::WATER_SPAWN_CHANCE
+};
+
+struct LevelGenResult
+{
+    int spawn_x = -1;
+    int spawn_y = -1;
+    int door_x = -1;
+    int door_y = -1;
+};
+
+// Scratch for one sector, reused by the thread that generates it
+struct LevelGenScratch
+{
+    std::vector<uint8_t> cells; // 1 floor, 0 wall, 2 floor joined to the anchor
+    std::vector<uint8_t> next;
+    std::vector<int32_t> order; // joined floor, nearest the anchor first
+};
+
+inline const char *level_gen_mode_name(LevelGenMode mode)
+{
+    return mode == LEVEL_GEN_CAVES ? "caves" : "rooms";
+}
+
+inline bool level_gen_parse_mode(const std::string &name, LevelGenMode &mode)
+{
+    if (name == "rooms" || name == "caves")
+    {
+        mode = name == "caves" ? LEVEL_GEN_CAVES : LEVEL_GEN_ROOMS;
+        return true;
+    }
+    return false;
+}
+
+// Sectors along one side of length tiles
+inline int level_gen_sectors(int length)
+{
+    return std::max(1, length / LEVEL_GEN_SECTOR);
+}
+
+// First tile of sector s along a side of length tiles; s == count gives the end
+inline int level_gen_sector_start(int length, int s)
+{
+    return s >= level_gen_sectors(length) ? length : s * LEVEL_GEN_SECTOR;
+}
+
+inline uint64_t level_gen_key(uint64_t seed, uint64_t key)
+{
+    Rng rng;
+    rng_seed(rng, seed ^ (key * 0xD1B54A32D192ED03ull));
+    return rng_next(rng);
+}
+
+// Row of the gate between sectors (sx, sy) and (sx + 1, sy), or column of
+// the one between (sx, sy) and (sx, sy + 1), away from the level border
+inline int level_gen_gate(const LevelGenOptions &options, int sx, int sy, bool vertical_edge)
+{
+    int sector = sy * level_gen_sectors(options.width) + sx;
+    int length = vertical_edge ? options.height : options.width;
+    int s = vertical_edge ? sy : sx;
+    int first = std::max(1, level_gen_sector_start(length, s));
+    int last = std::min(length - 1, level_gen_sector_start(length, s + 1)) - 1;
+    uint64_t key = level_gen_key(options.seed, (uint64_t)sector * 2 + vertical_edge);
+    return first + (int)(key % (uint64_t)(last - first + 1));
+}
+
+// Makes the cells on an L-shaped path from (x0, y0) to (x1, y1) floor
+inline void level_gen_carve(std::vector<uint8_t> &cells, int w, int x0, int y0, int x1, int y1)
+{
+    for (int x = std::min(x0, x1); x <= std::max(x0, x1); ++x)
+    {
+        cells[y0 * w + x] = 1;
+    }
+    for (int y = std::min(y0, y1); y <= std::max(y0, y1); ++y)
+    {
+        cells[y * w + x1] = 1;
+    }
+}
+
+// Rooms of 3 to 10 tiles a side inside the sector margin, each joined to
+// the one before. The anchor is the centre of the first room.
+inline void level_gen_rooms(Rng &rng, std::vector<uint8_t> &cells, int w, int h, int &anchor_x, int &anchor_y)
+{
+    int inner_w = w - 2;
+    int inner_h = h - 2;
+    int rooms = std::max(1, w * h / 160);
+    int prev_x = -1, prev_y = -1;
+    for (int r = 0; r < rooms; ++r)
+    {
+        int rw = std::min(inner_w, 3 + rng_range(rng, 8));
+        int rh = std::min(inner_h, 3 + rng_range(rng, 8));
+        int rx = 1 + rng_range(rng, inner_w - rw + 1);
+        int ry = 1 + rng_range(rng, inner_h - rh + 1);
+        for (int y = ry; y < ry + rh; ++y)
+        {
+            std::fill(cells.begin() + y * w + rx, cells.begin() + y * w + rx + rw, 1);
+        }
+        int cx = rx + rw / 2;
+        int cy = ry + rh / 2;
+        if (r == 0)
+        {
+            anchor_x = cx;
+            anchor_y = cy;
+        }
+        else
+        {
+            level_gen_carve(cells, w, prev_x, prev_y, cx, cy);
+        }
+        prev_x = cx;
+        prev_y = cy;
+    }
+}
+
+// Random fill, then LEVEL_GEN_CAVE_STEPS rounds of: a cell is wall when at
+// least 5 of the 9 cells around it, itself included, are wall. Cells
+// outside the sector count as wall, so caves close off at sector edges.
+inline void level_gen_caves(Rng &rng, LevelGenScratch &scratch, int w, int h, int &anchor_x, int &anchor_y)
+{
+    std::vector<uint8_t> &cells = scratch.cells;
+    for (int y = 1; y < h - 1; ++y)
+    {
+        for (int x = 1; x < w - 1; ++x)
+        {
+            cells[y * w + x] = rng_range(rng, 100) >= LEVEL_GEN_CAVE_FILL;
+        }
+    }
+    scratch.next.assign(cells.size(), 0);
+    for (int step = 0; step < LEVEL_GEN_CAVE_STEPS; ++step)
+    {
+        for (int y = 1; y < h - 1; ++y)
+        {
+            const uint8_t *above = &cells[(y - 1) * w];
+            const uint8_t *row = &cells[y * w];
+            const uint8_t *below = &cells[(y + 1) * w];
+            uint8_t *out = &scratch.next[y * w];
+            // floor in the column of three at x - 1 and x, slid along the row
+            int left = above[0] + row[0] + below[0];
+            int middle = above[1] + row[1] + below[1];
+            for (int x = 1; x < w - 1; ++x)
+            {
+                int right = above[x + 1] + row[x + 1] + below[x + 1];
+                out[x] = left + middle + right >= 5;
+                left = middle;
+                middle = right;
+            }
+        }
+        cells.swap(scratch.next);
+    }
+
+    // Anchor in the biggest cave, so walling up the rest loses little
+    int anchor = (1 + rng_range(rng, h - 2)) * w + 1 + rng_range(rng, w - 2);
+    size_t biggest = 0;
+    std::vector<int32_t> &stack = scratch.order;
+    for (int start = 0; start < w * h; ++start)
+    {
+        if (cells[start] != 1)
+        {
+            continue;
+        }
+        size_t size = 0;
+        stack.assign(1, start);
+        cells[start] = 3;
+        while (!stack.empty())
+        {
+            int cell = stack.back();
+            stack.pop_back();
+            size++;
+            // the ring of the sector is always wall, so every neighbour is in it
+            for (int n : {cell - 1, cell + 1, cell - w, cell + w})
+            {
+                if (cells[n] == 1)
+                {
+                    cells[n] = 3;
+                    stack.push_back(n);
+                }
+            }
+        }
+        if (size > biggest)
+        {
+            biggest = size;
+            anchor = start;
+        }
+    }
+    for (uint8_t &cell : cells)
+    {
+        cell = cell != 0;
+    }
+    anchor_x = anchor % w;
+    anchor_y = anchor / w;
+}
+
+// Generates sector (sx, sy) into out, which holds level rows from out_y
+// on with stride level width. Fills in the spawn for the first sector and
+// the door for the last.
+inline void level_gen_sector(const LevelGenOptions &options, int sx, int sy, uint8_t *out, int out_y, LevelGenResult &result)
+{
+    thread_local LevelGenScratch scratch;
+    int sectors_x = level_gen_sectors(options.width);
+    int sectors_y = level_gen_sectors(options.height);
+    int x0 = level_gen_sector_start(options.width, sx);
+    int y0 = level_gen_sector_start(options.height, sy);
+    int w = level_gen_sector_start(options.width, sx + 1) - x0;
+    int h = level_gen_sector_start(options.height, sy + 1) - y0;
+
+    Rng rng;
+    rng_seed(rng, level_gen_key(options.seed, ((uint64_t)sy << 32 | (uint64_t)sx) + 1));
+    std::vector<uint8_t> &cells = scratch.cells;
+    cells.assign((size_t)w * h, 0);
+    int anchor_x, anchor_y;
+    if (options.mode == LEVEL_GEN_CAVES)
+    {
+        level_gen_caves(rng, scratch, w, h, anchor_x, anchor_y);
+    }
+    else
+    {
+        level_gen_rooms(rng, cells, w, h, anchor_x, anchor_y);
+    }
+
+    // Join every gate to the anchor, in sector coordinates
+    if (sx > 0)
+    {
+        level_gen_carve(cells, w, 0, level_gen_gate(options, sx - 1, sy, true) - y0, anchor_x, anchor_y);
+    }
+    if (sx < sectors_x - 1)
+    {
+        level_gen_carve(cells, w, w - 1, level_gen_gate(options, sx, sy, true) - y0, anchor_x, anchor_y);
+    }
+    if (sy > 0)
+    {
+        level_gen_carve(cells, w, anchor_x, anchor_y, level_gen_gate(options, sx, sy - 1, false) - x0, 0);
+    }
+    if (sy < sectors_y - 1)
+    {
+        level_gen_carve(cells, w, anchor_x, anchor_y, level_gen_gate(options, sx, sy, false) - x0, h - 1);
+    }
+    cells[anchor_y * w + anchor_x] = 1;
+
+    // Breadth-first from the anchor, so order ends on the furthest floor
+    std::vector<int32_t> &order = scratch.order;
+    order.clear();
+    order.push_back(anchor_y * w + anchor_x);
+    cells[order[0]] = 2;
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        int cell = order[i];
+        int x = cell % w;
+        int y = cell / w;
+        int neighbours[4] = {x > 0 ? cell - 1 : -1, x < w - 1 ? cell + 1 : -1, y > 0 ? cell - w : -1, y < h - 1 ? cell + w : -1};
+        for (int n : neighbours)
+        {
+            if (n >= 0 && cells[n] == 1)
+            {
+                cells[n] = 2;
+                order.push_back(n);
+            }
+        }
+    }
+
+    const uint8_t wall = pack_tile(WALL, false);
+    const uint8_t grass = pack_tile(GRASS, true);
+    const uint8_t water = pack_tile(WATER, true);
+    for (int y = 0; y < h; ++y)
+    {
+        uint8_t *row = out + (size_t)(y0 + y - out_y) * options.width + x0;
+        const uint8_t *cell = &cells[y * w];
+        for (int x = 0; x < w; ++x)
+        {
+            row[x] = cell[x] != 2 ? wall : rng_range(rng, 10) < options.water_chance ? water : grass;
+        }
+    }
+
+    if (sx == 0 && sy == 0)
+    {
+        out[(size_t)(y0 + anchor_y - out_y) * options.width + x0 + anchor_x] = grass;
+        result.spawn_x = x0 + anchor_x;
+        result.spawn_y = y0 + anchor_y;
+    }
+    if (sx == sectors_x - 1 && sy == sectors_y - 1)
+    {
+        // A wall beside the furthest floor that can take the door. Walls
+        // never carry a path, so the door cannot cut the area in two.
+        for (size_t i = order.size(); i-- > 0 && result.door_x < 0;)
+        {
+            int x = order[i] % w;
+            int y = order[i] / w;
+            int around[4][2] = {{x - 1, y}, {x + 1, y}, {x, y - 1}, {x, y + 1}};
+            for (auto &n : around)
+            {
+                int lx = x0 + n[0];
+                int ly = y0 + n[1];
+                if (n[0] >= 0 && n[0] < w && n[1] >= 0 && n[1] < h && cells[n[1] * w + n[0]] != 2 && lx > 0 && ly > 0 &&
+                    lx < options.width - 1 && ly < options.height - 1)
+                {
+                    result.door_x = lx;
+                    result.door_y = ly;
+                    break;
+                }
+            }
+        }
+        if (result.door_x < 0 && order.size() > 1)
+        {
+            // A level too small to have such a wall: the furthest floor itself
+            result.door_x = x0 + order.back() % w;
+            result.door_y = y0 + order.back() / w;
+        }
+        if (result.door_x >= 0)
+        {
+            out[(size_t)(result.door_y - out_y) * options.width + result.door_x] = pack_tile(DOOR, false);
+        }
+    }
+}
+
+// Generates sector row sy into band, which holds those rows of the level
+inline void level_gen_band(const LevelGenOptions &options, int sy, uint8_t *band, ThreadPool *pool, LevelGenResult &result)
+{
+    int out_y = level_gen_sector_start(options.height, sy);
+    thread_pool_run(pool, level_gen_sectors(options.width),
+                    [&](int sx) { level_gen_sector(options, sx, sy, band, out_y, result); });
+}
+
+inline bool level_gen_valid(const LevelGenOptions &options)
+{
+    return options.width >= LEVEL_GEN_MIN_SIZE && options.height >= LEVEL_GEN_MIN_SIZE &&
+           (uint64_t)options.width * options.height <= (uint64_t)UINT32_MAX;
+}
+
+// Generates the whole level into tiles, the sectors spread over pool
+inline bool level_generate(const LevelGenOptions &options, std::vector<uint8_t> &tiles, LevelGenResult &result,
+                           ThreadPool *pool = nullptr)
+{
+    PROFILE_ZONE("level_generate");
+    if (!level_gen_valid(options))
+    {
+        return false;
+    }
+    result = LevelGenResult();
+    tiles.resize((size_t)options.width * options.height);
+    int sectors_x = level_gen_sectors(options.width);
+    thread_pool_run(pool, sectors_x * level_gen_sectors(options.height), [&](int sector) {
+        level_gen_sector(options, sector % sectors_x, sector / sectors_x, tiles.data(), 0, result);
+    });
+    return result.door_x >= 0;
+}
+
+// Generates the level straight into a .lvl file a band of sectors at a
+// time, so memory stays at one band whatever the level size
+inline bool level_generate_file(const std::string &path, const LevelGenOptions &options, LevelGenResult &result,
+                                ThreadPool *pool = nullptr)
+{
+    PROFILE_ZONE("level_generate_file");
+    LevelWriter writer;
+    if (!level_gen_valid(options) || !level_writer_open(writer, path, options.width, options.height))
+    {
+        return false;
+    }
+    result = LevelGenResult();
+    std::vector<uint8_t> band;
+    for (int sy = 0; sy < level_gen_sectors(options.height); ++sy)
+    {
+        int rows = level_gen_sector_start(options.height, sy + 1) - level_gen_sector_start(options.height, sy);
+        band.resize((size_t)rows * options.width);
+        level_gen_band(options, sy, band.data(), pool, result);
+        level_writer_row(writer, band.data(), band.size());
+    }
+    return level_writer_close(writer) && result.door_x >= 0;
+}
+
+// Stands in for a level that has no file: generates one the size of the
+// screen from the run's random stream, so a replay of the run generates it
+// again, and puts the player on its spawn tile. Odd levels are rooms, even
+// levels caves.
+inline bool level_gen_fallback(const Para &p, Game &game, World &world)
+{
+    LevelGenOptions options;
+    options.width = p.NUM_TILES_X;
+    options.height = p.NUM_TILES_Y;
+    options.seed = rng_next(game.rng);
+    options.mode = game.player.level % 2 ? LEVEL_GEN_ROOMS : LEVEL_GEN_CAVES;
+    options.water_chance = p.WATER_SPAWN_CHANCE;
+
+    auto source = std::make_shared<LevelSource>();
+    LevelGenResult result;
+    if (!level_generate(options, source->bytes, result, game.pool))
+    {
+        LOG_ERROR(LOG_LEVEL, "Could not generate a %dx%d level for %s", options.width, options.height, game.map);
+        return false;
+    }
+    source->width = options.width;
+    source->height = options.height;
+    source->tiles = source->bytes.data();
+    world_open(world, source);
+    game.player.x = result.spawn_x;
+    game.player.y = result.spawn_y;
+    LOG_INFO(LOG_LEVEL, "No level file for %s, generated %s from seed %llu", game.map, level_gen_mode_name(options.mode),
+             options.seed);
+    return true;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <mutex>
+#include "edit_log.h"
+#include "level_format.h"
+#include "level_json.h"
+#include "world.h"
+
+/*
+Loading and saving whole levels by name ("level_1.json"). The binary copy
+in resources/levels is used when it is at least as new as the JSON,
+otherwise the JSON is parsed and the binary copy refreshed.
+
+Either way the level's edit log (edit_log.h) is replayed over it, so
+edits autosaved since the last full save survive a crash.
+
+Levels may be loaded from the level cache worker thread. SplashKit's json
+functions are not thread safe, so every JSON read here holds
+level_json_mutex(). Saving writes the JSON text directly and does not
+need it.
+*/
+
+inline std::mutex &level_json_mutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+// Opens a .lvl file by path. Levels too big to hold whole stream from the mapping.
+inline bool load_level_file(const string &path, World &world)
+{
+    std::shared_ptr<LevelSource> source = std::make_shared<LevelSource>();
+    if (!open_level_source(path, *source))
+    {
+        return false;
+    }
+    world_open(world, source);
+    return true;
+}
+
+// Applies the level's edit log if it was written against the copy with
+// this checksum. A mapped level is copied into memory first.
+inline void level_apply_edit_log(const string &filename, LevelSource &source, uint32_t checksum)
+{
+    string path = edit_log_path(filename);
+    EditLogHeader header;
+    if (!edit_log_header(path, header) || header.base != checksum)
+    {
+        return;
+    }
+    if (source.bytes.empty())
+    {
+        source.bytes.assign(source.tiles, source.tiles + (size_t)source.width * source.height);
+        source.tiles = source.bytes.data();
+        unmap_level(source.mapped);
+    }
+    int applied = edit_log_replay(path, source.width, source.height, checksum, source.bytes.data());
+    if (applied > 0)
+    {
+        LOG_INFO(LOG_LEVEL, "Replayed %d unsaved edits from %s", applied, path);
+    }
+}
+
+// Function to load a level from the memory mapped binary file
+inline bool load_level_from_binary(const string &filename, World &world)
+{
+    std::shared_ptr<LevelSource> source = std::make_shared<LevelSource>();
+    if (!open_level_source(binary_level_path(filename), *source))
+    {
+        return false;
+    }
+    level_apply_edit_log(filename, *source, ((const LevelHeader *)source->mapped.base)->checksum);
+    world_open(world, source);
+    LOG_INFO(LOG_LEVEL, "Load map %s from binary", filename);
+    return true;
+}
+
+// Function to load a level from JSON
+inline bool load_level_from_json(const string &filename, World &world)
+{
+    LOG_INFO(LOG_LEVEL, "Load map %s from json", filename);
+    std::shared_ptr<LevelSource> source = std::make_shared<LevelSource>();
+    {
+        std::lock_guard<std::mutex> lock(level_json_mutex());
+        if (!read_level_json(filename, source->width, source->height, source->bytes))
+        {
+            return false;
+        }
+    }
+    source->tiles = source->bytes.data();
+
+    // Cache the parsed level in binary so the next load skips the JSON
+    write_level_binary(binary_level_path(filename), source->width, source->height, source->tiles);
+    level_apply_edit_log(filename, *source, level_checksum(source->tiles, source->bytes.size()));
+    world_open(world, source);
+    return true;
+}
+
+// The binary copy is only trusted when it is at least as new as the JSON it came from
+inline bool binary_level_is_current(const string &filename)
+{
+    struct stat binary_info, json_info;
+    if (stat(binary_level_path(filename).c_str(), &binary_info) != 0)
+    {
+        return false;
+    }
+    if (stat((LEVEL_JSON_DIR + filename).c_str(), &json_info) != 0)
+    {
+        return true;
+    }
+    return binary_info.st_mtime >= json_info.st_mtime;
+}
+
+inline bool load_level(const string &filename, World &world)
+{
+    if (binary_level_is_current(filename) && load_level_from_binary(filename, world))
+    {
+        return true;
+    }
+    return load_level_from_json(filename, world);
+}
+
+// Saves the JSON copy for editing and the binary copy the game loads, then
+// empties the edit log. Each file is written beside the old one and renamed
+// over it, so a crash leaves the old level or the new one, never a mix.
+// json is false for levels too big for JSON, which only get the binary copy.
+inline bool save_level_packed(const string &filename, int width, int height, const uint8_t *tiles, bool json)
+{
+    bool ok = !json || write_level_json_text(LEVEL_JSON_DIR + filename, width, height, tiles);
+    ok = ok && write_level_binary(binary_level_path(filename), width, height, tiles);
+    return ok && edit_log_reset(edit_log_path(filename), width, height, level_checksum(tiles, (size_t)width * height));
+}
+
+inline bool save_level(const string &filename, const World &world)
+{
+    vector<uint8_t> tiles;
+    world_pack(world, tiles);
+    return save_level_packed(filename, world.width, world.height, tiles.data(), !world_streamed(world));
+}
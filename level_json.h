@@ -0,0 +1,418 @@
+#pragma once
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include "splashkit.h"
+#include "level_format.h"
+
+const string LEVEL_JSON_DIR = "resources/json/";
+
+/*
+JSON level layout used in resources/json:
+
+  { "tiles": [ { "row": [ { "type": 2, "traversable": false }, ... ] }, ... ] }
+
+"tiles" holds one entry per column (x) and each "row" holds that column's
+tiles from top to bottom (y). Tiles are converted to and from the packed
+row-major bytes used by the binary format.
+
+write_level_json builds the document with SplashKit; write_level_json_text
+prints the same layout straight to a file, which is much faster for big
+levels and safe off the main thread. parse_level_json_text is the reading
+side of it: a strict parser for just this layout that says what is wrong
+and on which line, for the level checker.
+*/
+
+// Reads a JSON level into packed tile bytes. Returns false if it has no "tiles" key or is ragged.
+inline bool read_level_json(const string &filename, int &width, int &height, vector<uint8_t> &tiles)
+{
+    json map_json = json_from_file(filename);
+
+    // Check if the JSON has the "tiles" key
+    if (!json_has_key(map_json, "tiles"))
+    {
+        free_json(map_json);
+        return false;
+    }
+
+    vector<json> tile_rows;
+    json_read_array(map_json, "tiles", tile_rows);
+
+    width = tile_rows.size();
+    height = 0;
+    for (int i = 0; i < width; ++i)
+    {
+        vector<json> tile_row;
+        json_read_array(tile_rows[i], "row", tile_row);
+
+        if (i == 0)
+        {
+            height = tile_row.size();
+            tiles.assign((size_t)width * height, 0);
+        }
+        else if ((int)tile_row.size() != height)
+        {
+            LOG_WARN(LOG_LEVEL, "Level %s has a ragged column %d", filename, i);
+            for (json tile : tile_row)
+            {
+                free_json(tile);
+            }
+            for (json row : tile_rows)
+            {
+                free_json(row);
+            }
+            free_json(map_json);
+            return false;
+        }
+
+        for (int j = 0; j < height; ++j)
+        {
+            tiles[(size_t)j * width + i] = pack_tile(json_read_number_as_int(tile_row[j], "type"),
+                                                     json_read_bool(tile_row[j], "traversable"));
+            free_json(tile_row[j]);
+        }
+    }
+
+    for (json row : tile_rows)
+    {
+        free_json(row);
+    }
+    free_json(map_json);
+    return width > 0 && height > 0;
+}
+
+inline void write_level_json(const string &filename, int width, int height, const uint8_t *tiles)
+{
+    json map_json = create_json();
+    vector<json> tile_rows;
+
+    for (int i = 0; i < width; ++i)
+    {
+        vector<json> tile_row;
+        for (int j = 0; j < height; ++j)
+        {
+            uint8_t tile = tiles[(size_t)j * width + i];
+            json tile_json = create_json();
+            json_set_number(tile_json, "type", tile_byte_type(tile));
+            json_set_bool(tile_json, "traversable", tile_byte_traversable(tile));
+            tile_row.push_back(tile_json);
+        }
+
+        json row_json = create_json();
+        json_set_array(row_json, "row", tile_row);
+        tile_rows.push_back(row_json);
+        for (json tile : tile_row)
+        {
+            free_json(tile);
+        }
+    }
+
+    json_set_array(map_json, "tiles", tile_rows);
+    json_to_file(map_json, filename.c_str());
+    for (json row : tile_rows)
+    {
+        free_json(row);
+    }
+    free_json(map_json);
+}
+
+// Writes the JSON layout as text to path + ".tmp" and renames it over path
+inline bool write_level_json_text(const string &path, int width, int height, const uint8_t *tiles)
+{
+    FILE *file = fopen((path + ".tmp").c_str(), "wb");
+    if (!file)
+    {
+        LOG_ERROR(LOG_LEVEL, "Could not open %s for writing", path);
+        return false;
+    }
+    static const char *const TILE_TEXT[2] = {"{\"traversable\":false,\"type\":%d}", "{\"traversable\":true,\"type\":%d}"};
+    fputs("{\"tiles\":[", file);
+    for (int i = 0; i < width; ++i)
+    {
+        fputs(i == 0 ? "{\"row\":[" : ",\n{\"row\":[", file);
+        for (int j = 0; j < height; ++j)
+        {
+            uint8_t tile = tiles[(size_t)j * width + i];
+            if (j > 0)
+            {
+                fputc(',', file);
+            }
+            fprintf(file, TILE_TEXT[tile_byte_traversable(tile)], tile_byte_type(tile));
+        }
+        fputs("]}", file);
+    }
+    fputs("]}\n", file);
+    bool ok = !ferror(file);
+    ok = (fclose(file) == 0) && ok;
+    ok = ok && rename((path + ".tmp").c_str(), path.c_str()) == 0;
+    if (!ok)
+    {
+        LOG_ERROR(LOG_LEVEL, "Failed writing level %s", path);
+    }
+    return ok;
+}
+
+// Cursor over the JSON text being parsed. error holds the first problem found.
+struct LevelJsonScanner
+{
+    const char *begin;
+    const char *at;
+    const char *end;
+    string error;
+};
+
+inline bool level_json_fail(LevelJsonScanner &s, const string &message)
+{
+    if (s.error.empty())
+    {
+        s.error = "line " + std::to_string(1 + std::count(s.begin, s.at, '\n')) + ": " + message +
+                  (s.at >= s.end ? ", the file ends there" : "");
+    }
+    return false;
+}
+
+inline void level_json_space(LevelJsonScanner &s)
+{
+    while (s.at < s.end && (*s.at == ' ' || *s.at == '\n' || *s.at == '\r' || *s.at == '\t'))
+    {
+        ++s.at;
+    }
+}
+
+// Skips white space, then checks for c without taking it
+inline bool level_json_peek(LevelJsonScanner &s, char c)
+{
+    level_json_space(s);
+    return s.at < s.end && *s.at == c;
+}
+
+inline bool level_json_expect(LevelJsonScanner &s, char c)
+{
+    if (!level_json_peek(s, c))
+    {
+        return level_json_fail(s, string("expected '") + c + "'");
+    }
+    ++s.at;
+    return true;
+}
+
+inline bool level_json_string(LevelJsonScanner &s, string &out)
+{
+    if (!level_json_expect(s, '"'))
+    {
+        return false;
+    }
+    out.clear();
+    while (s.at < s.end && *s.at != '"')
+    {
+        if (*s.at == '\\' && s.at + 1 < s.end)
+        {
+            ++s.at; // keys and names here never need the escape decoded
+        }
+        out += *s.at++;
+    }
+    return s.at < s.end ? (++s.at, true) : level_json_fail(s, "unterminated string");
+}
+
+// Calls item() for every element of an array. item parses the element.
+template <typename Fn>
+inline bool level_json_array(LevelJsonScanner &s, Fn item)
+{
+    if (!level_json_expect(s, '['))
+    {
+        return false;
+    }
+    if (level_json_peek(s, ']'))
+    {
+        ++s.at;
+        return true;
+    }
+    while (item())
+    {
+        if (!level_json_peek(s, ','))
+        {
+            return level_json_expect(s, ']');
+        }
+        ++s.at;
+    }
+    return false;
+}
+
+// Calls member(key) for every member of an object. member parses the value.
+template <typename Fn>
+inline bool level_json_object(LevelJsonScanner &s, Fn member)
+{
+    if (!level_json_expect(s, '{'))
+    {
+        return false;
+    }
+    if (level_json_peek(s, '}'))
+    {
+        ++s.at;
+        return true;
+    }
+    string key;
+    while (level_json_string(s, key) && level_json_expect(s, ':') && member(key))
+    {
+        if (!level_json_peek(s, ','))
+        {
+            return level_json_expect(s, '}');
+        }
+        ++s.at;
+    }
+    return false;
+}
+
+inline bool level_json_skip_value(LevelJsonScanner &s)
+{
+    string text;
+    if (level_json_peek(s, '"'))
+    {
+        return level_json_string(s, text);
+    }
+    if (level_json_peek(s, '['))
+    {
+        return level_json_array(s, [&s] { return level_json_skip_value(s); });
+    }
+    if (level_json_peek(s, '{'))
+    {
+        return level_json_object(s, [&s](const string &) { return level_json_skip_value(s); });
+    }
+    const char *start = s.at;
+    while (s.at < s.end && !strchr(",]} \n\r\t", *s.at))
+    {
+        ++s.at;
+    }
+    return s.at > start || level_json_fail(s, "expected a value");
+}
+
+// The text must be followed by a 0 byte, as std::string's is
+inline bool level_json_int(LevelJsonScanner &s, int &value)
+{
+    level_json_space(s);
+    char *next;
+    double number = strtod(s.at, &next);
+    // Range first: casting a double outside int (or NaN) is undefined
+    if (next == s.at || next > s.end || !(number >= INT_MIN && number <= INT_MAX) || number != (int)number)
+    {
+        return level_json_fail(s, "expected a whole number");
+    }
+    s.at = next;
+    value = (int)number;
+    return true;
+}
+
+inline bool level_json_bool(LevelJsonScanner &s, bool &value)
+{
+    level_json_space(s);
+    for (bool option : {true, false})
+    {
+        const char *word = option ? "true" : "false";
+        size_t length = strlen(word);
+        if ((size_t)(s.end - s.at) >= length && memcmp(s.at, word, length) == 0)
+        {
+            s.at += length;
+            value = option;
+            return true;
+        }
+    }
+    return level_json_fail(s, "expected true or false");
+}
+
+// Parses a JSON level held in text into packed tile bytes without SplashKit,
+// so it can run on any thread. Unknown keys are skipped. Returns false with
+// error set if the text is not the level layout, a tile lacks its type or
+// traversable flag, a type does not fit in a tile byte, or the columns
+// differ in length.
+inline bool parse_level_json_text(const string &text, int &width, int &height, vector<uint8_t> &tiles, string &error)
+{
+    LevelJsonScanner s = {text.data(), text.data(), text.data() + text.size(), ""};
+    vector<uint8_t> columns; // column-major as in the file
+    vector<int> lengths;
+    bool found = false;
+    bool ok = level_json_object(s, [&](const string &key) {
+        if (key != "tiles")
+        {
+            return level_json_skip_value(s);
+        }
+        found = true;
+        return level_json_array(s, [&] {
+            lengths.push_back(0);
+            return level_json_object(s, [&](const string &key) {
+                if (key != "row")
+                {
+                    return level_json_skip_value(s);
+                }
+                return level_json_array(s, [&] {
+                    int type = -1;
+                    int traversable = -1;
+                    bool tile_ok = level_json_object(s, [&](const string &key) {
+                        bool flag = false;
+                        if (key == "type")
+                        {
+                            return level_json_int(s, type);
+                        }
+                        if (key == "traversable")
+                        {
+                            return level_json_bool(s, flag) && (traversable = flag, true);
+                        }
+                        return level_json_skip_value(s);
+                    });
+                    string where = "tile " + std::to_string(lengths.back()) + " of column " + std::to_string(lengths.size() - 1);
+                    if (tile_ok && (type < 0 || traversable < 0))
+                    {
+                        return level_json_fail(s, where + " has no " + (type < 0 ? "type" : "traversable flag"));
+                    }
+                    if (tile_ok && type > TILE_TYPE_MASK)
+                    {
+                        return level_json_fail(s, where + " has type " + std::to_string(type) + ", types go up to " +
+                                                      std::to_string(TILE_TYPE_MASK));
+                    }
+                    columns.push_back(pack_tile(type, traversable));
+                    lengths.back()++;
+                    return tile_ok;
+                });
+            });
+        });
+    });
+    if (ok && !found)
+    {
+        s.error = "no \"tiles\" key";
+        ok = false;
+    }
+
+    int columns_found = lengths.size();
+    int rows_found = columns_found > 0 ? lengths[0] : 0;
+    for (int x = 1; ok && x < columns_found; ++x)
+    {
+        if (lengths[x] != rows_found)
+        {
+            s.error = "ragged: column " + std::to_string(x) + " has " + std::to_string(lengths[x]) + " tiles, column 0 has " +
+                      std::to_string(rows_found);
+            ok = false;
+        }
+    }
+    if (ok && (columns_found == 0 || rows_found == 0))
+    {
+        s.error = "no tiles";
+        ok = false;
+    }
+    error = s.error;
+    if (!ok)
+    {
+        return false;
+    }
+
+    width = columns_found;
+    height = rows_found;
+    tiles.resize((size_t)width * height);
+    for (int x = 0; x < width; ++x)
+    {
+        for (int y = 0; y < height; ++y)
+        {
+            tiles[(size_t)y * width + x] = columns[(size_t)x * height + y];
+        }
+    }
+    return true;
+}
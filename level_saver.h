@@ -0,0 +1,210 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "level_io.h"
+#include "profiler.h"
+
+/*
+Writes levels on a worker thread so the editor never waits on the disk.
+level_saver_save copies the world into packed bytes on the caller, which
+is a memcpy per chunk row, and the worker writes the JSON and binary
+copies and empties the edit log (save_level_packed). level_saver_append
+queues the tiles changed since the last autosave for the edit log, and
+level_saver_discard empties the log when the editor drops its changes.
+
+Jobs run in the order they were queued, so records appended after a save
+was queued land in the new log. A save queued while an older save of the
+same level is still waiting replaces it.
+*/
+
+enum LevelSaveKind
+{
+    LEVEL_SAVE_FULL,    // tiles is the whole level
+    LEVEL_SAVE_APPEND,  // tiles is edit log records
+    LEVEL_SAVE_DISCARD  // empty the edit log
+};
+
+struct LevelSaveJob
+{
+    LevelSaveKind kind = LEVEL_SAVE_FULL;
+    string name;
+    int width = 0;
+    int height = 0;
+    bool json = true;
+    std::vector<uint8_t> tiles;
+};
+
+struct LevelSaver
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<LevelSaveJob> pending;
+    int busy = 0;        // jobs taken by the worker and not finished
+    int failures = 0;    // jobs that failed since the start
+    std::thread worker;
+    bool stopping = false;
+};
+
+// Resets the log unless it already belongs to the .lvl on disk, so the records appended next apply to it
+inline bool level_saver_open_log(const LevelSaveJob &job)
+{
+    string path = edit_log_path(job.name);
+    uint32_t checksum;
+    if (!level_file_checksum(binary_level_path(job.name), checksum))
+    {
+        if (job.kind == LEVEL_SAVE_DISCARD)
+        {
+            return true; // no log to empty
+        }
+        LOG_WARN(LOG_LEVEL, "%s has no binary copy yet, edits are not logged until it is saved", job.name);
+        return false;
+    }
+    EditLogHeader header;
+    if (job.kind == LEVEL_SAVE_APPEND && edit_log_header(path, header) && header.base == checksum)
+    {
+        return true;
+    }
+    return edit_log_reset(path, job.width, job.height, checksum);
+}
+
+// Runs on the saver thread, so it has no profiler zone: the ring is only safe to write from frame work
+inline bool level_saver_run(const LevelSaveJob &job)
+{
+    if (job.kind == LEVEL_SAVE_FULL)
+    {
+        auto start = std::chrono::steady_clock::now();
+        bool ok = save_level_packed(job.name, job.width, job.height, job.tiles.data(), job.json);
+        LOG_INFO(LOG_LEVEL, "Saved %s in %.1f ms", job.name,
+                 std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        return ok;
+    }
+    if (!level_saver_open_log(job))
+    {
+        return false;
+    }
+    return job.kind == LEVEL_SAVE_DISCARD || edit_log_append(edit_log_path(job.name), job.tiles);
+}
+
+inline void level_saver_worker(LevelSaver &saver)
+{
+    std::unique_lock<std::mutex> lock(saver.mutex);
+    while (true)
+    {
+        saver.changed.wait(lock, [&saver] { return saver.stopping || !saver.pending.empty(); });
+        if (saver.pending.empty())
+        {
+            return; // stopping, and everything queued is written
+        }
+
+        LevelSaveJob job = std::move(saver.pending.front());
+        saver.pending.pop_front();
+        saver.busy++;
+        lock.unlock();
+        bool ok = level_saver_run(job);
+        lock.lock();
+        saver.busy--;
+        saver.failures += !ok;
+        saver.changed.notify_all();
+    }
+}
+
+inline void level_saver_start(LevelSaver &saver)
+{
+    saver.stopping = false;
+    saver.worker = std::thread(level_saver_worker, std::ref(saver));
+}
+
+// Writes whatever is still queued, then stops the worker
+inline void level_saver_stop(LevelSaver &saver)
+{
+    {
+        std::lock_guard<std::mutex> lock(saver.mutex);
+        saver.stopping = true;
+    }
+    saver.changed.notify_all();
+    if (saver.worker.joinable())
+    {
+        saver.worker.join();
+    }
+}
+
+inline void level_saver_queue(LevelSaver &saver, LevelSaveJob &&job)
+{
+    std::lock_guard<std::mutex> lock(saver.mutex);
+    if (job.kind == LEVEL_SAVE_FULL && !saver.pending.empty() && saver.pending.back().kind == LEVEL_SAVE_FULL &&
+        saver.pending.back().name == job.name)
+    {
+        saver.pending.back() = std::move(job);
+    }
+    else
+    {
+        saver.pending.push_back(std::move(job));
+    }
+    saver.changed.notify_all();
+}
+
+// Snapshots world and queues it to be saved as name
+inline void level_saver_save(LevelSaver &saver, const string &name, const World &world)
+{
+    PROFILE_ZONE("level_snapshot");
+    LevelSaveJob job;
+    job.kind = LEVEL_SAVE_FULL;
+    job.name = name;
+    job.width = world.width;
+    job.height = world.height;
+    job.json = !world_streamed(world);
+    world_pack(world, job.tiles);
+    level_saver_queue(saver, std::move(job));
+}
+
+// Queues the current tiles of the given row runs for the level's edit log.
+// Runs outside the loaded chunks are skipped.
+inline void level_saver_append(LevelSaver &saver, const string &name, const World &world, const std::vector<EditLogRun> &runs)
+{
+    LevelSaveJob job;
+    job.kind = LEVEL_SAVE_APPEND;
+    job.name = name;
+    job.width = world.width;
+    job.height = world.height;
+    std::vector<uint8_t> row;
+    for (const EditLogRun &run : runs)
+    {
+        row.resize(run.length);
+        bool resident = true;
+        for (int i = 0; i < run.length; ++i)
+        {
+            resident = resident && world_resident(world, run.x + i, run.y);
+            row[i] = pack_tile(world_tile(world, run.x + i, run.y), world_traversable(world, run.x + i, run.y));
+        }
+        if (resident)
+        {
+            edit_log_encode(job.tiles, run.x, run.y, run.length, row.data());
+        }
+    }
+    if (!job.tiles.empty())
+    {
+        level_saver_queue(saver, std::move(job));
+    }
+}
+
+// Queues emptying the level's edit log, for edits that were thrown away
+inline void level_saver_discard(LevelSaver &saver, const string &name, const World &world)
+{
+    LevelSaveJob job;
+    job.kind = LEVEL_SAVE_DISCARD;
+    job.name = name;
+    job.width = world.width;
+    job.height = world.height;
+    level_saver_queue(saver, std::move(job));
+}
+
+// Whether anything is queued or being written
+inline bool level_saver_busy(LevelSaver &saver)
+{
+    std::lock_guard<std::mutex> lock(saver.mutex);
+    return saver.busy > 0 || !saver.pending.empty();
+}
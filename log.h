@@ -0,0 +1,485 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <sys/stat.h>
+
+/*
+Asynchronous logging. LOG_INFO(LOG_LEVEL, "Loaded %s", name) copies the
+format pointer, a timestamp and up to LOG_MAX_ARGS arguments into a ring
+owned by the calling thread and returns; nothing is formatted or written
+on the caller. A drain thread empties every ring LOG_DRAIN_MS apart,
+formats the records in time order and appends them to logs/game.log,
+rotating it at LOG_MAX_FILE_BYTES, and echoes INFO and above to stdout.
+
+Each ring has one writer (its thread) and one reader (the drain thread),
+so writing a record takes two atomic loads and one store. A full ring
+drops the record and counts it rather than blocking the game.
+
+Levels below LOG_MIN_LEVEL compile to nothing, arguments included.
+Before log_start, or after log_stop, records are formatted straight to
+stderr, which is what the command line tools get.
+
+Format strings must be literals and use printf conversions. String
+arguments are copied, up to LOG_TEXT_BYTES in total per record.
+*/
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+enum LogCategory : uint8_t
+{
+    LOG_GAME,
+    LOG_SIM,
+    LOG_LEVEL,
+    LOG_AUDIO,
+    LOG_EDITOR,
+    LOG_REPLAY,
+    LOG_PROFILER
+};
+
+const char *const LOG_LEVEL_NAMES[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR"};
+const char *const LOG_CATEGORY_NAMES[] = {"game", "sim", "level", "audio", "editor", "replay", "profiler"};
+
+const int LOG_MAX_ARGS = 4;
+const int LOG_TEXT_BYTES = 56;
+const uint32_t LOG_RING_SIZE = 2048; // records per thread, a power of two
+const int LOG_DRAIN_MS = 20;
+const std::string LOG_DIR = "logs/";
+const long LOG_MAX_FILE_BYTES = 1 << 20;
+const int LOG_MAX_FILES = 5; // game.log plus game.1.log .. game.4.log
+const int LOG_ECHO_LEVEL = LOG_LEVEL_INFO;
+
+enum LogArgType : uint8_t
+{
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_TEXT // offset into LogRecord::text
+};
+
+struct LogRecord
+{
+    uint64_t time_ns; // steady clock
+    const char *format;
+    uint8_t level;
+    uint8_t category;
+    uint8_t arg_count;
+    uint8_t text_used;
+    uint8_t types[LOG_MAX_ARGS];
+    union
+    {
+        int64_t i;
+        uint64_t u;
+        double d;
+    } args[LOG_MAX_ARGS];
+    char text[LOG_TEXT_BYTES];
+};
+
+struct LogRing
+{
+    std::atomic<uint64_t> head{0}; // records written by the owning thread
+    std::atomic<uint64_t> tail{0}; // records taken by the drain thread
+    std::atomic<uint64_t> dropped{0};
+    LogRecord records[LOG_RING_SIZE];
+};
+
+struct Logger
+{
+    std::mutex mutex; // guards rings and the fields below, never taken by log_write
+    std::vector<std::unique_ptr<LogRing>> rings;
+    std::atomic<bool> running{false};
+    std::condition_variable changed;
+    bool stopping = false;
+    std::thread worker;
+    std::string path;
+    FILE *file = nullptr;
+    long file_bytes = 0;
+    int64_t wall_offset_ns = 0; // system clock minus steady clock, for timestamps
+};
+
+inline Logger &logger()
+{
+    static Logger instance;
+    return instance;
+}
+
+inline uint64_t log_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The calling thread's ring, registered the first time the thread logs
+inline LogRing &log_thread_ring()
+{
+    static thread_local LogRing *ring = nullptr;
+    if (!ring)
+    {
+        Logger &log = logger();
+        std::lock_guard<std::mutex> lock(log.mutex);
+        log.rings.emplace_back(new LogRing());
+        ring = log.rings.back().get();
+        memset(ring->records, 0, sizeof(ring->records)); // take the page faults now, not mid-frame
+    }
+    return *ring;
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type log_capture(LogRecord &record, T value)
+{
+    int i = record.arg_count++;
+    if (std::is_signed<T>::value || std::is_enum<T>::value)
+    {
+        record.types[i] = LOG_ARG_INT;
+        record.args[i].i = (int64_t)value;
+    }
+    else
+    {
+        record.types[i] = LOG_ARG_UINT;
+        record.args[i].u = (uint64_t)value;
+    }
+}
+
+inline void log_capture(LogRecord &record, double value)
+{
+    int i = record.arg_count++;
+    record.types[i] = LOG_ARG_DOUBLE;
+    record.args[i].d = value;
+}
+
+inline void log_capture(LogRecord &record, const char *value)
+{
+    int i = record.arg_count++;
+    record.types[i] = LOG_ARG_TEXT;
+    if (record.text_used == LOG_TEXT_BYTES)
+    {
+        record.args[i].u = LOG_TEXT_BYTES - 1; // out of room, the last string's terminator reads as ""
+        return;
+    }
+    record.args[i].u = record.text_used;
+    size_t length = std::min(strlen(value), (size_t)(LOG_TEXT_BYTES - record.text_used - 1));
+    memcpy(record.text + record.text_used, value, length);
+    record.text[record.text_used + length] = '\0';
+    record.text_used += length + 1;
+}
+
+inline void log_capture(LogRecord &record, const std::string &value)
+{
+    log_capture(record, value.c_str());
+}
+
+// Expands a record's format with its arguments and appends it to out
+inline void log_format_message(const LogRecord &record, std::string &out)
+{
+    char buffer[128];
+    int arg = 0;
+    for (const char *at = record.format; *at; ++at)
+    {
+        if (*at != '%')
+        {
+            out += *at;
+            continue;
+        }
+        if (at[1] == '%')
+        {
+            out += '%';
+            ++at;
+            continue;
+        }
+
+        // Keep flags, width and precision; drop length modifiers, the argument's own type decides
+        char spec[16] = "%";
+        size_t used = 1;
+        ++at;
+        while (*at && !strchr("diouxXcfFeEgGsp", *at))
+        {
+            if (!strchr("hljztL", *at) && used < sizeof(spec) - 4)
+            {
+                spec[used++] = *at;
+            }
+            ++at;
+        }
+        if (!*at)
+        {
+            break;
+        }
+        char conversion = *at;
+        if (arg >= record.arg_count)
+        {
+            out += "<?>";
+            continue;
+        }
+
+        uint8_t type = record.types[arg];
+        const auto &value = record.args[arg];
+        arg++;
+        if (type == LOG_ARG_TEXT || conversion == 's')
+        {
+            spec[used++] = 's';
+            spec[used] = '\0';
+            std::string number = type == LOG_ARG_DOUBLE ? std::to_string(value.d)
+                                 : type == LOG_ARG_INT  ? std::to_string(value.i)
+                                                        : std::to_string(value.u);
+            snprintf(buffer, sizeof(buffer), spec, type == LOG_ARG_TEXT ? record.text + value.u : number.c_str());
+        }
+        else if (strchr("fFeEgG", conversion))
+        {
+            spec[used++] = conversion;
+            spec[used] = '\0';
+            snprintf(buffer, sizeof(buffer), spec, type == LOG_ARG_DOUBLE ? value.d : type == LOG_ARG_INT ? (double)value.i : (double)value.u);
+        }
+        else if (conversion == 'c')
+        {
+            spec[used++] = 'c';
+            spec[used] = '\0';
+            snprintf(buffer, sizeof(buffer), spec, (int)value.i);
+        }
+        else
+        {
+            spec[used++] = 'l';
+            spec[used++] = 'l';
+            spec[used++] = conversion == 'p' ? 'x' : conversion;
+            spec[used] = '\0';
+            long long integer = type == LOG_ARG_DOUBLE ? (long long)value.d : (long long)value.i;
+            snprintf(buffer, sizeof(buffer), spec, integer);
+        }
+        out += buffer;
+    }
+}
+
+inline void log_format_line(const LogRecord &record, int64_t wall_offset_ns, std::string &out)
+{
+    int64_t wall_ns = (int64_t)record.time_ns + wall_offset_ns;
+    time_t seconds = (time_t)(wall_ns / 1000000000);
+    struct tm local;
+    localtime_r(&seconds, &local);
+    char stamp[48];
+    size_t length = strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+    snprintf(stamp + length, sizeof(stamp) - length, ".%03d %-5s %-8s ", (int)(wall_ns / 1000000 % 1000),
+             LOG_LEVEL_NAMES[record.level], LOG_CATEGORY_NAMES[record.category]);
+    out += stamp;
+    log_format_message(record, out);
+    out += '\n';
+}
+
+template <typename... Args>
+inline void log_write(int level, LogCategory category, const char *format, const Args &...args)
+{
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+    LogRecord local;
+    LogRing *ring = nullptr;
+    LogRecord *record = &local;
+    uint64_t head = 0;
+    if (logger().running.load(std::memory_order_acquire))
+    {
+        ring = &log_thread_ring();
+        head = ring->head.load(std::memory_order_relaxed);
+        if (head - ring->tail.load(std::memory_order_acquire) >= LOG_RING_SIZE)
+        {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        record = &ring->records[head & (LOG_RING_SIZE - 1)];
+    }
+
+    record->time_ns = log_now_ns();
+    record->format = format;
+    record->level = (uint8_t)level;
+    record->category = category;
+    record->arg_count = 0;
+    record->text_used = 0;
+    int expand[] = {0, (log_capture(*record, args), 0)...};
+    (void)expand;
+
+    if (ring)
+    {
+        ring->head.store(head + 1, std::memory_order_release);
+        return;
+    }
+    std::string line;
+    log_format_message(local, line);
+    fprintf(stderr, "%s %s: %s\n", LOG_LEVEL_NAMES[level], LOG_CATEGORY_NAMES[category], line.c_str());
+}
+
+#define LOG_AT(level, category, ...) log_write(level, category, __VA_ARGS__)
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(category, ...) LOG_AT(LOG_LEVEL_TRACE, category, __VA_ARGS__)
+#else
+#define LOG_TRACE(category, ...) ((void)0)
+#endif
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(category, ...) LOG_AT(LOG_LEVEL_DEBUG, category, __VA_ARGS__)
+#else
+#define LOG_DEBUG(category, ...) ((void)0)
+#endif
+#if LOG_MIN_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(category, ...) LOG_AT(LOG_LEVEL_INFO, category, __VA_ARGS__)
+#else
+#define LOG_INFO(category, ...) ((void)0)
+#endif
+#if LOG_MIN_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(category, ...) LOG_AT(LOG_LEVEL_WARN, category, __VA_ARGS__)
+#else
+#define LOG_WARN(category, ...) ((void)0)
+#endif
+#define LOG_ERROR(category, ...) LOG_AT(LOG_LEVEL_ERROR, category, __VA_ARGS__)
+
+// Moves game.log to game.1.log and so on, dropping the oldest. Caller holds the logger mutex.
+inline void log_rotate(Logger &log)
+{
+    fclose(log.file);
+    std::string stem = log.path.substr(0, log.path.rfind('.'));
+    for (int i = LOG_MAX_FILES - 1; i > 0; --i)
+    {
+        std::string from = i == 1 ? log.path : stem + "." + std::to_string(i - 1) + ".log";
+        rename(from.c_str(), (stem + "." + std::to_string(i) + ".log").c_str());
+    }
+    log.file = fopen(log.path.c_str(), "w");
+    log.file_bytes = 0;
+}
+
+// Takes everything written so far from every ring and writes it out, oldest first
+inline void log_drain(Logger &log)
+{
+    std::vector<LogRecord> batch;
+    std::string echo;
+    {
+        std::lock_guard<std::mutex> lock(log.mutex);
+        for (std::unique_ptr<LogRing> &ring : log.rings)
+        {
+            uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            for (; tail < head; ++tail)
+            {
+                batch.push_back(ring->records[tail & (LOG_RING_SIZE - 1)]);
+            }
+            ring->tail.store(tail, std::memory_order_release);
+
+            uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped)
+            {
+                LogRecord note = LogRecord();
+                note.time_ns = log_now_ns();
+                note.format = "%llu log records dropped, the ring was full";
+                note.level = LOG_LEVEL_WARN;
+                note.category = LOG_GAME;
+                log_capture(note, dropped);
+                batch.push_back(note);
+            }
+        }
+    }
+    if (batch.empty())
+    {
+        return;
+    }
+
+    std::stable_sort(batch.begin(), batch.end(), [](const LogRecord &a, const LogRecord &b) { return a.time_ns < b.time_ns; });
+    std::string lines;
+    for (const LogRecord &record : batch)
+    {
+        size_t start = lines.size();
+        log_format_line(record, log.wall_offset_ns, lines);
+        if (record.level >= LOG_ECHO_LEVEL)
+        {
+            echo.append(lines, start, std::string::npos);
+        }
+    }
+    if (!echo.empty())
+    {
+        fputs(echo.c_str(), stdout);
+        fflush(stdout);
+    }
+
+    std::lock_guard<std::mutex> lock(log.mutex);
+    if (log.file)
+    {
+        fwrite(lines.data(), 1, lines.size(), log.file);
+        fflush(log.file);
+        log.file_bytes += (long)lines.size();
+        if (log.file_bytes >= LOG_MAX_FILE_BYTES)
+        {
+            log_rotate(log);
+        }
+    }
+}
+
+inline void log_worker(Logger &log)
+{
+    std::unique_lock<std::mutex> lock(log.mutex);
+    while (!log.stopping)
+    {
+        log.changed.wait_for(lock, std::chrono::milliseconds(LOG_DRAIN_MS));
+        lock.unlock();
+        log_drain(log);
+        lock.lock();
+    }
+}
+
+// Opens the log file (appending) and starts the drain thread
+inline bool log_start(const std::string &path = LOG_DIR + "game.log")
+{
+    Logger &log = logger();
+    size_t slash = path.find_last_of('/');
+    if (slash != std::string::npos)
+    {
+        mkdir(path.substr(0, slash).c_str(), 0755);
+    }
+    log.path = path;
+    log.file = fopen(path.c_str(), "a");
+    if (!log.file)
+    {
+        fprintf(stderr, "Could not open log %s, logging to stderr\n", path.c_str());
+        return false;
+    }
+    log.file_bytes = ftell(log.file);
+    int64_t wall = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    log.wall_offset_ns = wall - (int64_t)log_now_ns();
+    log.stopping = false;
+    log.running.store(true, std::memory_order_release);
+    log.worker = std::thread(log_worker, std::ref(log));
+    log_thread_ring();
+    return true;
+}
+
+// Writes out whatever is still queued and closes the file
+inline void log_stop()
+{
+    Logger &log = logger();
+    if (!log.running.load())
+    {
+        return;
+    }
+    log.running.store(false, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(log.mutex);
+        log.stopping = true;
+    }
+    log.changed.notify_all();
+    log.worker.join();
+    log_drain(log);
+    if (log.file) // null if rotating could not reopen it
+    {
+        fclose(log.file);
+        log.file = nullptr;
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "splashkit.h"
+#include "game.h"
+
+// Reads the game constants (resources/json/consts.json) into p
+inline void load_constants_from_json(Para &p, const string &filename)
+{
+    // Read JSON file
+    json consts_json = json_from_file(filename);
+
+    // Assign values to global variables
+    p.SCREEN_WIDTH = json_read_number(consts_json, "SCREEN_WIDTH");
+    p.SCREEN_HEIGHT = json_read_number(consts_json, "SCREEN_HEIGHT");
+    p.TILE_SIZE = json_read_number(consts_json, "TILE_SIZE");
+    p.NUM_TILES_X = p.SCREEN_WIDTH / p.TILE_SIZE;
+    p.NUM_TILES_Y = p.SCREEN_HEIGHT / p.TILE_SIZE;
+    p.MAX_MOBS = json_read_number(consts_json, "MAX_MOBS");
+    p.TICK_SPEED = json_read_number(consts_json, "TICK_SPEED");
+    p.WATER_SPAWN_CHANCE = json_read_number(consts_json, "WATER_SPAWN_CHANCE");
+    p.MAX_AIR = json_read_number(consts_json, "MAX_AIR");
+    p.MAX_HEALTH = json_read_number(consts_json, "MAX_HEALTH");
+    p.AIR_GAIN_RATE = json_read_number(consts_json, "AIR_GAIN_RATE");
+    p.AIR_LOSS_RATE = json_read_number(consts_json, "AIR_LOSS_RATE");
+    p.DROWN_THRESHOLD = json_read_number(consts_json, "DROWN_THRESHOLD");
+    p.MOB_MOVE_INTERVAL = json_read_number(consts_json, "MOB_MOVE_INTERVAL");
+    p.BASE_MOBS_KILLED = json_read_number(consts_json, "BASE_MOBS_KILLED");
+    p.FOOTSTEP_FIRST = json_read_string(consts_json, "FOOTSTEP_FIRST");
+    p.FOOTSTEP_SECOND = json_read_string(consts_json, "FOOTSTEP_SECOND");
+    p.WATER_SOUND_EFFECT = json_read_string(consts_json, "WATER_SOUND_EFFECT");
+    free_json(consts_json);
+}
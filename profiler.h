@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "log.h"
+
+/*
+Frame profiler. PROFILE_ZONE("name") times the rest of the enclosing
+scope into a ring buffer of ProfileRecords shared by every thread.
+profiler_frame_end folds the frame's records into per-stage times and a
+frame time history for the overlay, and profiler_write_trace dumps the
+buffer as Chrome trace JSON (chrome://tracing or ui.perfetto.dev).
+
+While the profiler is off a zone costs one relaxed load and a branch.
+Building with -DPROFILER_DISABLED removes the zones altogether.
+
+Zone names must be string literals: records keep the pointer.
+Records are read on the main thread between frames, when the thread
+pool is idle, so the ring needs no lock.
+*/
+
+const uint32_t PROFILE_CAPACITY = 1 << 16;   // records kept, a power of two
+const int PROFILE_FRAME_HISTORY = 240;      // frames in the overlay graph
+const double PROFILE_SMOOTHING = 0.1;       // weight of the newest frame in the per-stage averages
+
+struct ProfileRecord
+{
+    const char *name;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint32_t thread;
+    uint32_t depth;
+};
+
+struct ProfileStage
+{
+    const char *name;
+    double last_ms = 0; // time in the zone last frame, summed over threads
+    double average_ms = 0;
+};
+
+struct Profiler
+{
+    std::atomic<bool> enabled{false};
+    std::atomic<uint64_t> next{0}; // records written, the slot is next & (PROFILE_CAPACITY - 1)
+    std::vector<ProfileRecord> records; // PROFILE_CAPACITY once first enabled
+    uint64_t frame_first = 0;      // first record of the current frame
+    uint64_t frame_start_ns = 0;
+    std::vector<ProfileStage> stages; // in order of first appearance
+    std::vector<float> frame_ms = std::vector<float>(PROFILE_FRAME_HISTORY); // ring, newest at frame_count - 1
+    uint64_t frame_count = 0;
+    std::atomic<uint32_t> next_thread{0};
+};
+
+inline Profiler &profiler()
+{
+    static Profiler instance;
+    return instance;
+}
+
+inline uint64_t profile_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Small id for the calling thread, in the order threads first record a zone
+inline uint32_t profile_thread_id()
+{
+    static thread_local uint32_t id = profiler().next_thread.fetch_add(1);
+    return id;
+}
+
+inline uint32_t &profile_depth()
+{
+    static thread_local uint32_t depth = 0;
+    return depth;
+}
+
+struct ProfileZone
+{
+    const char *name;
+    uint64_t start_ns = 0; // 0 while the profiler was off when the zone opened
+
+    explicit ProfileZone(const char *zone_name) : name(zone_name)
+    {
+        if (profiler().enabled.load(std::memory_order_relaxed))
+        {
+            profile_depth()++;
+            start_ns = profile_now_ns();
+        }
+    }
+
+    ~ProfileZone()
+    {
+        if (start_ns)
+        {
+            uint64_t end_ns = profile_now_ns();
+            Profiler &prof = profiler();
+            uint32_t depth = --profile_depth();
+            uint64_t slot = prof.next.fetch_add(1, std::memory_order_relaxed) & (PROFILE_CAPACITY - 1);
+            prof.records[slot] = {name, start_ns, end_ns, profile_thread_id(), depth};
+        }
+    }
+
+    ProfileZone(const ProfileZone &) = delete;
+    ProfileZone &operator=(const ProfileZone &) = delete;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#ifdef PROFILER_DISABLED
+#define PROFILE_ZONE(name)
+#else
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#endif
+
+inline bool profiler_enabled()
+{
+    return profiler().enabled.load(std::memory_order_relaxed);
+}
+
+// Turns recording on or off. Turning it on starts from an empty buffer.
+inline void profiler_set_enabled(bool enabled)
+{
+    Profiler &prof = profiler();
+    if (enabled && !profiler_enabled())
+    {
+        prof.records.resize(PROFILE_CAPACITY);
+        prof.next.store(0);
+        prof.frame_first = 0;
+        prof.frame_start_ns = profile_now_ns();
+        prof.stages.clear();
+        prof.frame_count = 0;
+    }
+    prof.enabled.store(enabled);
+}
+
+inline ProfileStage &profiler_stage(Profiler &prof, const char *name)
+{
+    for (ProfileStage &stage : prof.stages)
+    {
+        if (stage.name == name)
+        {
+            return stage;
+        }
+    }
+    prof.stages.push_back(ProfileStage());
+    prof.stages.back().name = name;
+    return prof.stages.back();
+}
+
+// Call once per frame on the main thread, after the frame's work is done
+inline void profiler_frame_end()
+{
+    if (!profiler_enabled())
+    {
+        return;
+    }
+    Profiler &prof = profiler();
+    uint64_t now = profile_now_ns();
+    uint64_t last = prof.next.load();
+    uint64_t first = std::max(prof.frame_first, last > PROFILE_CAPACITY ? last - PROFILE_CAPACITY : 0);
+
+    for (ProfileStage &stage : prof.stages)
+    {
+        stage.last_ms = 0;
+    }
+    for (uint64_t i = first; i < last; ++i)
+    {
+        const ProfileRecord &record = prof.records[i & (PROFILE_CAPACITY - 1)];
+        profiler_stage(prof, record.name).last_ms += (record.end_ns - record.start_ns) / 1e6;
+    }
+    for (ProfileStage &stage : prof.stages)
+    {
+        stage.average_ms += (stage.last_ms - stage.average_ms) * PROFILE_SMOOTHING;
+    }
+
+    prof.frame_ms[prof.frame_count % PROFILE_FRAME_HISTORY] = (float)((now - prof.frame_start_ns) / 1e6);
+    prof.frame_count++;
+    prof.frame_first = last;
+    prof.frame_start_ns = now;
+}
+
+// Writes the records still in the ring as Chrome trace JSON
+inline bool profiler_write_trace(const std::string &path)
+{
+    Profiler &prof = profiler();
+    size_t slash = path.find_last_of('/');
+    if (slash != std::string::npos)
+    {
+        mkdir(path.substr(0, slash).c_str(), 0755);
+    }
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file)
+    {
+        LOG_ERROR(LOG_PROFILER, "Could not open %s for writing", path);
+        return false;
+    }
+
+    uint64_t last = prof.next.load();
+    uint64_t first = last > PROFILE_CAPACITY ? last - PROFILE_CAPACITY : 0;
+    uint64_t origin = first < last ? prof.records[first & (PROFILE_CAPACITY - 1)].start_ns : 0;
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (uint64_t i = first; i < last; ++i)
+    {
+        const ProfileRecord &record = prof.records[i & (PROFILE_CAPACITY - 1)];
+        origin = std::min(origin, record.start_ns);
+    }
+    for (uint64_t i = first; i < last; ++i)
+    {
+        const ProfileRecord &record = prof.records[i & (PROFILE_CAPACITY - 1)];
+        fprintf(file, "%s{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u}",
+                i == first ? "" : ",\n", record.name, (record.start_ns - origin) / 1e3,
+                (record.end_ns - record.start_ns) / 1e3, record.thread);
+    }
+    fprintf(file, "\n]}\n");
+    bool ok = fclose(file) == 0;
+    if (ok)
+    {
+        LOG_INFO(LOG_PROFILER, "Trace of %llu zones written to %s", last - first, path);
+    }
+    return ok;
+}
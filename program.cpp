@@ -1,424 +1,294 @@
 #include "splashkit.h"
-#include <cstdlib> // Include for random number generation
+#include "asset_loader.h"
+#include "connectivity.h"
+#include "edit_journal.h"
+#include "level_cache.h"
+#include "level_gen.h"
+#include "level_saver.h"
+#include "para_json.h"
+#include "replay.h"
+#include "resources.h"
+#include "scene.h"
+#include "sim.h"
+#include "snapshot.h"
+#include "tile_layer.h"
+#include "tile_types_json.h"
+#include <ctime>
 
 /*
 JSON editor
 CONVERT CONSTS TO JSON : DONE
+
+SplashKit front end. Game rules live in sim.h; this file turns keys into
+InputCommands, runs the simulation at a fixed SIM_TICKS_PER_SECOND and
+draws, plays and prints whatever the simulation reports.
 */
 
 using std::to_string;
-timer mob_move;
-
-enum TileType
-{
-    GRASS,
-    WATER,
-    WALL,
-    DOOR
-};
-
-enum GameState
-{
-    PLAYING,
-    GAME_OVER,
-    NOT_STARTED,
-    LEVELED,
-    EDITING
-};
-
-struct Para
-{
-    int SCREEN_WIDTH;
-    int SCREEN_HEIGHT;
-    int TILE_SIZE;
-    int NUM_TILES_X;
-    int NUM_TILES_Y;
-    int MAX_MOBS;
-    int TICK_SPEED;
-    int WATER_SPAWN_CHANCE;
-    int MAX_AIR;
-    int MAX_HEALTH;
-    int AIR_GAIN_RATE;
-    int AIR_LOSS_RATE;
-    int DROWN_THRESHOLD;
-    int MOB_MOVE_INTERVAL;
-    int BASE_MOBS_KILLED;
-    string FOOTSTEP_FIRST;
-    string FOOTSTEP_SECOND;
-    string WATER_SOUND_EFFECT;
-    string MOB_MOVE_TIMER;
-};
-
-struct Tile
+LevelCache level_cache;
+TileLayer tile_layer;
+ThreadPool mob_pool;
+ChunkStreamer chunk_streamer;
+Camera camera;
+Connectivity connectivity; // door reachability of the level in the editor
+EditJournal edit_journal;  // undo history of the level in the editor
+LevelSaver level_saver;
+
+const string SIM_CLOCK_TIMER = "sim_clock";
+const string BACKGROUND_MUSIC = "background_music";
+const string ASSET_GROUP_TITLE = "title"; // manifest group the title screen waits for
+const string ASSET_GROUP_GAME = "game";   // manifest group a run waits for
+
+// Handles for the timers, sounds and music the game uses, resolved once in load_resources
+struct GameResources
 {
-    TileType type;
-    bool traversable;
-    int x, y;
+    TimerHandle sim_clock;
+    SoundHandle footstep_first;
+    SoundHandle footstep_second;
+    SoundHandle water;
+    MusicHandle background;
 };
-
-struct Mob
-{
-    int x, y;
-    int health;
-    int damage;
-    int move_direction; // 0: up, 1: down, 2: left, 3: right
-};
-
-struct Player
+ResourceRegistry registry;
+GameResources res;
+AssetLoader asset_loader;
+bool start_requested = false;            // ENTER was pressed before the game assets were in
+SceneMachine scenes;                     // one scene per GameState, see scene.h
+bitmap menu_bitmap = nullptr;            // the menu screen showing, drawn once when its scene is entered
+const int MAX_CATCH_UP_TICKS = 5;       // ticks run in one frame before dropping time
+InputCommand pending_command = CMD_NONE; // key typed, waiting for the next tick
+// Number keys by digit, for the editor keys in the tile type registry
+const key_code DIGIT_KEYS[10] = {NUM_0_KEY, NUM_1_KEY, NUM_2_KEY, NUM_3_KEY, NUM_4_KEY,
+                                  NUM_5_KEY, NUM_6_KEY, NUM_7_KEY, NUM_8_KEY, NUM_9_KEY};
+const int EDITOR_PAN_SPEED = 10;         // pixels the editor view moves per frame with the arrow keys
+// What a click paints in the editor. Rectangles and lines take two clicks, one per end.
+enum EditorBrush
 {
-    int x, y;
-    int health;
-    bool has_key;
-    int air;
-    int mobs_killed;
-    int level;
-    int footstepValue;
-};
-
-struct Game
-{
-    Player player;
-    Tile **world; // Change to pointer to pointer
-    Mob *mobs;
-    int num_mobs;
-    GameState state;
-    int tick_counter; // Counter for tick system
-    string map;
-    
+    BRUSH_PENCIL,
+    BRUSH_RECT,
+    BRUSH_LINE,
+    BRUSH_FILL
 };
+EditorBrush editor_brush = BRUSH_PENCIL;
+TileType editor_draw_type = GRASS;       // what the editor paints
+string editor_commands;                  // key help along the bottom of the editor, built when it opens
+int brush_anchor_x = -1;                 // first end of a rectangle or line, -1 until clicked
+int brush_anchor_y = -1;
+const double AUTOSAVE_SECONDS = 5;       // edits reach the level's edit log at most this long after they are made
+std::vector<EditLogRun> unsaved_runs;    // tiles edited since the last autosave
+std::chrono::steady_clock::time_point last_autosave;
+bool save_unreachable = false;           // ENTER was pressed on a level whose door cannot be reached; again saves anyway
+unsigned int sim_ticks_run = 0;         // ticks run since the level started
+Recording recording;                     // the run being played, saved to RECORDING_DIR when it ends
+Recording replay_recording;              // loaded with --replay
+Replay replay;
+bool replaying = false;
+bool replay_fast = false;                // replay as fast as the CPU allows
+const uint32_t REPLAY_SEEK_TICKS = 10 * SIM_TICKS_PER_SECOND;
+const int REPLAY_FAST_FRAME_MS = 15;     // time spent replaying per frame when going fast
+bool show_profiler = false;              // F3 toggles profiling and its overlay, F4 writes a trace
+const double PROFILER_GRAPH_SCALE = 2;   // overlay graph pixels per millisecond
+const string QUICKSAVE_PATH = SNAPSHOT_DIR + "quicksave.sav"; // F5 saves the run here, F9 loads it
 
 void initialize_tiles(const string &filename,const Para &p, Game &game);
-void setup(const Para &p, Game &game);
-void draw_world(const Para &p, Game &game);
+void start_level(const Para &p, Game &game);
+void draw_world(const Para &p, const Game &game);
 void draw_player(const Para &p, const Game &game);
 void draw_mobs(const Para &p, const Game &game);
 void draw_stats(const Para &p, const Game &game);
-void handle_input(const Para &p, Game &game);
-bool is_traversable(const Para &p, Game &game, int x, int y);
-void move_player(const Para &p, Game &game, int dx, int dy);
-void update_game_state(Game &game);
-void spawn_mobs(const Para &p, Game &game);
-void move_mobs(const Para &p, Game &game);
+void handle_title_input(const Para &p, Game &game);
+void handle_editor_input(const Para &p, Game &game);
+void handle_game_over_input(const Para &p, Game &game);
+void handle_leveled_input(const Para &p, Game &game);
+void handle_play_input(const Para &p, Game &game);
+void run_sim_ticks(const Para &p, Game &game);
+void play_sim_events(const Para &p, Game &game);
 void draw_game_over();
-bool is_mob_at(int x, int y, const Game &game);
-void leveled(const Para &p, Game &game);
-void leveling(const Para &p, Game &game);
-void load_constants_from_json(Para &p, const string &filename);
+void open_menu(const Para &p, const string &title, const string &body, const string &prompt);
+void free_menu();
+void leave_menu(const Para &p, Game &game);
+void draw_menu(const Para &p, Game &game);
+void register_scenes();
 void edit_map(const Para &p, Game &game, TileType draw_type);
+void open_in_editor(const Para &p, Game &game);
+void mark_edit(const Game &game, const EditBatch &batch);
+void draw_brush(const Para &p);
+void autosave_edits(const Game &game);
+void discard_edits(const Game &game);
 void save_map_to_file(const std::string &filename, const Para &p, const Game &game);
+bool check_map_before_save(const Game &game);
+void draw_connectivity(const Para &p, const Game &game);
 string tile_type_to_string(TileType type);
+int typed_tile_type();
+string editor_command_text();
 void display_commands();
+void load_resources(const Para &p);
+void update_resources(const Para &p);
+void draw_loading_screen(const Para &p, double progress);
+void start_run(const Para &p, Game &game);
+void finish_recording();
+void quicksave(const Game &game);
+void quickload(const Para &p, Game &game);
+void start_replay(const Para &p, Game &game);
+void run_replay_frame(const Para &p, Game &game);
+void handle_profiler_keys();
+void draw_profiler_overlay(const Para &p);
+void present_frame(const Para &p);
+void write_profiler_trace();
 
 // Function to convert TileType to string
 string tile_type_to_string(TileType type) {
-    switch (type) {
-        case GRASS: return "GRASS";
-        case WATER: return "WATER";
-        case WALL: return "WALL";
-        case DOOR: return "DOOR";
-        default: return "UNKNOWN";
-    }
+    return tile_type_name(type);
 }
 
 void save_map_to_file(const std::string &filename, const Para &p, const Game &game) {
-    // Create a JSON object to hold the map data
-    json map_json = create_json();
-
-    // Create a vector to hold the rows of tiles as JSON objects
-    vector<json> tile_rows;
-
-    // Iterate through the tiles and store their data in the vector
-    for (int i = 0; i < p.NUM_TILES_X; ++i)
-    {
-        // Create a vector to represent the current row
-        vector<json> tile_row;
-
-        for (int j = 0; j < p.NUM_TILES_Y; ++j)
-        {
-            // Create a JSON object for the current tile
-            json tile_json = create_json();
-
-            // Store the tile type and traversable status
-            json_set_number(tile_json, "type", game.world[i][j].type);
-            json_set_bool(tile_json, "traversable", game.world[i][j].traversable);
-
-            // Add the tile JSON object to the current row vector
-            tile_row.push_back(tile_json);
-        }
-
-        // Add the current row vector to the rows vector as a JSON array
-        json row_json = create_json();
-        json_set_array(row_json, "row", tile_row);
-        tile_rows.push_back(row_json);
-    }
-
-    // Add the rows vector to the map JSON object as a JSON array
-    json_set_array(map_json, "tiles", tile_rows);
+    // Written on the saver thread; the edit log is emptied once the level is on disk
+    level_saver_save(level_saver, filename, game.world);
+    unsaved_runs.clear();
 
-    // Save the JSON object to a file
-    json_to_file(map_json, filename.c_str());
+    // Keep the cached copy in step so playing the level picks up the edits
+    level_cache_store(level_cache, filename, game.world);
 }
 
-void load_constants_from_json(Para &p, const string &filename)
+// False if the level cannot be finished and this is the first ENTER since the last edit
+bool check_map_before_save(const Game &game)
 {
-    // Read JSON file
-    json consts_json = json_from_file(filename);
-
-    // Assign values to global variables
-    p.SCREEN_WIDTH = json_read_number(consts_json, "SCREEN_WIDTH");
-    p.SCREEN_HEIGHT = json_read_number(consts_json, "SCREEN_HEIGHT");
-    p.TILE_SIZE = json_read_number(consts_json, "TILE_SIZE");
-    p.NUM_TILES_X = p.SCREEN_WIDTH / p.TILE_SIZE;
-    p.NUM_TILES_Y = p.SCREEN_HEIGHT / p.TILE_SIZE;
-    p.MAX_MOBS = json_read_number(consts_json, "MAX_MOBS");
-    p.TICK_SPEED = json_read_number(consts_json, "TICK_SPEED");
-    p.WATER_SPAWN_CHANCE = json_read_number(consts_json, "WATER_SPAWN_CHANCE");
-    p.MAX_AIR = json_read_number(consts_json, "MAX_AIR");
-    p.MAX_HEALTH = json_read_number(consts_json, "MAX_HEALTH");
-    p.AIR_GAIN_RATE = json_read_number(consts_json, "AIR_GAIN_RATE");
-    p.AIR_LOSS_RATE = json_read_number(consts_json, "AIR_LOSS_RATE");
-    p.DROWN_THRESHOLD = json_read_number(consts_json, "DROWN_THRESHOLD");
-    p.MOB_MOVE_INTERVAL = json_read_number(consts_json, "MOB_MOVE_INTERVAL");
-    p.BASE_MOBS_KILLED = json_read_number(consts_json, "BASE_MOBS_KILLED");
-    p.FOOTSTEP_FIRST = json_read_string(consts_json, "FOOTSTEP_FIRST");
-    p.FOOTSTEP_SECOND = json_read_string(consts_json, "FOOTSTEP_SECOND");
-    p.WATER_SOUND_EFFECT = json_read_string(consts_json, "WATER_SOUND_EFFECT");
-    p.MOB_MOVE_TIMER = json_read_string(consts_json, "MOB_MOVE_TIMER");
-}
-
-void draw_screen(const Para &p, Game &game, const string &title, const string &welcome, const string &pressEnter)
-{
-    // Constants for text dimensions
-    int CHAR_WIDTH = 10;                      // Approximate width of a character in pixels
-    int LINE_HEIGHT = 20;                     // Height of a line of text in pixels
-    int MAX_LINE_WIDTH = p.SCREEN_WIDTH - 40; // Max line width with some padding
-
-    // Calculate text widths manually (approximate)
-    int title_width = title.length() * CHAR_WIDTH;
-    int pressEnter_width = pressEnter.length() * CHAR_WIDTH;
-
-    // Break welcome text into multiple lines if necessary
-    vector<string> welcome_lines;
-    int start = 0;
-    while (start < welcome.length())
+    connectivity_update(connectivity, game.world);
+    if (connectivity.passable_tiles > connectivity.main_tiles)
     {
-        int end = start + MAX_LINE_WIDTH / CHAR_WIDTH;
-        if (end >= welcome.length())
-        {
-            welcome_lines.push_back(welcome.substr(start));
-            break;
-        }
-        int last_space = welcome.rfind(' ', end);
-        if (last_space == string::npos || last_space <= start)
-        {
-            welcome_lines.push_back(welcome.substr(start, end - start));
-            start = end;
-        }
-        else
-        {
-            welcome_lines.push_back(welcome.substr(start, last_space - start));
-            start = last_space + 1;
-        }
+        LOG_WARN(LOG_EDITOR, "%s has %d tiles cut off from the main area",
+                 game.map, (int)(connectivity.passable_tiles - connectivity.main_tiles));
     }
-
-    // Centering y positions
-    int line1_y = p.SCREEN_HEIGHT / 2 - (welcome_lines.size() + 1) * LINE_HEIGHT / 2 - LINE_HEIGHT / 2;
-    int line2_y = line1_y + LINE_HEIGHT;
-    int line3_y = line2_y + welcome_lines.size() * LINE_HEIGHT;
-
-    // Clear the screen
-    clear_screen(COLOR_WHITE_SMOKE);
-
-    // Draw each line of text
-    draw_text(title, COLOR_BLACK, (p.SCREEN_WIDTH - title_width) / 2, line1_y);
-    for (size_t i = 0; i < welcome_lines.size(); ++i)
+    if (connectivity.reachable_exits > 0 || save_unreachable)
     {
-        int line_width = welcome_lines[i].length() * CHAR_WIDTH;
-        draw_text(welcome_lines[i], COLOR_BLACK, (p.SCREEN_WIDTH - line_width) / 2, line2_y + i * LINE_HEIGHT);
+        save_unreachable = false;
+        return true;
     }
-    draw_text(pressEnter, COLOR_BLACK, (p.SCREEN_WIDTH - pressEnter_width) / 2, line3_y);
-
-    // Handle input to continue
-    handle_input(p, game);
+    LOG_WARN(LOG_EDITOR, "%s not saved, its door cannot be reached. Press ENTER again to save anyway", game.map);
+    save_unreachable = true;
+    return false;
 }
 
-// Function to load map from JSON
-bool load_map_from_json(const string &filename, const Para &p, Game &game)
+// Draws a menu screen into menu_bitmap once, so showing it is a single blit a frame
+void open_menu(const Para &p, const string &title, const string &body, const string &prompt)
 {
-    printf("Load map from json\n");
-    // Load JSON from file
-    json map_json = json_from_file(filename);
-
-    // Check if the JSON has the "tiles" key
-    if (!json_has_key(map_json, "tiles"))
+    free_menu();
+    menu_bitmap = create_bitmap("menu", p.SCREEN_WIDTH, p.SCREEN_HEIGHT);
+    clear_bitmap(menu_bitmap, COLOR_WHITE_SMOKE);
+    for (const TextLine &line : text_screen_layout(p.SCREEN_WIDTH, p.SCREEN_HEIGHT, title, body, prompt))
     {
-        return false;
+        draw_text(line.text, COLOR_BLACK, line.x, line.y, option_draw_to(menu_bitmap));
     }
+}
 
-    // Read the tiles array
-    vector<json> tile_rows;
-    json_read_array(map_json, "tiles", tile_rows);
-
-    // Allocate memory for the 2D array
-    game.world = new Tile *[p.NUM_TILES_X];
-    for (int i = 0; i < p.NUM_TILES_X; ++i)
+void free_menu()
+{
+    if (menu_bitmap)
     {
-        game.world[i] = new Tile[p.NUM_TILES_Y];
+        free_bitmap(menu_bitmap);
+        menu_bitmap = nullptr;
     }
+}
 
-    // Iterate through the rows and columns
-    for (int i = 0; i < p.NUM_TILES_X; ++i)
-    {
-        vector<json> tile_row;
-        json_read_array(tile_rows[i], "row", tile_row);
+// Exit hook of the menu scenes
+void leave_menu(const Para &p, Game &game)
+{
+    free_menu();
+}
 
-        for (int j = 0; j < p.NUM_TILES_Y; ++j)
-        {
-            json tile_json = tile_row[j];
-            game.world[i][j].x = i * p.TILE_SIZE;
-            game.world[i][j].y = j * p.TILE_SIZE;
-            game.world[i][j].type = static_cast<TileType>(json_read_number_as_int(tile_json, "type"));
-            game.world[i][j].traversable = json_read_bool(tile_json, "traversable");
-        }
-    }
+// Render hook of the menu scenes
+void draw_menu(const Para &p, Game &game)
+{
+    draw_bitmap(menu_bitmap, 0, 0);
+}
 
-    // Free the JSON object
-    free_json(map_json);
+void draw_loading_screen(const Para &p, double progress)
+{
+    int BAR_WIDTH = p.SCREEN_WIDTH / 2;
+    int BAR_HEIGHT = 20;
+    int bar_x = (p.SCREEN_WIDTH - BAR_WIDTH) / 2;
+    int bar_y = p.SCREEN_HEIGHT / 2;
+    string text = "Loading " + to_string((int)(progress * 100)) + "%";
 
-    return true;
+    clear_screen(COLOR_WHITE_SMOKE);
+    draw_text(text, COLOR_BLACK, (p.SCREEN_WIDTH - (int)text.length() * 10) / 2, bar_y - 30);
+    fill_rectangle(COLOR_GREEN, bar_x, bar_y, BAR_WIDTH * progress, BAR_HEIGHT);
+    draw_rectangle(COLOR_BLACK, bar_x, bar_y, BAR_WIDTH, BAR_HEIGHT);
 }
 
 void initialize_tiles(const string &filename, const Para &p, Game &game)
 {
-    // Try to load the map from the JSON file
-    if (load_map_from_json(filename, p, game))
+    // Take the level from the cache, it is only read from disk on a miss
+    World world;
+    if (level_cache_get(level_cache, filename, world))
     {
-        // Successfully loaded map from file
+        // Successfully loaded map, swap it in and let the old one go
+        std::swap(game.world, world);
+        sim_world_changed(game);
+        tile_layer_mark_all(tile_layer);
         return;
     }
 
-    // // If loading the map failed, generate a new map
-    // // Allocate memory for the 2D array
-    // game.world = new Tile*[p.NUM_TILES_X];
-    // for (int i = 0; i < p.NUM_TILES_X; ++i)
-    // {
-    //     game.world[i] = new Tile[p.NUM_TILES_Y];
-    // }
-
-    // for (int i = 0; i < p.NUM_TILES_X; ++i)
-    // {
-    //     for (int j = 0; j < p.NUM_TILES_Y; ++j)
-    //     {
-    //         game.world[i][j].x = i * p.TILE_SIZE;
-    //         game.world[i][j].y = j * p.TILE_SIZE;
-    //         // Set tile type and traversable attribute
-    //         if (i == 0 || i == p.NUM_TILES_X - 1 || j == 0 || j == p.NUM_TILES_Y - 1)
-    //         {
-    //             game.world[i][j].type = WALL;
-    //             game.world[i][j].traversable = false;
-    //         }
-    //         else if (i == p.NUM_TILES_X / 2 && j == p.NUM_TILES_Y / 2)
-    //         {
-    //             game.world[i][j].type = DOOR;
-    //             game.world[i][j].traversable = false;
-    //         }
-    //         else
-    //         {
-    //             int rnd_num = rnd(10); // Generate a random number between 0 and 9
-    //             if (rnd_num < p.WATER_SPAWN_CHANCE)
-    //             {
-    //                 game.world[i][j].type = WATER;
-    //                 game.world[i][j].traversable = true;
-    //             }
-    //             else
-    //             {
-    //                 game.world[i][j].type = GRASS;
-    //                 game.world[i][j].traversable = true;
-    //             }
-    //         }
-    //     }
-    // }
-}
-
-void setup(const Para &p, Game &game)
-{
-    // Generate random spawn coordinates for the player
-    int x_tile, y_tile;
-    x_tile = rnd(p.NUM_TILES_X);
-    y_tile = rnd(p.NUM_TILES_Y);
-    // Convert tile indices to screen coordinates
-    game.player.x = x_tile * p.TILE_SIZE;
-    game.player.y = y_tile * p.TILE_SIZE;
-    game.player.health = p.MAX_HEALTH;
-    game.player.has_key = false;
-    game.player.air = p.MAX_AIR;
-    game.player.mobs_killed = p.BASE_MOBS_KILLED;
-    game.player.level = 1;
-    game.num_mobs = 0;
-    game.tick_counter = 0; // Initialize tick counter
-    game.map = "level_"+to_string(game.player.level)+".json";
-    game.mobs = new Mob[p.MAX_MOBS];
-
-    string title = "Tile-Based RPG";
-    string welcome = "Welcome to this RPG game, developed by Ronan. To get started, please kill " +
-                     to_string(game.player.level * 10 / 2) + " mobs to get the key to progress to the next level.";
-    string pressEnter = "Press ENTER to Start";
+    // No level file, so generate one rather than leave the player in an empty map
+    if (level_gen_fallback(p, game, world))
+    {
+        std::swap(game.world, world);
+        sim_world_changed(game);
+        tile_layer_mark_all(tile_layer);
+    }
+}
 
-    draw_screen(p, game, title, welcome, pressEnter);
+// Loads game.map and hands it to the simulation, restarting the tick clock
+void start_level(const Para &p, Game &game)
+{
+    recording_add(recording, REPLAY_START_LEVEL);
+    initialize_tiles(game.map, p, game);
+    sim_start_level(p, game);
+    resource_reset_timer(registry, res.sim_clock);
+    sim_ticks_run = 0;
+    pending_command = CMD_NONE;
 }
 
-void draw_world(const Para &p, Game &game)
+// Starts the run from a seed of its own so it can be recorded and replayed
+void start_run(const Para &p, Game &game)
 {
-    for (int i = 0; i < p.NUM_TILES_X; ++i)
-    {
-        for (int j = 0; j < p.NUM_TILES_Y; ++j)
-        {
-            switch (game.world[i][j].type)
-            {
-            case GRASS:
-                fill_rectangle(COLOR_GREEN, game.world[i][j].x, game.world[i][j].y, p.TILE_SIZE, p.TILE_SIZE);
-                break;
-            case WATER:
-                fill_rectangle(COLOR_BLUE, game.world[i][j].x, game.world[i][j].y, p.TILE_SIZE, p.TILE_SIZE);
-                break;
-            case WALL:
-                fill_rectangle(COLOR_DARK_GREEN, game.world[i][j].x, game.world[i][j].y, p.TILE_SIZE, p.TILE_SIZE);
-                break;
-            case DOOR:
-                fill_rectangle(game.player.has_key ? COLOR_GOLD : COLOR_BLACK, game.world[i][j].x, game.world[i][j].y, p.TILE_SIZE, p.TILE_SIZE);
-                if (game.player.has_key)
-                {
-                    if (game.world[i][j].type == DOOR)
-                    {
-                        game.world[i][j].traversable = true;
-                    }
-                }
-                break;
-            }
-        }
-    }
+    uint64_t seed = rng_next(game.rng);
+    rng_seed(game.rng, seed);
+    recording_begin(recording, seed, p);
+    sim_new_run(p, game);
+    start_level(p, game);
 }
 
-void initialize_mobs(const Para &p, Game &game)
+void draw_world(const Para &p, const Game &game)
 {
-    game.mobs = new Mob[p.MAX_MOBS]; // Allocate memory for the mobs array
+    PROFILE_ZONE("draw_world");
+    // Repaint only the tiles that changed, then blit the blocks on screen
+    tile_layer_update(tile_layer, game.world, p.TILE_SIZE, game.player.has_key, camera, p.SCREEN_WIDTH, p.SCREEN_HEIGHT);
+    tile_layer_draw(tile_layer, camera, p.SCREEN_WIDTH, p.SCREEN_HEIGHT);
 }
 
 void draw_mobs(const Para &p, const Game &game)
 {
-    for (int i = 0; i < game.num_mobs; ++i)
+    PROFILE_ZONE("draw_mobs");
+    for (int i = 0; i < game.mobs.count; ++i)
     {
-        fill_circle(COLOR_GRAY, game.mobs[i].x + p.TILE_SIZE / 2, game.mobs[i].y + p.TILE_SIZE / 2, p.TILE_SIZE / 4);
+        int x = game.mobs.x[i] * p.TILE_SIZE;
+        int y = game.mobs.y[i] * p.TILE_SIZE;
+        if (camera_sees(camera, x, y, p.TILE_SIZE, p.TILE_SIZE, p.SCREEN_WIDTH, p.SCREEN_HEIGHT))
+        {
+            fill_circle(COLOR_GRAY, x - camera.x + p.TILE_SIZE / 2, y - camera.y + p.TILE_SIZE / 2, p.TILE_SIZE / 4);
+        }
     }
 }
 
 void draw_player(const Para &p, const Game &game)
 {
-    fill_circle(COLOR_RED, game.player.x + p.TILE_SIZE / 2, game.player.y + p.TILE_SIZE / 2, p.TILE_SIZE / 4);
+    PROFILE_ZONE("draw_player");
+    fill_circle(COLOR_RED, game.player.x * p.TILE_SIZE - camera.x + p.TILE_SIZE / 2, game.player.y * p.TILE_SIZE - camera.y + p.TILE_SIZE / 2, p.TILE_SIZE / 4);
 }
 
 void draw_stats(const Para &p, const Game &game)
 {
+    PROFILE_ZONE("draw_stats");
     for (int i = 0; i < 10; ++i)
     {
         if (i < game.player.health / 10)
@@ -450,405 +320,583 @@ void edit_map(const Para &p, Game &game, TileType draw_type)
     int m_y = mouse_y();
 
     // Convert mouse position to grid coordinates
-    int tile_x = m_x / p.TILE_SIZE;
-    int tile_y = m_y / p.TILE_SIZE;
+    int tile_x = (m_x + camera.x) / p.TILE_SIZE;
+    int tile_y = (m_y + camera.y) / p.TILE_SIZE;
     // Check if the mouse is within the map bounds and left mouse button is clicked
-    if (mouse_clicked(LEFT_BUTTON) && tile_x >= 0 && tile_x < p.NUM_TILES_X && tile_y >= 0 && tile_y < p.NUM_TILES_Y)
+    if (!mouse_clicked(LEFT_BUTTON) || !world_resident(game.world, tile_x, tile_y))
     {
-        if (draw_type == GRASS)
-        {
-            game.world[tile_x][tile_y].type = GRASS;
-            game.world[tile_x][tile_y].traversable = true;
-        }
-        else if (draw_type == WATER)
-        {
-            game.world[tile_x][tile_y].type = WATER;
-            game.world[tile_x][tile_y].traversable = true;
-        }
-        else if (draw_type == WALL)
+        return;
+    }
+
+    // The journal checks the type's edit rules for every tile it paints
+    bool traversable = tile_type_info(draw_type).traversable;
+    const EditBatch *batch = nullptr;
+    if (editor_brush == BRUSH_PENCIL)
+    {
+        batch = edit_rect(edit_journal, game, tile_x, tile_y, tile_x, tile_y, draw_type, traversable);
+    }
+    else if (editor_brush == BRUSH_FILL)
+    {
+        batch = edit_flood(edit_journal, game, tile_x, tile_y, draw_type, traversable);
+    }
+    else if (brush_anchor_x < 0)
+    {
+        brush_anchor_x = tile_x;
+        brush_anchor_y = tile_y;
+    }
+    else
+    {
+        if (editor_brush == BRUSH_RECT)
         {
-            if (tile_x != 0 && tile_x != p.NUM_TILES_X - 1 && tile_y != 0 && tile_y != p.NUM_TILES_Y - 1)
-            {
-                game.world[tile_x][tile_y].type = WALL;
-                game.world[tile_x][tile_y].traversable = false;
-            }
+            batch = edit_rect(edit_journal, game, brush_anchor_x, brush_anchor_y, tile_x, tile_y, draw_type, traversable);
         }
-        else if (draw_type == DOOR)
+        else
         {
-            bool door_exists = false;
-            for (int i = 0; i < p.NUM_TILES_X; ++i)
-            {
-                for (int j = 0; j < p.NUM_TILES_Y; ++j)
-                {
-                    if (game.world[i][j].type == DOOR)
-                    {
-                        door_exists = true;
-                        break;
-                    }
-                }
-                if (door_exists)
-                {
-                    break;
-                }
-            }
-            if (!door_exists)
-            {
-                game.world[tile_x][tile_y].type = DOOR;
-                game.world[tile_x][tile_y].traversable = false;
-            }
+            batch = edit_line(edit_journal, game, brush_anchor_x, brush_anchor_y, tile_x, tile_y, draw_type, traversable);
         }
+        brush_anchor_x = brush_anchor_y = -1;
+    }
+    if (batch)
+    {
+        LOG_DEBUG(LOG_EDITOR, "Painted %d tiles of %s", (int)batch->tiles, tile_type_name(draw_type));
+        mark_edit(game, *batch);
     }
 }
 
-void handle_input(const Para &p, Game &game)
+// Loads game.map for editing, with a fresh history
+void open_in_editor(const Para &p, Game &game)
 {
-    static TileType current_draw_type = GRASS;
+    initialize_tiles(game.map, p, game);
+    connectivity_reset(connectivity, game.world);
+    edit_journal_reset(edit_journal, game.world);
+    brush_anchor_x = brush_anchor_y = -1;
+    save_unreachable = false;
+}
 
-    if (game.state == NOT_STARTED)
+// Repaints and rechecks the tiles a batch changed, after it was painted, undone or redone
+void mark_edit(const Game &game, const EditBatch &batch)
+{
+    if (batch.tiles > EDIT_REFRESH_TILES)
     {
-        if (key_typed(RETURN_KEY))
-        {
-            initialize_tiles(game.map, p, game);
-            spawn_mobs(p, game);
-            game.state = PLAYING;
-        }
-        else if (key_typed(ESCAPE_KEY))
-        {
-            game.state = GAME_OVER;
-            draw_game_over();
-        }
-        else if (key_typed(RIGHT_CTRL_KEY) && key_typed(E_KEY) || key_typed(LEFT_CTRL_KEY) && key_typed(E_KEY))
-        {
-            printf("Entered Map Edit Mode\n\nEditing the map");
-            initialize_tiles(game.map, p, game);
-            game.state = EDITING;
-        }
+        tile_layer_mark_all(tile_layer);
     }
-    else if (game.state == EDITING)
+    for (const EditRun &run : batch.runs)
     {
-        if (key_typed(NUM_7_KEY))
+        unsaved_runs.push_back({run.x, run.y, run.length});
+        // One mark per chunk the run crosses
+        for (int x = run.x; x < run.x + run.length; x = (x | CHUNK_MASK) + 1)
         {
-            current_draw_type = GRASS;
+            connectivity_mark(connectivity, game.world, x, run.y);
         }
-        else if (key_typed(NUM_8_KEY))
+        for (int i = 0; i < run.length && batch.tiles <= EDIT_REFRESH_TILES; ++i)
         {
-            current_draw_type = WATER;
-        }
-        else if (key_typed(NUM_9_KEY))
-        {
-            current_draw_type = WALL;
-        }
-        else if (key_typed(NUM_6_KEY))
-        {
-            current_draw_type = DOOR;
-        }
-        else if (key_typed(NUM_1_KEY))
-        {
-            printf("Level 1 Map opened");
-            game.map = "level_1.json";
-            initialize_tiles(game.map, p, game);
-        }
-        else if (key_typed(NUM_2_KEY))
-        {
-            printf("Level 2 Map opened");
-            game.map = "level_2.json";
-            initialize_tiles(game.map, p, game);
-        }
-        else if (key_typed(NUM_3_KEY))
-        {
-            printf("Level 3 Map opened");
-            game.map = "level_3.json";
-            initialize_tiles(game.map, p, game);
-        }
-        else if (key_typed(ESCAPE_KEY))
-        {
-            game.state = NOT_STARTED;
-        }
-        else if (key_typed(RETURN_KEY)) {
-            save_map_to_file(game.map, p, game);
-            game.state = NOT_STARTED;  // Return to the initial state after saving
-        }
-        
-        // Call edit_map to handle the drawing
-        edit_map(p, game, current_draw_type);
-    }
-    else if (game.state==GAME_OVER){
-        if (key_typed(RETURN_KEY)){
-            game.state = NOT_STARTED;
-        } 
-        else if (key_typed(ESCAPE_KEY)){
-            draw_game_over();
+            tile_layer_mark_dirty(tile_layer, run.x + i, run.y);
         }
     }
-    else if (game.state == LEVELED)
+    save_unreachable = false;
+}
+
+// Appends the tiles edited since the last autosave to the level's edit log, every AUTOSAVE_SECONDS
+void autosave_edits(const Game &game)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (unsaved_runs.empty() || std::chrono::duration<double>(now - last_autosave).count() < AUTOSAVE_SECONDS)
+    {
+        return;
+    }
+    level_saver_append(level_saver, game.map, game.world, unsaved_runs);
+    unsaved_runs.clear();
+    last_autosave = now;
+}
+
+// Leaves the level as it was last saved: the edits are dropped from its edit log as well
+void discard_edits(const Game &game)
+{
+    level_saver_discard(level_saver, game.map, game.world);
+    unsaved_runs.clear();
+}
+
+// Outlines the rectangle or line waiting for its second click
+void draw_brush(const Para &p)
+{
+    if (brush_anchor_x < 0)
     {
-        if (key_typed(RETURN_KEY))
-        {
-            game.state = PLAYING;
-            initialize_tiles(game.map, p, game);
-            spawn_mobs(p, game);
-        }
-        else if (key_typed(ESCAPE_KEY))
-        {
-            game.state = GAME_OVER;
-            draw_game_over();
-        }
+        return;
+    }
+    int x0 = brush_anchor_x * p.TILE_SIZE - camera.x;
+    int y0 = brush_anchor_y * p.TILE_SIZE - camera.y;
+    int x1 = ((int)mouse_x() + camera.x) / p.TILE_SIZE * p.TILE_SIZE - camera.x;
+    int y1 = ((int)mouse_y() + camera.y) / p.TILE_SIZE * p.TILE_SIZE - camera.y;
+    if (editor_brush == BRUSH_RECT)
+    {
+        draw_rectangle(COLOR_WHITE, std::min(x0, x1), std::min(y0, y1), std::abs(x1 - x0) + p.TILE_SIZE, std::abs(y1 - y0) + p.TILE_SIZE);
     }
-    else if (game.state == PLAYING)
+    else
     {
-        if (key_typed(D_KEY))
+        draw_line(COLOR_WHITE, x0 + p.TILE_SIZE / 2, y0 + p.TILE_SIZE / 2, x1 + p.TILE_SIZE / 2, y1 + p.TILE_SIZE / 2);
+    }
+}
+
+// Shades passable tiles cut off from the main area and rings the door red if it cannot be reached
+void draw_connectivity(const Para &p, const Game &game)
+{
+    PROFILE_ZONE("draw_connectivity");
+    connectivity_update(connectivity, game.world);
+    if (connectivity.passable_tiles > connectivity.main_tiles)
+    {
+        color stray = rgba_color(255, 0, 0, 96);
+        int x0 = std::max(0, camera.x / p.TILE_SIZE);
+        int y0 = std::max(0, camera.y / p.TILE_SIZE);
+        int x1 = std::min(game.world.width, (camera.x + p.SCREEN_WIDTH) / p.TILE_SIZE + 1);
+        int y1 = std::min(game.world.height, (camera.y + p.SCREEN_HEIGHT) / p.TILE_SIZE + 1);
+        for (int y = y0; y < y1; ++y)
         {
-            move_player(p, game, p.TILE_SIZE, 0);
+            for (int x = x0; x < x1; ++x)
+            {
+                if (connectivity_stray(connectivity, game.world, x, y))
+                {
+                    fill_rectangle(stray, x * p.TILE_SIZE - camera.x, y * p.TILE_SIZE - camera.y, p.TILE_SIZE, p.TILE_SIZE);
+                }
+            }
         }
-        else if (key_typed(A_KEY))
+    }
+    connectivity_for_each_exit(connectivity, game.world, [&](int x, int y, bool reachable) {
+        if (!reachable)
         {
-            move_player(p, game, -p.TILE_SIZE, 0);
+            draw_rectangle(COLOR_RED, x * p.TILE_SIZE - camera.x, y * p.TILE_SIZE - camera.y, p.TILE_SIZE, p.TILE_SIZE);
+            draw_rectangle(COLOR_RED, x * p.TILE_SIZE - camera.x + 1, y * p.TILE_SIZE - camera.y + 1, p.TILE_SIZE - 2, p.TILE_SIZE - 2);
         }
-        else if (key_typed(W_KEY))
+    });
+
+    string status;
+    if (connectivity.exit_count == 0)
+    {
+        status = "No door";
+    }
+    else if (connectivity.reachable_exits == 0)
+    {
+        status = "Door cannot be reached";
+    }
+    if (connectivity.passable_tiles > connectivity.main_tiles)
+    {
+        status += string(status.empty() ? "" : ", ") + to_string(connectivity.passable_tiles - connectivity.main_tiles) + " tiles cut off";
+    }
+    if (save_unreachable)
+    {
+        status += ". Press Enter again to save anyway";
+    }
+    if (!status.empty())
+    {
+        draw_text(status, COLOR_RED, 25, 10);
+    }
+}
+
+// Title screen keys
+void handle_title_input(const Para &p, Game &game)
+{
+    PROFILE_ZONE("handle_input");
+    if (key_typed(RETURN_KEY))
+    {
+        // The loading screen takes over until the game assets are in
+        if (asset_loader_ready(asset_loader, ASSET_GROUP_GAME))
         {
-            move_player(p, game, 0, -p.TILE_SIZE);
+            start_run(p, game);
         }
-        else if (key_typed(S_KEY))
+        else
         {
-            move_player(p, game, 0, p.TILE_SIZE);
+            start_requested = true;
         }
-        else if (key_typed(ESCAPE_KEY))
+    }
+    else if (key_typed(ESCAPE_KEY))
+    {
+        game.state = GAME_OVER;
+        draw_game_over();
+    }
+    else if (key_typed(F9_KEY))
+    {
+        quickload(p, game);
+    }
+    else if (key_typed(RIGHT_CTRL_KEY) && key_typed(E_KEY) || key_typed(LEFT_CTRL_KEY) && key_typed(E_KEY))
+    {
+        game.state = EDITING;
+    }
+}
+
+// Editor keys, then the brush under the mouse
+void handle_editor_input(const Para &p, Game &game)
+{
+    PROFILE_ZONE("handle_input");
+    int typed_type = typed_tile_type();
+    bool ctrl = key_down(LEFT_CTRL_KEY) || key_down(RIGHT_CTRL_KEY);
+    if (typed_type >= 0)
+    {
+        editor_draw_type = (TileType)typed_type;
+    }
+    else if (ctrl && (key_typed(Z_KEY) || key_typed(Y_KEY)))
+    {
+        const EditBatch *batch = key_typed(Z_KEY) ? edit_undo(edit_journal, game) : edit_redo(edit_journal, game);
+        if (batch)
         {
-            game.state = GAME_OVER;
-            draw_game_over();
+            mark_edit(game, *batch);
         }
     }
+    else if (key_typed(P_KEY) || key_typed(R_KEY) || key_typed(L_KEY) || key_typed(F_KEY))
+    {
+        editor_brush = key_typed(P_KEY) ? BRUSH_PENCIL : key_typed(R_KEY) ? BRUSH_RECT : key_typed(L_KEY) ? BRUSH_LINE : BRUSH_FILL;
+        brush_anchor_x = brush_anchor_y = -1;
+    }
+    else if (key_typed(NUM_1_KEY))
+    {
+        LOG_INFO(LOG_EDITOR, "Level 1 Map opened");
+        discard_edits(game);
+        game.map = "level_1.json";
+        open_in_editor(p, game);
+    }
+    else if (key_typed(NUM_2_KEY))
+    {
+        LOG_INFO(LOG_EDITOR, "Level 2 Map opened");
+        discard_edits(game);
+        game.map = "level_2.json";
+        open_in_editor(p, game);
+    }
+    else if (key_typed(NUM_3_KEY))
+    {
+        LOG_INFO(LOG_EDITOR, "Level 3 Map opened");
+        discard_edits(game);
+        game.map = "level_3.json";
+        open_in_editor(p, game);
+    }
+    else if (key_typed(ESCAPE_KEY))
+    {
+        discard_edits(game);
+        game.state = NOT_STARTED;
+        return;
+    }
+    else if (key_typed(RETURN_KEY) && check_map_before_save(game)) {
+        save_map_to_file(game.map, p, game);
+        game.state = NOT_STARTED;  // Return to the initial state after saving
+        return;
+    }
+
+    // Arrow keys look around levels bigger than the screen
+    camera.x += (key_down(RIGHT_KEY) - key_down(LEFT_KEY)) * EDITOR_PAN_SPEED;
+    camera.y += (key_down(DOWN_KEY) - key_down(UP_KEY)) * EDITOR_PAN_SPEED;
+    camera_clamp(camera, p.SCREEN_WIDTH, p.SCREEN_HEIGHT, game.world.width * p.TILE_SIZE, game.world.height * p.TILE_SIZE);
+
+    // Call edit_map to handle the drawing
+    edit_map(p, game, editor_draw_type);
 }
 
-bool is_traversable(const Para &p, Game &game, int x, int y)
+void handle_game_over_input(const Para &p, Game &game)
 {
-    if (x < 0 || y < 0 || x >= p.SCREEN_WIDTH || y >= p.SCREEN_HEIGHT)
-        return false;
-    return game.world[x / p.TILE_SIZE][y / p.TILE_SIZE].traversable;
+    if (key_typed(RETURN_KEY)){
+        game.state = NOT_STARTED;
+    } 
+    else if (key_typed(ESCAPE_KEY)){
+        draw_game_over();
+    }
 }
 
-void leveled(const Para &p, Game &game)
+void handle_leveled_input(const Para &p, Game &game)
 {
-    if (game.player.level <= 3)
+    if (key_typed(RETURN_KEY))
     {
+        start_level(p, game);
+    }
+    else if (key_typed(ESCAPE_KEY))
+    {
+        game.state = GAME_OVER;
+        draw_game_over();
+    }
+}
 
-        string title = "LEVELED UP " + to_string(game.player.level - 1) + " -> " + to_string(game.player.level);
-        string welcome = "please kill " + to_string(game.player.level * 10 / 2) +
-                         " mobs to get the key to progress to the next level.";
-        string pressEnter = "Press ENTER to Continue";
-
-        draw_screen(p, game, title, welcome, pressEnter);
+// Moves are queued for the next simulation tick
+void handle_play_input(const Para &p, Game &game)
+{
+    PROFILE_ZONE("handle_input");
+    if (key_typed(D_KEY))
+    {
+        pending_command = CMD_MOVE_RIGHT;
     }
-    else
+    else if (key_typed(A_KEY))
+    {
+        pending_command = CMD_MOVE_LEFT;
+    }
+    else if (key_typed(W_KEY))
+    {
+        pending_command = CMD_MOVE_UP;
+    }
+    else if (key_typed(S_KEY))
+    {
+        pending_command = CMD_MOVE_DOWN;
+    }
+    else if (key_typed(F5_KEY))
+    {
+        quicksave(game);
+    }
+    else if (key_typed(F9_KEY))
+    {
+        quickload(p, game);
+    }
+    else if (key_typed(ESCAPE_KEY))
     {
         game.state = GAME_OVER;
-        printf("3 levels completed Game over you win!\n");
+        draw_game_over();
     }
 }
 
-void leveling(const Para &p, Game &game)
+// Runs however many fixed ticks are due since the level started
+void run_sim_ticks(const Para &p, Game &game)
 {
-    // Clear the screen and reset player's position
-    clear_screen(COLOR_WHITE_SMOKE);
-    // Increment player's level and regenerate the world
-    game.player.level++;
-    game.player.has_key = false; // clearing the players key so they have to get it in the next level.
-    game.player.mobs_killed = p.BASE_MOBS_KILLED;
-    game.player.health = p.MAX_HEALTH;
-    game.player.air = p.MAX_AIR;
-    game.state = LEVELED;
-    game.map = "level_"+to_string(game.player.level)+".json";
-    printf("Leveled up to level: %d\n", game.player.level);
-}
-
-void move_player(const Para &p, Game &game, int dx, int dy)
-{
-    int new_x = game.player.x + dx;
-    int new_y = game.player.y + dy;
-
-    if (is_traversable(p, game, new_x, new_y))
-    {
-        game.player.x = new_x;
-        game.player.y = new_y;
-        // Check for door collision
-        int tile_x = game.player.x / p.TILE_SIZE;
-        int tile_y = game.player.y / p.TILE_SIZE;
-        if (game.world[tile_x][tile_y].type == DOOR && !game.player.has_key)
-        {
-            // Player needs key to open the door
-            // Prevent player from moving through the door without the key
-            game.player.x -= dx;
-            game.player.y -= dy;
-        }
-        else if (game.world[tile_x][tile_y].type == WATER)
+    PROFILE_ZONE("run_sim_ticks");
+    unsigned int due = resource_timer_ticks(registry, res.sim_clock) * SIM_TICKS_PER_SECOND / 1000;
+    int steps = 0;
+    while (sim_ticks_run < due && steps < MAX_CATCH_UP_TICKS && game.state == PLAYING)
+    {
+        if (pending_command != CMD_NONE)
         {
-            if (game.player.air < 0)
-            {
-                game.player.health -= game.player.level * 2;
-            }
-            else
-            {
-                game.player.air -= p.AIR_LOSS_RATE;
-            }
+            recording_add(recording, REPLAY_COMMAND, pending_command);
         }
-        else if (game.world[tile_x][tile_y].type == GRASS)
-        {
+        sim_tick(p, game, pending_command);
+        recording_tick(recording);
+        pending_command = CMD_NONE;
+        sim_ticks_run++;
+        steps++;
+    }
+    if (sim_ticks_run < due && steps == MAX_CATCH_UP_TICKS)
+    {
+        sim_ticks_run = due; // too far behind, drop the time rather than spiral
+    }
+}
 
+// Plays and prints what the simulation reported since the last frame
+void play_sim_events(const Para &p, Game &game)
+{
+    PROFILE_ZONE("play_sim_events");
+    for (const SimEvent &event : game.events)
+    {
+        switch (event.type)
+        {
+        case EVENT_FOOTSTEP:
             // Play footstep sound alternately
-            if (game.player.footstepValue == 0)
-            {
-                play_sound_effect(p.FOOTSTEP_FIRST);
-                game.player.footstepValue = 1;
-                printf("footstep first played\n");
-            }
-            else
-            {
-                play_sound_effect(p.FOOTSTEP_SECOND);
-                game.player.footstepValue = 0;
-                printf("footstep second played\n");
-            }
-            if (game.player.air < p.MAX_AIR)
+            if (event.value == 0)
             {
-                game.player.air += p.AIR_GAIN_RATE;
+                resource_play_sound(registry, res.footstep_first);
+                LOG_DEBUG(LOG_AUDIO, "footstep first played");
             }
             else
             {
-                printf("player air is max %d\n", game.player.air);
-            }
-            int x, y;
-            if (game.player.health < p.MAX_HEALTH)
-            {
-                game.player.health++;
-            }
-            else
-            {
-                printf("Player is at max health\n");
-            }
-            // stop_sound_effect(FOOTSTEPS);
-        }
-        else if (game.world[tile_x][tile_y].type == DOOR)
-        {
-            leveling(p, game);
-        }
-        // Check for mob collision
-        for (int i = 0; i < game.num_mobs; ++i)
-        {
-            if (game.mobs[i].x == game.player.x && game.mobs[i].y == game.player.y)
-            {
-                // Decrease player's health when colliding with a mob
-                game.player.health -= game.mobs[i].damage;
-                game.player.mobs_killed++;
-                if (game.player.mobs_killed == game.player.level * 10 / 2) // for level 1 mobs to kill is 5, for leve 2 mobs to kill is 10
-                {
-                    game.player.has_key = true;
-                }
-                // Remove the mob from the game
-                for (int j = i; j < game.num_mobs - 1; ++j)
-                {
-                    game.mobs[j] = game.mobs[j + 1];
-                }
-                game.num_mobs--;
-                break; // Stop checking for mob collisions once one is found
+                resource_play_sound(registry, res.footstep_second);
+                LOG_DEBUG(LOG_AUDIO, "footstep second played");
             }
+            break;
+        case EVENT_AIR_FULL:
+            LOG_DEBUG(LOG_SIM, "player air is max %d", event.value);
+            break;
+        case EVENT_HEALTH_FULL:
+            LOG_DEBUG(LOG_SIM, "Player is at max health");
+            break;
+        case EVENT_KEY_EARNED:
+            break;
+        case EVENT_LEVELED:
+            LOG_INFO(LOG_GAME, "Leveled up to level: %d", event.value);
+            // Parse the next level in the background while the LEVELED screen shows
+            level_cache_prefetch(level_cache, game.map);
+            break;
+        case EVENT_GAME_WON:
+            LOG_INFO(LOG_GAME, "3 levels completed Game over you win!");
+            break;
+        case EVENT_PLAYER_DIED:
+            LOG_INFO(LOG_GAME, "Player died health dropped below 0");
+            break;
+        case EVENT_SPAWN_BLOCKED:
+            LOG_WARN(LOG_SIM, "No free tiles left, %d mobs could not spawn", event.value);
+            break;
         }
     }
+    game.events.clear();
 }
 
-void update_game_state(Game &game)
+// Saves the run just played, if there is one
+void finish_recording()
 {
-    // Check if player's health drops to zero
-    if (game.player.health <= 0)
+    if (!recording.active)
     {
-        printf("Player died health dropped below 0\n");
-        game.state = GAME_OVER;
+        return;
+    }
+    recording.active = false;
+    char stamp[32];
+    time_t now = time(nullptr);
+    strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", localtime(&now));
+    string path = RECORDING_DIR + "session_" + stamp + ".rec";
+    if (save_recording(path, recording))
+    {
+        LOG_INFO(LOG_REPLAY, "Run recorded to %s (%u ticks)", path, recording.ticks);
     }
 }
 
-void spawn_mobs(const Para &p, Game &game) {
-    // Check if the maximum number of mobs has been reached
-    if (game.num_mobs >= p.MAX_MOBS) {
+void quicksave(const Game &game)
+{
+    auto start = std::chrono::steady_clock::now();
+    if (snapshot_save(QUICKSAVE_PATH, game))
+    {
+        LOG_INFO(LOG_GAME, "Quicksaved at tick %d in %.2f ms", game.tick_counter,
+                 std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+}
+
+// Picks the run up where the quicksave left it. The recording of the run
+// being played ends here, since a replay cannot start from a snapshot.
+void quickload(const Para &p, Game &game)
+{
+    auto start = std::chrono::steady_clock::now();
+    if (!snapshot_load(QUICKSAVE_PATH, game))
+    {
         return;
     }
+    LOG_INFO(LOG_GAME, "Quickloaded %s at tick %d in %.2f ms", game.map, game.tick_counter,
+             std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    finish_recording();
+    tile_layer_mark_all(tile_layer);
+    resource_reset_timer(registry, res.sim_clock);
+    sim_ticks_run = 0;
+    pending_command = CMD_NONE;
+}
 
-    // Calculate number of mobs to spawn
-    int mobs_to_spawn = p.MAX_MOBS - game.num_mobs;
+// Real-time replay counts ticks from here; sim_ticks_run holds the tick the clock started on
+void restart_replay_clock()
+{
+    resource_reset_timer(registry, res.sim_clock);
+    sim_ticks_run = replay.tick;
+}
 
-    for (int i = 0; i < mobs_to_spawn; ++i) {
-        int x_tile, y_tile;
-        
-        // Ensure mobs spawn in traversable tiles
-        do {
-            x_tile = rnd(p.NUM_TILES_X);
-            y_tile = rnd(p.NUM_TILES_Y);
-        } while (!game.world[x_tile][y_tile].traversable || is_mob_at(x_tile * p.TILE_SIZE, y_tile * p.TILE_SIZE, game));
+void start_replay(const Para &p, Game &game)
+{
+    replay_start(replay, replay_recording, p, game);
+    restart_replay_clock();
+}
+
+// Plays the recording in real time, or flat out while F is toggled on.
+// Left and right seek back and forward, R restarts.
+void run_replay_frame(const Para &p, Game &game)
+{
+    if (key_typed(F_KEY))
+    {
+        replay_fast = !replay_fast;
+        restart_replay_clock();
+    }
+    if (key_typed(R_KEY))
+    {
+        start_replay(p, game);
+    }
+    if (key_typed(RIGHT_KEY) || key_typed(LEFT_KEY))
+    {
+        uint32_t target = key_typed(RIGHT_KEY) ? replay.tick + REPLAY_SEEK_TICKS
+                                               : replay.tick - std::min(replay.tick, REPLAY_SEEK_TICKS);
+        replay_seek(replay, p, game, target);
+        game.events.clear();
+        restart_replay_clock();
+    }
 
-        // Initialize the mob
-        game.mobs[game.num_mobs].x = x_tile * p.TILE_SIZE;
-        game.mobs[game.num_mobs].y = y_tile * p.TILE_SIZE;
-        game.mobs[game.num_mobs].health = 100; // Example health value
-        game.mobs[game.num_mobs].damage = 10; // Example damage value
-        game.mobs[game.num_mobs].move_direction = rnd(4); // Random initial direction
+    if (replay_fast)
+    {
+        unsigned int start = resource_timer_ticks(registry, res.sim_clock);
+        while (resource_timer_ticks(registry, res.sim_clock) - start < REPLAY_FAST_FRAME_MS && replay_step(replay, p, game))
+        {
+            game.events.clear();
+        }
+    }
+    else
+    {
+        unsigned int due = sim_ticks_run + resource_timer_ticks(registry, res.sim_clock) * SIM_TICKS_PER_SECOND / 1000;
+        for (int steps = 0; replay.tick < due && steps < MAX_CATCH_UP_TICKS && replay_step(replay, p, game); ++steps)
+        {
+        }
+        play_sim_events(p, game);
+    }
+    if (replay.level_changed)
+    {
+        tile_layer_mark_all(tile_layer);
+        replay.level_changed = false;
+    }
 
-        // Increment the mob count
-        game.num_mobs++;
+    clear_screen(COLOR_WHITE);
+    if (game.world.width > 0)
+    {
+        camera_follow(camera, game.player.x * p.TILE_SIZE + p.TILE_SIZE / 2, game.player.y * p.TILE_SIZE + p.TILE_SIZE / 2,
+                      p.SCREEN_WIDTH, p.SCREEN_HEIGHT, game.world.width * p.TILE_SIZE, game.world.height * p.TILE_SIZE);
+        draw_world(p, game);
+        draw_mobs(p, game);
+        draw_player(p, game);
+        draw_stats(p, game);
     }
+    string status = "Replay tick " + to_string(replay.tick) + " / " + to_string(replay_recording.ticks) +
+                    (replay.finished ? " (finished)" : "") + (replay_fast ? " fast" : "") +
+                    "  F: Fast, Left/Right: Seek, R: Restart";
+    draw_text(status, COLOR_BLACK, 25, screen_height() - 25);
 }
 
-bool is_mob_at(int x, int y, const Game &game)
+void handle_profiler_keys()
 {
-    for (int i = 0; i < game.num_mobs; ++i)
+    if (key_typed(F3_KEY))
     {
-        if (game.mobs[i].x == x && game.mobs[i].y == y)
-        {
-            return true; // Mob found at the given position
-        }
+        show_profiler = !show_profiler;
+        profiler_set_enabled(show_profiler);
+    }
+    if (key_typed(F4_KEY) && profiler_enabled())
+    {
+        write_profiler_trace();
     }
-    return false; // No mob found at the given position
 }
 
-void move_mobs(const Para &p, Game &game)
+void write_profiler_trace()
 {
-    if (timer_ticks(p.MOB_MOVE_TIMER) >= p.MOB_MOVE_INTERVAL)
+    char stamp[32];
+    time_t now = time(nullptr);
+    strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", localtime(&now));
+    profiler_write_trace("logs/trace_" + string(stamp) + ".json");
+}
+
+// Per-stage times averaged over recent frames, and the last PROFILE_FRAME_HISTORY frame times
+void draw_profiler_overlay(const Para &p)
+{
+    if (!show_profiler)
     {
-        for (int i = 0; i < game.num_mobs; ++i)
-        {
-            // Generate random movement direction
-            int move_dir = rnd(4); // 0: up, 1: down, 2: left, 3: right
-            // Move mob based on direction
-            switch (move_dir)
-            {
-            case 0:
-                game.mobs[i].y -= p.TILE_SIZE; // Move one-half of the tile size up
-                break;
-            case 1:
-                game.mobs[i].y += p.TILE_SIZE; // Move one-half of the tile size down
-                break;
-            case 2:
-                game.mobs[i].x -= p.TILE_SIZE; // Move one-half of the tile size left
-                break;
-            case 3:
-                game.mobs[i].x += p.TILE_SIZE; // Move one-half of the tile size right
-                break;
-            }
-            // Ensure mob stays within bounds and moves to a traversable tile
-            int new_tile_x = game.mobs[i].x / p.TILE_SIZE;
-            int new_tile_y = game.mobs[i].y / p.TILE_SIZE;
-            if (new_tile_x < 0 || new_tile_x >= p.NUM_TILES_X || new_tile_y < 0 || new_tile_y >= p.NUM_TILES_Y || !game.world[new_tile_x][new_tile_y].traversable)
-            {
-                // Undo movement if mob moves out of bounds or onto non-traversable tile
-                game.mobs[i].x -= (move_dir == 3 ? p.TILE_SIZE : (move_dir == 2 ? -p.TILE_SIZE : 0)); // Undo horizontal movement
-                game.mobs[i].y -= (move_dir == 1 ? p.TILE_SIZE : (move_dir == 0 ? -p.TILE_SIZE : 0)); // Undo vertical movement
-            }
+        return;
+    }
+    const Profiler &prof = profiler();
+    int LINE_HEIGHT = 12;
+    int graph_height = 40 * PROFILER_GRAPH_SCALE;
+    int height = (int)prof.stages.size() * LINE_HEIGHT + graph_height + 20;
+    fill_rectangle(rgba_color(255, 255, 255, 200), 5, 5, PROFILE_FRAME_HISTORY + 10, height);
+
+    int y = 10;
+    char line[64];
+    for (const ProfileStage &stage : prof.stages)
+    {
+        snprintf(line, sizeof(line), "%-18s %6.2f ms", stage.name, stage.average_ms);
+        draw_text(line, COLOR_BLACK, 10, y);
+        y += LINE_HEIGHT;
+    }
 
-            // Check for mob collision
-            if (game.mobs[i].x == game.player.x && game.mobs[i].y == game.player.y)
-            {
-                // Decrease player's health when colliding with a mob
-                game.player.health -= game.mobs[i].damage;
-            }
-        }
-        reset_timer(p.MOB_MOVE_TIMER);
+    // One bar per frame, oldest on the left, with the 60 fps budget marked
+    int base = y + 5 + graph_height;
+    uint64_t frames = std::min<uint64_t>(prof.frame_count, PROFILE_FRAME_HISTORY);
+    for (uint64_t i = 0; i < frames; ++i)
+    {
+        float ms = prof.frame_ms[(prof.frame_count - frames + i) % PROFILE_FRAME_HISTORY];
+        int bar = std::min(graph_height, (int)(ms * PROFILER_GRAPH_SCALE));
+        fill_rectangle(ms > 1000.0 / 60 ? COLOR_RED : COLOR_GREEN, 10 + i, base - bar, 1, bar);
     }
+    double budget = 1000.0 / 60 * PROFILER_GRAPH_SCALE;
+    draw_line(COLOR_BLACK, 10, base - budget, 10 + PROFILE_FRAME_HISTORY, base - budget);
+}
+
+void present_frame(const Para &p)
+{
+    draw_profiler_overlay(p);
+    PROFILE_ZONE("refresh_screen");
+    refresh_screen(60);
 }
 
 void draw_game_over()
@@ -857,90 +905,246 @@ void draw_game_over()
 }
 
 // Function to display the available commands
+// Tile type whose editor key was typed this frame, -1 if none
+int typed_tile_type()
+{
+    const TileTypeRegistry &types = tile_types();
+    for (uint8_t id : types.defined)
+    {
+        int key = types.info[id].editor_key;
+        if (key >= 0 && key <= 9 && key_typed(DIGIT_KEYS[key]))
+        {
+            return id;
+        }
+    }
+    return -1;
+}
+
+// Key help along the bottom of the editor, one entry per tile type with an editor key
+string editor_command_text()
+{
+    string commands_text = "1: Level 1, 2: Level 2, 3: Level 3, ";
+    const TileTypeRegistry &types = tile_types();
+    for (uint8_t id : types.defined)
+    {
+        if (types.info[id].editor_key >= 0)
+        {
+            commands_text += to_string(types.info[id].editor_key) + ": " + types.info[id].name + ", ";
+        }
+    }
+    commands_text += "P/R/L/F: Pencil/Rect/Line/Fill, Ctrl+Z/Y: Undo/Redo, Arrows: Scroll, Press Enter to save";
+    return commands_text;
+}
+
 void display_commands() {
-    // Define the text to be displayed
-    string commands_text = "1: Level 1, 2: Level 2, 3: Level 3, 6: Door, 7: Grass 8: Water 9: Wall, Press Enter to save";
 // Calculate the position to draw the text
     float x = 25; // Left side of the screen
     float y = screen_height() - 25; // 100 pixels above the bottom border
     // Draw the text on the screen
-    draw_text(commands_text, COLOR_BLACK, x, y);
+    draw_text(editor_commands, COLOR_BLACK, x, y);
+}
+
+// Title: a fresh run behind the welcome screen, loading screens while assets come in
+void enter_title(const Para &p, Game &game)
+{
+    // Fresh player, random spawn, level 1
+    sim_new_run(p, game);
+
+    string welcome = "Welcome to this RPG game, developed by Ronan. To get started, please kill " +
+                     to_string(game.player.level * 10 / 2) + " mobs to get the key to progress to the next level.";
+    open_menu(p, "Tile-Based RPG", welcome, "Press ENTER to Start");
+}
+
+void update_title(const Para &p, Game &game)
+{
+    if (start_requested)
+    {
+        if (asset_loader_ready(asset_loader, ASSET_GROUP_GAME))
+        {
+            start_requested = false;
+            start_run(p, game);
+        }
+    }
+    else if (asset_loader_ready(asset_loader, ASSET_GROUP_TITLE))
+    {
+        handle_title_input(p, game);
+    }
+}
+
+void render_title(const Para &p, Game &game)
+{
+    if (!asset_loader_ready(asset_loader, ASSET_GROUP_TITLE))
+    {
+        draw_loading_screen(p, asset_loader_progress(asset_loader, ASSET_GROUP_TITLE));
+    }
+    else if (start_requested)
+    {
+        draw_loading_screen(p, asset_loader_progress(asset_loader, ASSET_GROUP_GAME));
+    }
+    else
+    {
+        draw_menu(p, game);
+    }
+}
+
+// Playing: advance the simulation, then draw the state it left
+void update_playing(const Para &p, Game &game)
+{
+    handle_play_input(p, game);
+    run_sim_ticks(p, game);
+    play_sim_events(p, game);
 }
 
-int main()
+void render_playing(const Para &p, Game &game)
+{
+    clear_screen(COLOR_WHITE);
+    camera_follow(camera, game.player.x * p.TILE_SIZE + p.TILE_SIZE / 2, game.player.y * p.TILE_SIZE + p.TILE_SIZE / 2,
+                  p.SCREEN_WIDTH, p.SCREEN_HEIGHT, game.world.width * p.TILE_SIZE, game.world.height * p.TILE_SIZE);
+    draw_world(p, game);
+    draw_mobs(p, game);
+    draw_player(p, game);
+    draw_stats(p, game);
+}
+
+void enter_leveled(const Para &p, Game &game)
+{
+    string title = "LEVELED UP " + to_string(game.player.level - 1) + " -> " + to_string(game.player.level);
+    string welcome = "please kill " + to_string(game.player.level * 10 / 2) +
+                     " mobs to get the key to progress to the next level.";
+    open_menu(p, title, welcome, "Press ENTER to Continue");
+}
+
+void enter_game_over(const Para &p, Game &game)
+{
+    finish_recording();
+    open_menu(p, "Tile-Based RPG", "Congratulations you completed the game. You can now play again or finish (escape)",
+              "Press ENTER to restart");
+}
+
+void enter_editor(const Para &p, Game &game)
+{
+    LOG_INFO(LOG_EDITOR, "Entered Map Edit Mode, editing %s", game.map);
+    open_in_editor(p, game);
+    editor_commands = editor_command_text();
+}
+
+void update_editor(const Para &p, Game &game)
+{
+    handle_editor_input(p, game);
+    autosave_edits(game);
+}
+
+void render_editor(const Para &p, Game &game)
+{
+    draw_world(p, game);
+    draw_connectivity(p, game);
+    draw_brush(p);
+    display_commands();
+}
+
+// One scene per state, see scene.h
+void register_scenes()
+{
+    scenes.scenes[NOT_STARTED] = {enter_title, update_title, render_title, leave_menu};
+    scenes.scenes[PLAYING] = {nullptr, update_playing, render_playing, nullptr};
+    scenes.scenes[LEVELED] = {enter_leveled, handle_leveled_input, draw_menu, leave_menu};
+    scenes.scenes[GAME_OVER] = {enter_game_over, handle_game_over_input, draw_menu, leave_menu};
+    scenes.scenes[EDITING] = {enter_editor, update_editor, render_editor, nullptr};
+}
+
+// Resolves the timer and starts the sounds, music and levels in the manifest loading in the background
+void load_resources(const Para &p)
+{
+    res.sim_clock = resource_timer(registry, SIM_CLOCK_TIMER);
+    asset_loader_start(asset_loader, ASSET_MANIFEST, &level_cache);
+}
+
+// Resolves the audio handles once their asset group has loaded
+void update_resources(const Para &p)
+{
+    static bool title_resolved = false;
+    static bool game_resolved = false;
+    asset_loader_update(asset_loader);
+    if (!title_resolved && asset_loader_ready(asset_loader, ASSET_GROUP_TITLE))
+    {
+        res.background = resource_music(registry, BACKGROUND_MUSIC);
+        title_resolved = true;
+    }
+    if (!game_resolved && asset_loader_ready(asset_loader, ASSET_GROUP_GAME))
+    {
+        res.footstep_first = resource_sound(registry, p.FOOTSTEP_FIRST);
+        res.footstep_second = resource_sound(registry, p.FOOTSTEP_SECOND);
+        res.water = resource_sound(registry, p.WATER_SOUND_EFFECT); // no file ships for it yet
+        game_resolved = true;
+    }
+}
+
+int main(int argc, char *argv[])
 {
     Game game;
     Para p;
+    log_start();
     load_constants_from_json(p, "consts.json");
+    load_tile_types_from_json(tile_types(), "tile_types.json");
+    // program --replay recordings/session_....rec plays a recorded run instead of taking input
+    if (argc == 3 && string(argv[1]) == "--replay")
+    {
+        if (!load_recording(argv[2], replay_recording))
+        {
+            log_stop();
+            return 1;
+        }
+        replaying = true;
+    }
     open_window("Tile-Based RPG", p.SCREEN_WIDTH, p.SCREEN_HEIGHT);
     game.state = NOT_STARTED;
-    create_timer(p.MOB_MOVE_TIMER);
-    start_timer(p.MOB_MOVE_TIMER);
-    load_music("background_music", "./SoundEffects/cinematic-time-lapse.mp3");
-    load_sound_effect(p.FOOTSTEP_FIRST, "./SoundEffects/footstep1.ogg");
-    load_sound_effect(p.FOOTSTEP_SECOND, "./SoundEffects/footstep2.ogg");
+    rng_seed(game.rng, (uint64_t)time(nullptr));
+    level_cache_start(level_cache, 4);
+    level_saver_start(level_saver);
+    load_resources(p);
+    resource_start_timer(registry, res.sim_clock);
+    thread_pool_start(mob_pool, thread_pool_default_workers());
+    game.pool = &mob_pool;
+    chunk_streamer_start(chunk_streamer);
+    game.streamer = &chunk_streamer;
+    register_scenes();
+    if (replaying)
+    {
+        start_replay(p, game);
+    }
     do
     {
-        if (game.state == NOT_STARTED)
+        process_events();
+        handle_profiler_keys();
+        update_resources(p);
+        if (replaying)
         {
-            process_events();
-            setup(p, game);
-            refresh_screen(60);
-        }
-        else if (game.state == PLAYING)
-        {
-
-            process_events();
-            clear_screen(COLOR_WHITE);
-
-            if (game.state == PLAYING)
+            run_replay_frame(p, game);
+            if (key_typed(ESCAPE_KEY))
             {
-                handle_input(p, game);
-                draw_world(p, game);
-                draw_mobs(p, game);
-                draw_player(p, game);
-                draw_stats(p, game);
-                update_game_state(game);
-                // Increment the tick counter
-                game.tick_counter++;
-                // Spawn new mobs every TICK_SPEED ticks
-                if (game.tick_counter >= p.TICK_SPEED)
-                {
-                    spawn_mobs(p, game);
-                    game.tick_counter = 0; // Reset the tick counter
-                }
-                // Move mobs
-                move_mobs(p, game);
+                break;
             }
-            refresh_screen(60);
         }
-        else if (game.state == LEVELED)
-        {
-            process_events();
-            leveled(p, game);
-        }
-        else if (game.state == GAME_OVER)
-        {
-            process_events();
-            string title = "Tile-Based RPG";
-            string welcome = "Congratulations you completed the game. You can now play again or finish (escape)";
-            string pressEnter = "Press ENTER to restart";
-
-    draw_screen(p, game, title, welcome, pressEnter);
-        }
-        else if (game.state == EDITING) {
-            process_events();
-            
-            handle_input(p, game);
-            draw_world(p,game);
-            display_commands();
-        }
-        else 
+        else
         {
-            game.state = GAME_OVER;
+            scene_frame(scenes, p, game);
         }
-        refresh_screen(60);
+        present_frame(p);
+        profiler_frame_end();
     } while (!window_close_requested("Tile-Based RPG"));
 
+    scene_leave(scenes, p, game);
+    finish_recording();
+    if (profiler_enabled())
+    {
+        write_profiler_trace();
+    }
+    chunk_streamer_stop(chunk_streamer);
+    thread_pool_stop(mob_pool);
+    asset_loader_stop(asset_loader);
+    level_saver_stop(level_saver);
+    level_cache_stop(level_cache);
+    resource_log_accesses(registry);
+    log_stop();
     return 0;
 }
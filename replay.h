@@ -0,0 +1,405 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "level_gen.h"
+#include "level_io.h"
+#include "sim.h"
+
+/*
+Session recordings. The simulation only changes through sim_tick, level
+starts and its own Rng, so a run is fully described by the seed it
+started from, the command fed to each tick and the ticks levels started
+on. Replaying those through the same code gives the same run, in the
+window or headless as fast as the CPU allows.
+
+Recording file (.rec, little endian):
+
+  RecordingHeader (32 bytes)
+  event_count events, each a varint tick delta from the previous event
+  followed by one byte, type << 4 | value
+
+Ticks with no command are not stored, so an idle minute costs nothing.
+*/
+
+const char RECORDING_MAGIC[4] = {'D', 'R', 'E', 'C'};
+const uint16_t RECORDING_VERSION = 1;
+const std::string RECORDING_DIR = "recordings/";
+const uint32_t REPLAY_SNAPSHOT_INTERVAL = 600; // ticks between seek snapshots, 10 s of play
+const size_t REPLAY_MAX_SNAPSHOTS = 64;        // past this the interval doubles and every other one goes
+
+enum ReplayEventType : uint8_t
+{
+    REPLAY_COMMAND,    // value: InputCommand for this tick
+    REPLAY_START_LEVEL // the level named by game.map starts before this tick
+};
+
+struct ReplayEvent
+{
+    uint32_t tick;
+    uint8_t type;
+    uint8_t value;
+};
+
+#pragma pack(push, 1)
+struct RecordingHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t header_size;
+    uint64_t seed;
+    uint32_t para_hash; // parameters the simulation reads, see recording_para_hash
+    uint32_t ticks;     // ticks simulated over the whole run
+    uint32_t event_count;
+    uint32_t reserved;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(RecordingHeader) == 32, "RecordingHeader must stay 32 bytes");
+
+struct Recording
+{
+    uint64_t seed = 0;
+    uint32_t para_hash = 0;
+    uint32_t ticks = 0;
+    std::vector<ReplayEvent> events;
+    bool active = false; // a run is being recorded
+};
+
+// A replay position that seeking can jump back to
+struct ReplaySnapshot
+{
+    uint32_t tick;
+    size_t next_event;
+    Game game;
+};
+
+struct Replay
+{
+    const Recording *recording = nullptr;
+    uint32_t tick = 0; // ticks replayed so far
+    size_t next_event = 0;
+    bool finished = false;
+    bool diverged = false;      // the run stopped before the recording did
+    bool level_changed = false; // game.world was replaced, set until the caller clears it
+    uint32_t snapshot_interval = REPLAY_SNAPSHOT_INTERVAL;
+    std::vector<ReplaySnapshot> snapshots;
+};
+
+// FNV-1a over the parameters sim.h reads, the tile type fields it reads and
+// its rules version, so a replay against different consts.json,
+// tile_types.json or older simulation code is caught
+inline uint32_t recording_para_hash(const Para &p)
+{
+    uint32_t hash = 2166136261u;
+    auto add = [&hash](int value) {
+        for (int i = 0; i < 4; ++i)
+        {
+            hash = (hash ^ ((uint32_t)value >> (i * 8) & 0xFF)) * 16777619u;
+        }
+    };
+    const int values[] = {SIM_RULES_VERSION, p.NUM_TILES_X, p.NUM_TILES_Y, p.MAX_MOBS, p.TICK_SPEED, p.MAX_AIR, p.MAX_HEALTH,
+                          p.AIR_GAIN_RATE, p.AIR_LOSS_RATE, p.MOB_MOVE_INTERVAL, p.BASE_MOBS_KILLED};
+    for (int value : values)
+    {
+        add(value);
+    }
+    const TileTypeRegistry &types = tile_types();
+    for (uint8_t id : types.defined)
+    {
+        const TileTypeInfo &info = types.info[id];
+        add(id);
+        add(info.traversable);
+        add(info.requires_key);
+        add(info.effects);
+        add(info.damage);
+        add(info.path_cost);
+    }
+    return hash;
+}
+
+// Starts recording a run. Call before sim_new_run, with game.rng seeded from seed.
+inline void recording_begin(Recording &recording, uint64_t seed, const Para &p)
+{
+    recording.seed = seed;
+    recording.para_hash = recording_para_hash(p);
+    recording.ticks = 0;
+    recording.events.clear();
+    recording.active = true;
+}
+
+// Records an event before the next tick runs
+inline void recording_add(Recording &recording, ReplayEventType type, int value = 0)
+{
+    if (recording.active)
+    {
+        recording.events.push_back({recording.ticks, (uint8_t)type, (uint8_t)value});
+    }
+}
+
+inline void recording_tick(Recording &recording)
+{
+    if (recording.active)
+    {
+        recording.ticks++;
+    }
+}
+
+inline bool save_recording(const std::string &path, const Recording &recording)
+{
+    std::vector<uint8_t> bytes;
+    bytes.reserve(recording.events.size() * 2);
+    uint32_t last_tick = 0;
+    for (const ReplayEvent &event : recording.events)
+    {
+        uint32_t delta = event.tick - last_tick;
+        last_tick = event.tick;
+        while (delta >= 0x80)
+        {
+            bytes.push_back((uint8_t)(delta | 0x80));
+            delta >>= 7;
+        }
+        bytes.push_back((uint8_t)delta);
+        bytes.push_back((uint8_t)(event.type << 4 | (event.value & 0x0F)));
+    }
+
+    RecordingHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+    header.version = RECORDING_VERSION;
+    header.header_size = sizeof(RecordingHeader);
+    header.seed = recording.seed;
+    header.para_hash = recording.para_hash;
+    header.ticks = recording.ticks;
+    header.event_count = (uint32_t)recording.events.size();
+
+    size_t slash = path.find_last_of('/');
+    if (slash != std::string::npos)
+    {
+        mkdir(path.substr(0, slash).c_str(), 0755);
+    }
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        LOG_ERROR(LOG_REPLAY, "Could not open %s for writing", path);
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    ok = (fclose(file) == 0) && ok;
+    if (!ok)
+    {
+        LOG_ERROR(LOG_REPLAY, "Failed writing recording %s", path);
+    }
+    return ok;
+}
+
+inline bool load_recording(const std::string &path, Recording &recording)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        LOG_ERROR(LOG_REPLAY, "Could not open recording %s", path);
+        return false;
+    }
+    std::vector<uint8_t> bytes;
+    uint8_t buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        bytes.insert(bytes.end(), buffer, buffer + read);
+    }
+    fclose(file);
+
+    RecordingHeader header;
+    if (bytes.size() < sizeof(header))
+    {
+        LOG_ERROR(LOG_REPLAY, "Recording %s is too small", path);
+        return false;
+    }
+    memcpy(&header, bytes.data(), sizeof(header));
+    if (memcmp(header.magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) != 0 || header.version > RECORDING_VERSION ||
+        header.header_size < sizeof(RecordingHeader) || header.header_size > bytes.size())
+    {
+        LOG_ERROR(LOG_REPLAY, "Recording %s has a bad header", path);
+        return false;
+    }
+
+    recording = Recording();
+    recording.seed = header.seed;
+    recording.para_hash = header.para_hash;
+    recording.ticks = header.ticks;
+    recording.events.reserve(header.event_count);
+    size_t at = header.header_size;
+    uint32_t tick = 0;
+    for (uint32_t i = 0; i < header.event_count; ++i)
+    {
+        uint32_t delta = 0;
+        bool more = true;
+        for (int shift = 0; more && shift < 32 && at < bytes.size(); shift += 7)
+        {
+            uint8_t byte = bytes[at++];
+            delta |= (uint32_t)(byte & 0x7F) << shift;
+            more = byte & 0x80;
+        }
+        if (more && at < bytes.size())
+        {
+            LOG_ERROR(LOG_REPLAY, "Recording %s is corrupt, a tick delta runs past 5 bytes", path);
+            return false;
+        }
+        if (at >= bytes.size())
+        {
+            LOG_ERROR(LOG_REPLAY, "Recording %s is truncated", path);
+            return false;
+        }
+        tick += delta;
+        recording.events.push_back({tick, (uint8_t)(bytes[at] >> 4), (uint8_t)(bytes[at] & 0x0F)});
+        at++;
+    }
+    return true;
+}
+
+// Starts a replay from the beginning. game keeps its pool and streamer.
+inline void replay_start(Replay &replay, const Recording &recording, const Para &p, Game &game)
+{
+    if (recording.para_hash != recording_para_hash(p))
+    {
+        LOG_WARN(LOG_REPLAY, "Recording was made with different constants, the replay may not match");
+    }
+    replay.recording = &recording;
+    replay.tick = 0;
+    replay.next_event = 0;
+    replay.finished = false;
+    replay.diverged = false;
+    replay.snapshot_interval = REPLAY_SNAPSHOT_INTERVAL;
+    replay.snapshots.clear();
+    rng_seed(game.rng, recording.seed);
+    sim_new_run(p, game);
+    game.state = NOT_STARTED;
+}
+
+inline void replay_snapshot(Replay &replay, const Game &game)
+{
+    if (replay.snapshots.size() == REPLAY_MAX_SNAPSHOTS)
+    {
+        // Keep every other one so memory stays bounded on long recordings
+        size_t kept = 0;
+        for (size_t i = 0; i < replay.snapshots.size(); i += 2)
+        {
+            std::swap(replay.snapshots[kept++], replay.snapshots[i]);
+        }
+        replay.snapshots.resize(kept);
+        replay.snapshot_interval *= 2;
+    }
+    replay.snapshots.push_back({replay.tick, replay.next_event, game});
+}
+
+// Replays one tick, starting levels as recorded. Returns false once the recording is done.
+inline bool replay_step(Replay &replay, const Para &p, Game &game)
+{
+    if (replay.finished)
+    {
+        return false;
+    }
+    const Recording &recording = *replay.recording;
+    if (replay.tick % replay.snapshot_interval == 0 && (replay.snapshots.empty() || replay.snapshots.back().tick < replay.tick))
+    {
+        replay_snapshot(replay, game);
+    }
+
+    InputCommand command = CMD_NONE;
+    while (replay.next_event < recording.events.size() && recording.events[replay.next_event].tick == replay.tick)
+    {
+        const ReplayEvent &event = recording.events[replay.next_event++];
+        if (event.type == REPLAY_START_LEVEL)
+        {
+            World world;
+            if (!load_level(game.map, world) && !level_gen_fallback(p, game, world))
+            {
+                LOG_ERROR(LOG_REPLAY, "Replay could not load level %s", game.map);
+                replay.finished = replay.diverged = true;
+                return false;
+            }
+            std::swap(game.world, world);
+            sim_start_level(p, game);
+            replay.level_changed = true;
+        }
+        else if (event.type == REPLAY_COMMAND)
+        {
+            command = (InputCommand)event.value;
+        }
+    }
+
+    if (replay.tick >= recording.ticks)
+    {
+        replay.finished = true;
+        return false;
+    }
+    if (game.state != PLAYING)
+    {
+        LOG_WARN(LOG_REPLAY, "Replay diverged at tick %u, the run ended before the recording did", replay.tick);
+        replay.finished = replay.diverged = true;
+        return false;
+    }
+
+    sim_tick(p, game, command);
+    replay.tick++;
+    return true;
+}
+
+// Moves the replay to target, jumping back to the nearest snapshot when that is quicker
+inline void replay_seek(Replay &replay, const Para &p, Game &game, uint32_t target)
+{
+    const ReplaySnapshot *best = nullptr;
+    for (const ReplaySnapshot &snapshot : replay.snapshots)
+    {
+        if (snapshot.tick <= target && (target < replay.tick || snapshot.tick > replay.tick))
+        {
+            best = &snapshot;
+        }
+    }
+    if (best)
+    {
+        ThreadPool *pool = game.pool;
+        ChunkStreamer *streamer = game.streamer;
+        game = best->game;
+        game.pool = pool;
+        game.streamer = streamer;
+        replay.tick = best->tick;
+        replay.next_event = best->next_event;
+        replay.finished = replay.diverged = false;
+        replay.level_changed = true;
+    }
+    else if (target < replay.tick)
+    {
+        replay_start(replay, *replay.recording, p, game);
+    }
+
+    while (replay.tick < target && replay_step(replay, p, game))
+    {
+        game.events.clear();
+    }
+}
+
+// FNV-1a over the player and mobs, to check that two runs ended the same
+inline uint64_t replay_state_hash(const Game &game)
+{
+    uint64_t hash = 1469598103934665603ull;
+    auto mix = [&hash](int64_t value) { hash = (hash ^ (uint64_t)value) * 1099511628211ull; };
+    mix(game.player.x);
+    mix(game.player.y);
+    mix(game.player.health);
+    mix(game.player.air);
+    mix(game.player.mobs_killed);
+    mix(game.player.level);
+    mix(game.state);
+    mix(game.mobs.count);
+    for (int i = 0; i < game.mobs.count; ++i)
+    {
+        mix(game.mobs.x[i]);
+        mix(game.mobs.y[i]);
+    }
+    return hash;
+}
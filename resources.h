@@ -0,0 +1,173 @@
+#pragma once
+
+#include "splashkit.h"
+#include <algorithm>
+#include <numeric>
+#include "log.h"
+
+/*
+Resource registry. SplashKit finds timers, sounds and music by name on
+every call; the registry resolves each name once, at startup, to a typed
+handle (an index into the registry), and frame code goes through the
+handle to the SplashKit object directly. Handles of different kinds do
+not convert into each other, and every access is counted so the hot
+resources show up in the log at exit.
+
+Handles hold -1 when the resource could not be resolved; using one does
+nothing.
+*/
+
+struct TimerHandle
+{
+    int index = -1;
+};
+
+struct SoundHandle
+{
+    int index = -1;
+};
+
+struct MusicHandle
+{
+    int index = -1;
+};
+
+template <typename T>
+struct ResourceTable
+{
+    vector<T> items;
+    vector<string> names;
+    vector<uint64_t> accesses;
+};
+
+struct ResourceRegistry
+{
+    ResourceTable<timer> timers;
+    ResourceTable<sound_effect> sounds;
+    ResourceTable<music> tracks;
+};
+
+template <typename T>
+inline int resource_add(ResourceTable<T> &table, const string &name, T item)
+{
+    for (size_t i = 0; i < table.names.size(); ++i)
+    {
+        if (table.names[i] == name)
+        {
+            return (int)i;
+        }
+    }
+    table.items.push_back(item);
+    table.names.push_back(name);
+    table.accesses.push_back(0);
+    return (int)table.items.size() - 1;
+}
+
+// Creates the timer if SplashKit does not have one by that name yet
+inline TimerHandle resource_timer(ResourceRegistry &registry, const string &name)
+{
+    TimerHandle handle;
+    handle.index = resource_add(registry.timers, name, has_timer(name) ? timer_named(name) : create_timer(name));
+    return handle;
+}
+
+// Loads the sound unless it is already loaded. With no path, an unknown name gives an empty handle.
+inline SoundHandle resource_sound(ResourceRegistry &registry, const string &name, const string &path = "")
+{
+    SoundHandle handle;
+    if (has_sound_effect(name))
+    {
+        handle.index = resource_add(registry.sounds, name, sound_effect_named(name));
+    }
+    else if (!path.empty())
+    {
+        handle.index = resource_add(registry.sounds, name, load_sound_effect(name, path));
+    }
+    else
+    {
+        LOG_WARN(LOG_AUDIO, "No sound effect named %s", name);
+    }
+    return handle;
+}
+
+inline MusicHandle resource_music(ResourceRegistry &registry, const string &name, const string &path = "")
+{
+    MusicHandle handle;
+    if (has_music(name))
+    {
+        handle.index = resource_add(registry.tracks, name, music_named(name));
+    }
+    else if (!path.empty())
+    {
+        handle.index = resource_add(registry.tracks, name, load_music(name, path));
+    }
+    else
+    {
+        LOG_WARN(LOG_AUDIO, "No music named %s", name);
+    }
+    return handle;
+}
+
+template <typename T>
+inline T resource_use(ResourceTable<T> &table, int index)
+{
+    table.accesses[index]++;
+    return table.items[index];
+}
+
+inline unsigned int resource_timer_ticks(ResourceRegistry &registry, TimerHandle handle)
+{
+    return handle.index < 0 ? 0 : timer_ticks(resource_use(registry.timers, handle.index));
+}
+
+inline void resource_start_timer(ResourceRegistry &registry, TimerHandle handle)
+{
+    if (handle.index >= 0)
+    {
+        start_timer(resource_use(registry.timers, handle.index));
+    }
+}
+
+inline void resource_reset_timer(ResourceRegistry &registry, TimerHandle handle)
+{
+    if (handle.index >= 0)
+    {
+        reset_timer(resource_use(registry.timers, handle.index));
+    }
+}
+
+inline void resource_play_sound(ResourceRegistry &registry, SoundHandle handle)
+{
+    if (handle.index >= 0)
+    {
+        play_sound_effect(resource_use(registry.sounds, handle.index));
+    }
+}
+
+inline void resource_play_music(ResourceRegistry &registry, MusicHandle handle)
+{
+    if (handle.index >= 0)
+    {
+        play_music(resource_use(registry.tracks, handle.index));
+    }
+}
+
+template <typename T>
+inline void resource_log_table(const ResourceTable<T> &table, const char *kind)
+{
+    vector<size_t> order(table.names.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&table](size_t a, size_t b) { return table.accesses[a] > table.accesses[b]; });
+    for (size_t i : order)
+    {
+        LOG_INFO(LOG_GAME, "%s %s used %llu times", kind, table.names[i], table.accesses[i]);
+    }
+}
+
+// Logs how often each resource was used, busiest first within each kind
+inline void resource_log_accesses(const ResourceRegistry &registry)
+{
+    resource_log_table(registry.timers, "timer");
+    resource_log_table(registry.sounds, "sound");
+    resource_log_table(registry.tracks, "music");
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "game.h"
+
+/*
+Front-end scenes, one per GameState. When game.state changes, the scene
+being left runs its exit hook and the new one its enter hook, once. Enter
+does the work that used to be repeated every frame: resetting the run,
+wrapping and laying out the screen's text, making the bitmaps it draws
+from. Exit frees them. Each frame, update reads input and advances the
+scene, and render draws it. Any hook may be null.
+
+The hooks take Para and Game like the rest of the front end; what they
+draw with stays in program.cpp. The text layout below does not touch
+SplashKit either, so it is computed once and only drawn each frame.
+*/
+
+const int SCENE_COUNT = EDITING + 1; // one scene per GameState
+
+typedef void (*SceneHook)(const Para &p, Game &game);
+
+struct Scene
+{
+    SceneHook enter = nullptr;
+    SceneHook update = nullptr;
+    SceneHook render = nullptr;
+    SceneHook exit = nullptr;
+};
+
+struct SceneMachine
+{
+    Scene scenes[SCENE_COUNT];
+    int current = -1; // state whose scene was entered last, -1 before the first frame
+};
+
+// Leaves the current scene and enters the one for game.state, if they differ.
+// An enter hook can move straight on to another state.
+inline void scene_switch(SceneMachine &machine, const Para &p, Game &game)
+{
+    while (machine.current != game.state)
+    {
+        if (machine.current >= 0 && machine.scenes[machine.current].exit)
+        {
+            machine.scenes[machine.current].exit(p, game);
+        }
+        machine.current = game.state;
+        if (machine.scenes[machine.current].enter)
+        {
+            machine.scenes[machine.current].enter(p, game);
+        }
+    }
+}
+
+// One frame: update the scene, then render whichever scene the update left the game in
+inline void scene_frame(SceneMachine &machine, const Para &p, Game &game)
+{
+    scene_switch(machine, p, game);
+    if (machine.scenes[machine.current].update)
+    {
+        machine.scenes[machine.current].update(p, game);
+    }
+    scene_switch(machine, p, game);
+    if (machine.scenes[machine.current].render)
+    {
+        machine.scenes[machine.current].render(p, game);
+    }
+}
+
+// Runs the current scene's exit hook, at shutdown
+inline void scene_leave(SceneMachine &machine, const Para &p, Game &game)
+{
+    if (machine.current >= 0 && machine.scenes[machine.current].exit)
+    {
+        machine.scenes[machine.current].exit(p, game);
+    }
+    machine.current = -1;
+}
+
+const int TEXT_CHAR_WIDTH = 10;  // approximate width of a character in pixels
+const int TEXT_LINE_HEIGHT = 20; // height of a line of text in pixels
+const int TEXT_PADDING = 40;     // kept clear across the screen width
+
+struct TextLine
+{
+    std::string text;
+    int x = 0;
+    int y = 0;
+};
+
+// Breaks text into lines of at most max_chars, at the last space that fits
+inline std::vector<std::string> text_wrap(const std::string &text, int max_chars)
+{
+    std::vector<std::string> lines;
+    size_t start = 0;
+    while (start < text.length())
+    {
+        size_t end = start + max_chars;
+        if (end >= text.length())
+        {
+            lines.push_back(text.substr(start));
+            break;
+        }
+        size_t last_space = text.rfind(' ', end);
+        if (last_space == std::string::npos || last_space <= start)
+        {
+            lines.push_back(text.substr(start, end - start));
+            start = end;
+        }
+        else
+        {
+            lines.push_back(text.substr(start, last_space - start));
+            start = last_space + 1;
+        }
+    }
+    return lines;
+}
+
+// A menu screen: the title, the body wrapped to the screen and the prompt
+// below it, each line centred and the block centred vertically
+inline std::vector<TextLine> text_screen_layout(int screen_width, int screen_height, const std::string &title,
+                                                const std::string &body, const std::string &prompt)
+{
+    std::vector<std::string> texts = text_wrap(body, (screen_width - TEXT_PADDING) / TEXT_CHAR_WIDTH);
+    texts.insert(texts.begin(), title);
+    texts.push_back(prompt);
+
+    std::vector<TextLine> lines(texts.size());
+    int top = screen_height / 2 - (int)(texts.size() - 1) * TEXT_LINE_HEIGHT / 2 - TEXT_LINE_HEIGHT / 2;
+    for (size_t i = 0; i < texts.size(); ++i)
+    {
+        lines[i].text = texts[i];
+        lines[i].x = (screen_width - (int)texts[i].length() * TEXT_CHAR_WIDTH) / 2;
+        lines[i].y = top + (int)i * TEXT_LINE_HEIGHT;
+    }
+    return lines;
+}
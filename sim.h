@@ -0,0 +1,731 @@
+#pragma once
+
+#include "game.h"
+#include "profiler.h"
+#include "tile_types.h"
+#include <algorithm>
+#include <cstdlib>
+
+/*
+Headless simulation core. Advances a Game one fixed timestep at a time from
+an input command, with no SplashKit calls: randomness comes from game.rng,
+time is counted in ticks, and sounds or messages are reported as
+game.events for whoever is driving the simulation. Mob movement can be
+spread over game.pool without changing the result.
+*/
+
+const int SIM_TICKS_PER_SECOND = 60;
+const int SIM_RULES_VERSION = 2; // bump when a change makes old recordings play out differently
+const int LAST_LEVEL = 3;
+const int MOB_BATCH = 32; // mobs moved per random draw, 2 bits each
+const int STREAM_LOAD_RADIUS = 3; // chunks loaded around the player in a streamed world
+const int STREAM_KEEP_RADIUS = 5; // chunks further than this are unloaded
+
+enum InputCommand : uint8_t
+{
+    CMD_NONE,
+    CMD_MOVE_UP,
+    CMD_MOVE_DOWN,
+    CMD_MOVE_LEFT,
+    CMD_MOVE_RIGHT
+};
+
+inline void sim_new_run(const Para &p, Game &game);
+inline void sim_start_level(const Para &p, Game &game);
+inline void sim_tick(const Para &p, Game &game, InputCommand command);
+inline void open_doors(Game &game);
+inline bool is_traversable(const Game &game, int x, int y);
+inline void move_player(const Para &p, Game &game, int dx, int dy);
+inline bool move_player_step(const Para &p, Game &game, int dx, int dy);
+inline void update_game_state(Game &game);
+inline int spawn_mobs(const Para &p, Game &game);
+inline void move_mobs(const Para &p, Game &game);
+inline bool is_mob_at(int x, int y, const Game &game);
+inline int mob_index_at(int x, int y, const Game &game);
+inline void reset_occupancy(Game &game);
+inline void sim_world_changed(Game &game);
+inline void sim_set_tile(Game &game, int x, int y, TileType type, bool traversable);
+inline void place_mob(Game &game, int i, int x, int y);
+inline void move_mob_to(Game &game, int i, int x, int y);
+inline void remove_mob(Game &game, int i);
+inline void leveling(const Para &p, Game &game);
+inline void sim_stream(Game &game);
+
+inline void sim_emit(Game &game, SimEventType type, int value = 0)
+{
+    game.events.push_back({type, value});
+}
+
+// Resets the player and counters for a fresh run starting on level 1
+inline void sim_new_run(const Para &p, Game &game)
+{
+    // Random spawn tile for the player
+    game.player.x = rng_range(game.rng, p.NUM_TILES_X);
+    game.player.y = rng_range(game.rng, p.NUM_TILES_Y);
+    game.player.health = p.MAX_HEALTH;
+    game.player.has_key = false;
+    game.player.air = p.MAX_AIR;
+    game.player.mobs_killed = p.BASE_MOBS_KILLED;
+    game.player.level = 1;
+    game.player.footstepValue = 0;
+    game.tick_counter = 0; // Initialize tick counter
+    game.mob_move_ticks = 0;
+    game.map = "level_" + std::to_string(game.player.level) + ".json";
+    archetype_init(game.mobs, MOB_COMPONENTS, p.MAX_MOBS);
+}
+
+// Called once game.world holds the level named by game.map
+inline void sim_start_level(const Para &p, Game &game)
+{
+    archetype_clear(game.mobs);
+    // Levels can be smaller than the screen the spawn tile was picked from
+    game.player.x = std::min(game.player.x, game.world.width - 1);
+    game.player.y = std::min(game.player.y, game.world.height - 1);
+    sim_world_changed(game);
+    spawn_mobs(p, game);
+    game.state = PLAYING;
+}
+
+// Advances one fixed timestep of play
+inline void sim_tick(const Para &p, Game &game, InputCommand command)
+{
+    PROFILE_ZONE("sim_tick");
+    if (game.state != PLAYING)
+    {
+        return;
+    }
+
+    switch (command)
+    {
+    case CMD_MOVE_UP:
+        move_player(p, game, 0, -1);
+        break;
+    case CMD_MOVE_DOWN:
+        move_player(p, game, 0, 1);
+        break;
+    case CMD_MOVE_LEFT:
+        move_player(p, game, -1, 0);
+        break;
+    case CMD_MOVE_RIGHT:
+        move_player(p, game, 1, 0);
+        break;
+    case CMD_NONE:
+        break;
+    }
+    if (game.state != PLAYING)
+    {
+        return; // stepped through the door
+    }
+    sim_stream(game);
+
+    update_game_state(game);
+
+    // Spawn new mobs every TICK_SPEED ticks
+    game.tick_counter++;
+    if (game.tick_counter >= p.TICK_SPEED)
+    {
+        spawn_mobs(p, game);
+        game.tick_counter = 0; // Reset the tick counter
+    }
+
+    move_mobs(p, game);
+}
+
+// Tiles that need the key become traversable once the player holds it
+inline void open_doors(Game &game)
+{
+    const TileTypeRegistry &types = tile_types();
+    world_for_each_tile(game.world, [&game, &types](int x, int y, size_t index) {
+        TileType type = (TileType)game.world.tiles[index];
+        if (types.info[type].requires_key)
+        {
+            sim_set_tile(game, x, y, type, true);
+        }
+    });
+}
+
+inline bool is_traversable(const Game &game, int x, int y)
+{
+    return world_traversable(game.world, x, y);
+}
+
+inline void leveling(const Para &p, Game &game)
+{
+    // Increment player's level and move on to the next map
+    game.player.level++;
+    game.player.has_key = false; // clearing the players key so they have to get it in the next level.
+    game.player.mobs_killed = p.BASE_MOBS_KILLED;
+    game.player.health = p.MAX_HEALTH;
+    game.player.air = p.MAX_AIR;
+    game.map = "level_" + std::to_string(game.player.level) + ".json";
+
+    if (game.player.level <= LAST_LEVEL)
+    {
+        game.state = LEVELED;
+        sim_emit(game, EVENT_LEVELED, game.player.level);
+    }
+    else
+    {
+        game.state = GAME_OVER;
+        sim_emit(game, EVENT_GAME_WON);
+    }
+}
+
+inline void move_player(const Para &p, Game &game, int dx, int dy)
+{
+    while (move_player_step(p, game, dx, dy))
+    {
+    }
+}
+
+// Moves the player one tile and applies what entering it does.
+// Returns true if the tile makes the player slide on another step.
+inline bool move_player_step(const Para &p, Game &game, int dx, int dy)
+{
+    int new_x = game.player.x + dx;
+    int new_y = game.player.y + dy;
+
+    if (!is_traversable(game, new_x, new_y))
+    {
+        return false;
+    }
+    game.player.x = new_x;
+    game.player.y = new_y;
+    const TileTypeInfo &tile = tile_type_info(world_tile(game.world, new_x, new_y));
+    if (tile.requires_key && !game.player.has_key)
+    {
+        // Player needs key to open the door
+        // Prevent player from moving through the door without the key
+        game.player.x -= dx;
+        game.player.y -= dy;
+    }
+    else
+    {
+        if (tile.effects & TILE_EFFECT_DROWN)
+        {
+            if (game.player.air < 0)
+            {
+                game.player.health -= game.player.level * 2;
+            }
+            else
+            {
+                game.player.air -= p.AIR_LOSS_RATE;
+            }
+        }
+        if (tile.effects & TILE_EFFECT_FOOTSTEP)
+        {
+            // Footstep sound alternates between the two effects
+            sim_emit(game, EVENT_FOOTSTEP, game.player.footstepValue);
+            game.player.footstepValue = game.player.footstepValue == 0 ? 1 : 0;
+        }
+        if (tile.effects & TILE_EFFECT_BREATHE)
+        {
+            if (game.player.air < p.MAX_AIR)
+            {
+                game.player.air += p.AIR_GAIN_RATE;
+            }
+            else
+            {
+                sim_emit(game, EVENT_AIR_FULL, game.player.air);
+            }
+        }
+        if (tile.effects & TILE_EFFECT_HEAL)
+        {
+            if (game.player.health < p.MAX_HEALTH)
+            {
+                game.player.health++;
+            }
+            else
+            {
+                sim_emit(game, EVENT_HEALTH_FULL);
+            }
+        }
+        game.player.health -= tile.damage;
+        if (tile.effects & TILE_EFFECT_EXIT)
+        {
+            leveling(p, game);
+        }
+    }
+    // Check for mob collision
+    int i = mob_index_at(game.player.x, game.player.y, game);
+    if (i >= 0)
+    {
+        // Decrease player's health when colliding with a mob
+        game.player.health -= game.mobs.damage[i];
+        game.player.mobs_killed++;
+        if (game.player.mobs_killed == game.player.level * 10 / 2) // for level 1 mobs to kill is 5, for leve 2 mobs to kill is 10
+        {
+            game.player.has_key = true;
+            open_doors(game);
+            sim_emit(game, EVENT_KEY_EARNED);
+        }
+        // Remove the mob from the game
+        remove_mob(game, i);
+        return false;
+    }
+    // Sliding stops at a door that stayed shut, at the exit and when the player dies
+    return (tile.effects & TILE_EFFECT_SLIDE) && game.state == PLAYING && game.player.health > 0 &&
+           game.player.x == new_x && game.player.y == new_y;
+}
+
+inline void update_game_state(Game &game)
+{
+    PROFILE_ZONE("update_game_state");
+    // Check if player's health drops to zero
+    if (game.player.health <= 0)
+    {
+        game.state = GAME_OVER;
+        sim_emit(game, EVENT_PLAYER_DIED);
+    }
+}
+
+// Spawns mobs on uniformly random free tiles until MAX_MOBS are alive.
+// Returns how many spawned; short of that means the map has no free tiles left.
+inline int spawn_mobs(const Para &p, Game &game)
+{
+    PROFILE_ZONE("spawn_mobs");
+    // Check if the maximum number of mobs has been reached
+    if (game.mobs.count >= p.MAX_MOBS)
+    {
+        return 0;
+    }
+
+    // Calculate number of mobs to spawn
+    int mobs_to_spawn = p.MAX_MOBS - game.mobs.count;
+
+    for (int i = 0; i < mobs_to_spawn; ++i)
+    {
+        if (game.free_tiles.empty())
+        {
+            sim_emit(game, EVENT_SPAWN_BLOCKED, mobs_to_spawn - i);
+            return i;
+        }
+
+        // Any free tile is traversable and empty, so one draw is enough
+        int tile = game.free_tiles[rng_range(game.rng, (int)game.free_tiles.size())];
+
+        // Initialize the mob
+        int mob = archetype_add(game.mobs);
+        game.mobs.health[mob] = 100; // Example health value
+        game.mobs.damage[mob] = 10;  // Example damage value
+        place_mob(game, mob, world_index_x(game.world, tile), world_index_y(game.world, tile));
+    }
+    return mobs_to_spawn;
+}
+
+// game.mob_at mirrors the mob positions so tile lookups are O(1), and
+// game.free_tiles lists every traversable tile without a mob for spawning.
+// Every change to a mob position or to traversability goes through the
+// functions below so both stay in step.
+
+inline void free_tile_add(Game &game, int tile)
+{
+    if (game.free_slot[tile] < 0)
+    {
+        game.free_slot[tile] = game.free_tiles.size();
+        game.free_tiles.push_back(tile);
+    }
+}
+
+inline void free_tile_remove(Game &game, int tile)
+{
+    int slot = game.free_slot[tile];
+    if (slot >= 0)
+    {
+        int last = game.free_tiles.back();
+        game.free_tiles[slot] = last;
+        game.free_slot[last] = slot;
+        game.free_tiles.pop_back();
+        game.free_slot[tile] = -1;
+    }
+}
+
+// Re-adds the tile to the free list if it is traversable and has no mob, removes it otherwise
+inline void free_tile_refresh(Game &game, int x, int y)
+{
+    int tile = world_index(game.world, x, y);
+    if (world_traversable(game.world, x, y) && game.mob_at[tile] < 0)
+    {
+        free_tile_add(game, tile);
+    }
+    else
+    {
+        free_tile_remove(game, tile);
+    }
+}
+
+// Rebuilds both indexes from the world and the live mobs. Mobs left
+// standing outside the loaded part of the world are dropped.
+inline void reset_occupancy(Game &game)
+{
+    for (int i = 0; i < game.mobs.count;)
+    {
+        if (world_resident(game.world, game.mobs.x[i], game.mobs.y[i]))
+        {
+            ++i;
+        }
+        else
+        {
+            archetype_swap_remove(game.mobs, i);
+        }
+    }
+    game.mob_at.assign(game.world.tiles.size(), -1);
+    for (int i = 0; i < game.mobs.count; ++i)
+    {
+        game.mob_at[world_index(game.world, game.mobs.x[i], game.mobs.y[i])] = i;
+    }
+
+    game.regions_x = (game.world.width + MOB_REGION_SIZE - 1) / MOB_REGION_SIZE;
+    game.regions.assign((size_t)game.regions_x * ((game.world.height + MOB_REGION_SIZE - 1) / MOB_REGION_SIZE), MobRegion());
+    game.active_regions.clear();
+
+    game.free_slot.assign(game.world.tiles.size(), -1);
+    game.free_tiles.clear();
+    world_for_each_tile(game.world, [&game](int x, int y, size_t) { free_tile_refresh(game, x, y); });
+}
+
+// Call after a different world is swapped into game.world
+inline void sim_world_changed(Game &game)
+{
+    reset_occupancy(game);
+    game.flow.dirty = true;
+    game.stream_chunk = -1;
+    sim_stream(game);
+}
+
+// Changes a loaded tile and keeps the free tile index in step
+inline void sim_set_tile(Game &game, int x, int y, TileType type, bool traversable)
+{
+    if (!world_resident(game.world, x, y))
+    {
+        return;
+    }
+    world_set_tile(game.world, x, y, type, traversable);
+    game.flow.dirty = true;
+    if (!game.free_slot.empty())
+    {
+        free_tile_refresh(game, x, y);
+    }
+}
+
+inline int mob_index_at(int x, int y, const Game &game)
+{
+    if (!world_resident(game.world, x, y))
+    {
+        return -1;
+    }
+    return game.mob_at[world_index(game.world, x, y)];
+}
+
+inline bool is_mob_at(int x, int y, const Game &game)
+{
+    return mob_index_at(x, y, game) >= 0;
+}
+
+inline void place_mob(Game &game, int i, int x, int y)
+{
+    int tile = world_index(game.world, x, y);
+    game.mobs.x[i] = x;
+    game.mobs.y[i] = y;
+    game.mob_at[tile] = i;
+    free_tile_remove(game, tile);
+}
+
+inline void move_mob_to(Game &game, int i, int x, int y)
+{
+    int old_x = game.mobs.x[i];
+    int old_y = game.mobs.y[i];
+    int from = world_index(game.world, old_x, old_y);
+    int to = world_index(game.world, x, y);
+    int slot = game.free_slot[to];
+    if (slot >= 0 && world_traversable(game.world, old_x, old_y))
+    {
+        // The tile left behind takes over the target's place in the free list
+        game.free_tiles[slot] = from;
+        game.free_slot[from] = slot;
+        game.free_slot[to] = -1;
+        game.mob_at[from] = -1;
+        game.mob_at[to] = i;
+        game.mobs.x[i] = x;
+        game.mobs.y[i] = y;
+        return;
+    }
+    game.mob_at[from] = -1;
+    place_mob(game, i, x, y);
+    free_tile_refresh(game, old_x, old_y);
+}
+
+// Swaps the last mob into slot i instead of shifting the array down
+inline void remove_mob(Game &game, int i)
+{
+    int x = game.mobs.x[i];
+    int y = game.mobs.y[i];
+    game.mob_at[world_index(game.world, x, y)] = -1;
+    free_tile_refresh(game, x, y);
+    if (archetype_swap_remove(game.mobs, i) != i)
+    {
+        game.mob_at[world_index(game.world, game.mobs.x[i], game.mobs.y[i])] = i;
+    }
+}
+
+inline int mob_region_of(const Game &game, int x, int y)
+{
+    return (y / MOB_REGION_SIZE) * game.regions_x + x / MOB_REGION_SIZE;
+}
+
+// Steps the mobs of one region down the flow field toward the player, or in
+// a random direction for mobs the field does not reach. Runs on a pool
+// thread alongside other regions, so it only writes state belonging to
+// tiles inside the region: moves that would leave it are queued in
+// region.deferred instead. Mobs are handled MOB_BATCH at a time, proposals
+// for the whole batch first, then applied in order because each move
+// changes what the next mob may step onto.
+inline void move_region_mobs(Game &game, int r, uint64_t step_seed)
+{
+    PROFILE_ZONE("move_region");
+    MobRegion &region = game.regions[r];
+    const World &world = game.world;
+    int x0 = (r % game.regions_x) * MOB_REGION_SIZE;
+    int y0 = (r / game.regions_x) * MOB_REGION_SIZE;
+
+    // Each region draws from its own stream, so the result does not depend
+    // on which thread runs it or when
+    Rng rng;
+    rng_seed(rng, step_seed + (uint64_t)r);
+
+    int32_t new_x[MOB_BATCH];
+    int32_t new_y[MOB_BATCH];
+    uint8_t passable[MOB_BATCH];
+    uint8_t inside[MOB_BATCH];
+
+    region.deferred.clear();
+    int count = (int)region.mobs.size();
+    for (int base = 0; base < count; base += MOB_BATCH)
+    {
+        int n = std::min(MOB_BATCH, count - base);
+        const int32_t *ids = &region.mobs[base];
+
+        // One draw gives every mob in the batch a 2-bit direction: 0 up, 1 down, 2 left, 3 right.
+        // It is the wandering direction, and where ties start for mobs in the flow field.
+        uint64_t directions = rng_next(rng);
+
+        // Propose a step for each mob and look up whether the target is traversable.
+        // Out-of-bounds targets read tile (0, 0) and are masked off, and a mob
+        // with no closer neighbour proposes its own tile.
+        for (int k = 0; k < n; ++k)
+        {
+            int x = game.mobs.x[ids[k]];
+            int y = game.mobs.y[ids[k]];
+            int dir = flow_field_direction(game.flow, world, x, y, (int)(directions >> (2 * k)) & 3);
+            int tx = x + (dir == 3) - (dir == 2);
+            int ty = y + (dir == 1) - (dir == 0);
+            int in_bounds = ((unsigned)tx < (unsigned)world.width) & ((unsigned)ty < (unsigned)world.height);
+            int cx = tx * in_bounds;
+            int cy = ty * in_bounds;
+            int slot = world.slot_of[world_chunk(world, cx, cy)];
+            int loaded = slot >= 0;
+            uint32_t word = world.walkable[(size_t)(slot * loaded) * CHUNK_SIZE + (cy & CHUNK_MASK)];
+            new_x[k] = tx;
+            new_y[k] = ty;
+            passable[k] = (uint8_t)(in_bounds & loaded & (int)(word >> (cx & CHUNK_MASK)) & 1 & (dir >= 0));
+            inside[k] = (uint8_t)(((unsigned)(tx - x0) < (unsigned)MOB_REGION_SIZE) & ((unsigned)(ty - y0) < (unsigned)MOB_REGION_SIZE));
+        }
+
+        // Applying a move touches mob_at and free_slot at the target, scattered over
+        // the region; start those loads now so the misses overlap
+        for (int k = 0; k < n; ++k)
+        {
+            if (passable[k])
+            {
+                size_t target = world_index(world, new_x[k], new_y[k]);
+                __builtin_prefetch(&game.mob_at[target]);
+                __builtin_prefetch(&game.free_slot[target]);
+            }
+        }
+
+        for (int k = 0; k < n; ++k)
+        {
+            if (!passable[k])
+            {
+                continue;
+            }
+            int i = ids[k];
+            int target = (int)world_index(world, new_x[k], new_y[k]);
+            // move_mob_to only touches the two tiles when the mob leaves a
+            // traversable tile; otherwise it reshuffles the shared free list
+            if (inside[k] && world_traversable(world, game.mobs.x[i], game.mobs.y[i]))
+            {
+                if (game.mob_at[target] < 0)
+                {
+                    move_mob_to(game, i, new_x[k], new_y[k]);
+                }
+            }
+            else
+            {
+                region.deferred.push_back(i);
+                region.deferred.push_back(target);
+            }
+        }
+    }
+}
+
+// Steps every mob one tile toward the player along the flow field, which is
+// rebuilt first if the player moved. Regions run in parallel on
+// game.pool; moves across region borders are applied afterwards in region
+// order. The outcome is the same for any number of threads.
+inline void move_mobs(const Para &p, Game &game)
+{
+    PROFILE_ZONE("move_mobs");
+    // Mobs step once every MOB_MOVE_INTERVAL milliseconds of simulated time
+    game.mob_move_ticks++;
+    if (game.mob_move_ticks * 1000 < p.MOB_MOVE_INTERVAL * SIM_TICKS_PER_SECOND)
+    {
+        return;
+    }
+    game.mob_move_ticks = 0;
+    if (game.mobs.count > 0)
+    {
+        flow_field_update(game.flow, game.world, game.player.x, game.player.y);
+    }
+
+    // Sort the mobs into the regions they stand in, keeping slot order within each
+    for (int r : game.active_regions)
+    {
+        game.regions[r].mobs.clear();
+    }
+    game.active_regions.clear();
+    for (int i = 0; i < game.mobs.count; ++i)
+    {
+        int r = mob_region_of(game, game.mobs.x[i], game.mobs.y[i]);
+        if (game.regions[r].mobs.empty())
+        {
+            game.active_regions.push_back(r);
+        }
+        game.regions[r].mobs.push_back(i);
+    }
+    std::sort(game.active_regions.begin(), game.active_regions.end());
+
+    uint64_t step_seed = rng_next(game.rng);
+    thread_pool_run(game.pool, (int)game.active_regions.size(), [&game, step_seed](int task) {
+        move_region_mobs(game, game.active_regions[task], step_seed);
+    });
+
+    // Border moves: first come first served in region order, so every run agrees
+    for (int r : game.active_regions)
+    {
+        const std::vector<int32_t> &deferred = game.regions[r].deferred;
+        for (size_t j = 0; j < deferred.size(); j += 2)
+        {
+            int target = deferred[j + 1];
+            if (game.mob_at[target] < 0)
+            {
+                move_mob_to(game, deferred[j], world_index_x(game.world, target), world_index_y(game.world, target));
+            }
+        }
+    }
+
+    // Check for mob collision
+    int i = mob_index_at(game.player.x, game.player.y, game);
+    if (i >= 0)
+    {
+        // Decrease player's health when colliding with a mob
+        game.player.health -= game.mobs.damage[i];
+    }
+}
+
+// Streamed worlds keep only the chunks around the player loaded. Which
+// chunks those are depends on nothing but the player's position, so a run
+// replays the same way however fast the disk is; game.streamer just reads
+// ahead so loading rarely waits.
+
+// Drops a chunk, taking the mobs standing in it along
+inline void sim_unload_chunk(Game &game, int slot)
+{
+    size_t first = (size_t)slot * CHUNK_TILES;
+    for (size_t tile = first; tile < first + CHUNK_TILES; ++tile)
+    {
+        if (game.mob_at[tile] >= 0)
+        {
+            remove_mob(game, game.mob_at[tile]);
+        }
+        free_tile_remove(game, tile);
+    }
+    world_evict_slot(game.world, slot);
+    game.flow.dirty = true;
+}
+
+inline void sim_load_chunk(Game &game, int chunk)
+{
+    uint8_t packed[CHUNK_TILES];
+    chunk_streamer_read(game.streamer, game.world.source, chunk, packed);
+    int slot = world_install_chunk(game.world, chunk, packed);
+    game.flow.dirty = true;
+    if (slot < 0)
+    {
+        return; // every slot holds an edited chunk
+    }
+    int x0 = (chunk % game.world.chunks_x) * CHUNK_SIZE;
+    int y0 = (chunk / game.world.chunks_x) * CHUNK_SIZE;
+    for (int y = y0; y < std::min(y0 + CHUNK_SIZE, game.world.height); ++y)
+    {
+        for (int x = x0; x < std::min(x0 + CHUNK_SIZE, game.world.width); ++x)
+        {
+            // Doors opened earlier are open in freshly loaded chunks too
+            if (game.player.has_key && tile_type_info(world_tile(game.world, x, y)).requires_key)
+            {
+                world_set_traversable(game.world, x, y, true);
+            }
+            free_tile_refresh(game, x, y);
+        }
+    }
+}
+
+// Brings the loaded chunks in line with the player's position
+inline void sim_stream(Game &game)
+{
+    PROFILE_ZONE("sim_stream");
+    World &world = game.world;
+    if (!world_streamed(world) || !world_in_bounds(world, game.player.x, game.player.y))
+    {
+        return;
+    }
+    int cx = game.player.x >> CHUNK_SHIFT;
+    int cy = game.player.y >> CHUNK_SHIFT;
+    int centre = cy * world.chunks_x + cx;
+    if (centre == game.stream_chunk)
+    {
+        return;
+    }
+    game.stream_chunk = centre;
+
+    // Unload chunks left well behind, unless they hold edits
+    for (int slot = 0; slot < (int)world.chunk_of.size(); ++slot)
+    {
+        int chunk = world.chunk_of[slot];
+        if (chunk >= 0 && !world.edited[slot] &&
+            std::max(abs(chunk % world.chunks_x - cx), abs(chunk / world.chunks_x - cy)) > STREAM_KEEP_RADIUS)
+        {
+            sim_unload_chunk(game, slot);
+        }
+    }
+
+    // Load everything within reach, and have the ring beyond read in the background
+    for (int y = cy - STREAM_LOAD_RADIUS - 1; y <= cy + STREAM_LOAD_RADIUS + 1; ++y)
+    {
+        for (int x = cx - STREAM_LOAD_RADIUS - 1; x <= cx + STREAM_LOAD_RADIUS + 1; ++x)
+        {
+            if (x < 0 || y < 0 || x >= world.chunks_x || y >= world.chunks_y || world.slot_of[y * world.chunks_x + x] >= 0)
+            {
+                continue;
+            }
+            if (std::max(abs(x - cx), abs(y - cy)) <= STREAM_LOAD_RADIUS)
+            {
+                sim_load_chunk(game, y * world.chunks_x + x);
+            }
+            else if (game.streamer)
+            {
+                chunk_streamer_prefetch(*game.streamer, world.source, y * world.chunks_x + x);
+            }
+        }
+    }
+}
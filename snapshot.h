@@ -0,0 +1,453 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "level_io.h"
+#include "profiler.h"
+#include "sim.h"
+
+/*
+Quicksaves. snapshot_save writes the whole Game, world included, to one
+file and snapshot_load puts it back, so a run can be stopped and picked
+up later at the same tick with the same Rng state: it carries on exactly
+as if it had never stopped. Neither needs SplashKit.
+
+Snapshot file (.sav, little endian):
+
+  SnapshotHeader (32 bytes)
+  section data, each section starting on an 8 byte boundary
+  section_count SnapshotSection entries at table_offset
+
+Each section is one array (tiles, mob x, ...) or the SnapshotGameRecord,
+found by id. The whole file is read with one fread and every array is
+copied out of that buffer at the offset the table gives, so loading costs
+about as much as a memcpy of the level. There is no per-tile parsing.
+
+Compatibility: sections are found by id, so a reader skips ids it does
+not know and leaves arrays from missing sections empty. The
+SnapshotGameRecord only grows at the end; older, shorter records load
+with the newer fields zeroed. Bump SNAPSHOT_VERSION when the meaning of
+a section changes, and keep the reader for the old version.
+
+mob_at and free_slot are rebuilt from the mobs and free_tiles, and the
+flow field and region scratch are rebuilt by the simulation. free_tiles
+is saved in its current order, because spawns pick from it by index.
+Streamed worlds save their resident chunks; the level file is opened
+again for the rest.
+*/
+
+const char SNAPSHOT_MAGIC[4] = {'D', 'S', 'A', 'V'};
+const uint16_t SNAPSHOT_VERSION = 1;
+const std::string SNAPSHOT_DIR = "saves/";
+
+struct SnapshotHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t header_size;
+    uint64_t table_offset;
+    uint32_t section_count;
+    uint32_t reserved[3];
+};
+static_assert(sizeof(SnapshotHeader) == 32, "SnapshotHeader must stay 32 bytes");
+
+struct SnapshotSection
+{
+    uint32_t id;
+    uint32_t element_size;
+    uint64_t offset;
+    uint64_t count;
+};
+static_assert(sizeof(SnapshotSection) == 24, "SnapshotSection must stay 24 bytes");
+
+// Section ids are stored in files; never reuse one
+enum SnapshotSectionId : uint32_t
+{
+    SNAPSHOT_GAME = 1, // SnapshotGameRecord
+    SNAPSHOT_MAP = 2,  // game.map characters
+    SNAPSHOT_SLOT_OF = 3,
+    SNAPSHOT_CHUNK_OF = 4,
+    SNAPSHOT_STAMP = 5,
+    SNAPSHOT_EDITED = 6,
+    SNAPSHOT_TILES = 7,
+    SNAPSHOT_WALKABLE = 8,
+    SNAPSHOT_MOB_X = 9,
+    SNAPSHOT_MOB_Y = 10,
+    SNAPSHOT_MOB_HEALTH = 11,
+    SNAPSHOT_MOB_DAMAGE = 12,
+    SNAPSHOT_FREE_TILES = 13
+};
+
+// Everything in Game that is not an array. New fields go at the end.
+struct SnapshotGameRecord
+{
+    int32_t player_x;
+    int32_t player_y;
+    int32_t health;
+    int32_t has_key;
+    int32_t air;
+    int32_t mobs_killed;
+    int32_t level;
+    int32_t footstep_value;
+    int32_t state;
+    int32_t tick_counter;
+    int32_t mob_move_ticks;
+    int32_t stream_chunk;
+    uint64_t rng_state;
+    uint32_t mob_components;
+    int32_t mob_count;
+    int32_t width;
+    int32_t height;
+    int32_t slots;
+    uint32_t next_stamp;
+    int32_t streamed; // the world streams from the level file named by the map section
+    int32_t reserved;
+};
+static_assert(sizeof(SnapshotGameRecord) == 88, "add SnapshotGameRecord fields at the end only");
+
+struct SnapshotWriter
+{
+    std::vector<uint8_t> bytes;
+    std::vector<SnapshotSection> sections;
+};
+
+template <typename T>
+inline void snapshot_put(SnapshotWriter &writer, uint32_t id, const T *data, size_t count)
+{
+    writer.bytes.resize((writer.bytes.size() + 7) & ~(size_t)7);
+    writer.sections.push_back({id, (uint32_t)sizeof(T), writer.bytes.size(), count});
+    const uint8_t *begin = (const uint8_t *)data;
+    writer.bytes.insert(writer.bytes.end(), begin, begin + count * sizeof(T));
+}
+
+template <typename T>
+inline void snapshot_put(SnapshotWriter &writer, uint32_t id, const std::vector<T> &values)
+{
+    snapshot_put(writer, id, values.data(), values.size());
+}
+
+// Builds the snapshot file contents for game in bytes
+inline void snapshot_write(const Game &game, std::vector<uint8_t> &bytes)
+{
+    const World &world = game.world;
+    SnapshotGameRecord record;
+    memset(&record, 0, sizeof(record));
+    record.player_x = game.player.x;
+    record.player_y = game.player.y;
+    record.health = game.player.health;
+    record.has_key = game.player.has_key;
+    record.air = game.player.air;
+    record.mobs_killed = game.player.mobs_killed;
+    record.level = game.player.level;
+    record.footstep_value = game.player.footstepValue;
+    record.state = game.state;
+    record.tick_counter = game.tick_counter;
+    record.mob_move_ticks = game.mob_move_ticks;
+    record.stream_chunk = game.stream_chunk;
+    record.rng_state = game.rng.state;
+    record.mob_components = game.mobs.components;
+    record.mob_count = game.mobs.count;
+    record.width = world.width;
+    record.height = world.height;
+    record.slots = (int32_t)world.chunk_of.size();
+    record.next_stamp = world.next_stamp;
+    record.streamed = world_streamed(world);
+
+    SnapshotWriter writer;
+    writer.bytes.swap(bytes);
+    writer.bytes.assign(sizeof(SnapshotHeader), 0);
+    snapshot_put(writer, SNAPSHOT_GAME, &record, 1);
+    snapshot_put(writer, SNAPSHOT_MAP, game.map.data(), game.map.size());
+    snapshot_put(writer, SNAPSHOT_SLOT_OF, world.slot_of);
+    snapshot_put(writer, SNAPSHOT_CHUNK_OF, world.chunk_of);
+    snapshot_put(writer, SNAPSHOT_STAMP, world.stamp);
+    snapshot_put(writer, SNAPSHOT_EDITED, world.edited);
+    snapshot_put(writer, SNAPSHOT_TILES, world.tiles);
+    snapshot_put(writer, SNAPSHOT_WALKABLE, world.walkable);
+    snapshot_put(writer, SNAPSHOT_MOB_X, game.mobs.x);
+    snapshot_put(writer, SNAPSHOT_MOB_Y, game.mobs.y);
+    snapshot_put(writer, SNAPSHOT_MOB_HEALTH, game.mobs.health);
+    snapshot_put(writer, SNAPSHOT_MOB_DAMAGE, game.mobs.damage);
+    snapshot_put(writer, SNAPSHOT_FREE_TILES, game.free_tiles);
+
+    writer.bytes.resize((writer.bytes.size() + 7) & ~(size_t)7);
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.header_size = sizeof(SnapshotHeader);
+    header.table_offset = writer.bytes.size();
+    header.section_count = (uint32_t)writer.sections.size();
+    const uint8_t *table = (const uint8_t *)writer.sections.data();
+    writer.bytes.insert(writer.bytes.end(), table, table + writer.sections.size() * sizeof(SnapshotSection));
+    memcpy(writer.bytes.data(), &header, sizeof(header));
+    bytes.swap(writer.bytes);
+}
+
+// A section of a snapshot being read; data is null if the snapshot does not have it
+struct SnapshotView
+{
+    const uint8_t *data = nullptr;
+    uint32_t element_size = 0;
+    uint64_t count = 0;
+};
+
+inline SnapshotView snapshot_find(const uint8_t *bytes, const SnapshotHeader &header, uint32_t id)
+{
+    const SnapshotSection *table = (const SnapshotSection *)(bytes + header.table_offset);
+    for (uint32_t i = 0; i < header.section_count; ++i)
+    {
+        if (table[i].id == id)
+        {
+            return {bytes + table[i].offset, table[i].element_size, table[i].count};
+        }
+    }
+    return SnapshotView();
+}
+
+// Copies a section into values. False if it is present with a different element size.
+template <typename T>
+inline bool snapshot_get(const uint8_t *bytes, const SnapshotHeader &header, uint32_t id, std::vector<T> &values)
+{
+    SnapshotView view = snapshot_find(bytes, header, id);
+    if (view.data && view.element_size != sizeof(T))
+    {
+        return false;
+    }
+    values.assign((const T *)view.data, (const T *)view.data + (view.data ? view.count : 0));
+    return true;
+}
+
+// Checks the header and that every section lies inside the file
+inline bool snapshot_check(const uint8_t *bytes, size_t size, SnapshotHeader &header)
+{
+    if (size < sizeof(SnapshotHeader))
+    {
+        return false;
+    }
+    memcpy(&header, bytes, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || header.version > SNAPSHOT_VERSION ||
+        header.table_offset % 8 != 0 || header.table_offset > size ||
+        header.section_count > (size - header.table_offset) / sizeof(SnapshotSection))
+    {
+        return false;
+    }
+    const SnapshotSection *table = (const SnapshotSection *)(bytes + header.table_offset);
+    for (uint32_t i = 0; i < header.section_count; ++i)
+    {
+        if (table[i].offset % 8 != 0 || table[i].offset > size || table[i].element_size == 0 ||
+            table[i].count > (size - table[i].offset) / table[i].element_size)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Replaces game with the snapshot in bytes. On failure game is unchanged.
+inline bool snapshot_read(const uint8_t *bytes, size_t size, Game &game)
+{
+    SnapshotHeader header;
+    if (!snapshot_check(bytes, size, header))
+    {
+        LOG_WARN(LOG_GAME, "Snapshot is damaged or from a newer version");
+        return false;
+    }
+    SnapshotView game_view = snapshot_find(bytes, header, SNAPSHOT_GAME);
+    if (!game_view.data || game_view.count != 1)
+    {
+        LOG_WARN(LOG_GAME, "Snapshot has no game record");
+        return false;
+    }
+    SnapshotGameRecord record;
+    memset(&record, 0, sizeof(record));
+    memcpy(&record, game_view.data, std::min((size_t)game_view.element_size, sizeof(record)));
+
+    std::string map;
+    SnapshotView map_view = snapshot_find(bytes, header, SNAPSHOT_MAP);
+    if (map_view.data)
+    {
+        map.assign((const char *)map_view.data, map_view.count);
+    }
+
+    // Read into a fresh world and mobs first so a bad snapshot leaves the game alone
+    World world;
+    world.width = record.width;
+    world.height = record.height;
+    world.chunks_x = (record.width + CHUNK_MASK) >> CHUNK_SHIFT;
+    world.chunks_y = (record.height + CHUNK_MASK) >> CHUNK_SHIFT;
+    world.next_stamp = record.next_stamp;
+    Archetype mobs;
+    mobs.components = record.mob_components;
+    mobs.count = record.mob_count;
+    std::vector<int32_t> free_tiles;
+    bool ok = snapshot_get(bytes, header, SNAPSHOT_SLOT_OF, world.slot_of) &&
+              snapshot_get(bytes, header, SNAPSHOT_CHUNK_OF, world.chunk_of) &&
+              snapshot_get(bytes, header, SNAPSHOT_STAMP, world.stamp) &&
+              snapshot_get(bytes, header, SNAPSHOT_EDITED, world.edited) &&
+              snapshot_get(bytes, header, SNAPSHOT_TILES, world.tiles) &&
+              snapshot_get(bytes, header, SNAPSHOT_WALKABLE, world.walkable) &&
+              snapshot_get(bytes, header, SNAPSHOT_MOB_X, mobs.x) &&
+              snapshot_get(bytes, header, SNAPSHOT_MOB_Y, mobs.y) &&
+              snapshot_get(bytes, header, SNAPSHOT_MOB_HEALTH, mobs.health) &&
+              snapshot_get(bytes, header, SNAPSHOT_MOB_DAMAGE, mobs.damage) &&
+              snapshot_get(bytes, header, SNAPSHOT_FREE_TILES, free_tiles);
+
+    // Every array has to agree with the sizes in the record before anything indexes with it
+    size_t slots = record.slots;
+    auto column_ok = [&](const std::vector<int32_t> &values, uint32_t component) {
+        return values.size() == ((mobs.components & component) ? (size_t)mobs.count : 0);
+    };
+    ok = ok && record.width > 0 && record.height > 0 && mobs.count >= 0 &&
+         world.slot_of.size() == (size_t)world.chunks_x * world.chunks_y && world.chunk_of.size() == slots &&
+         world.stamp.size() == slots && world.edited.size() == slots && world.tiles.size() == slots * CHUNK_TILES &&
+         world.walkable.size() == slots * CHUNK_SIZE && column_ok(mobs.x, COMPONENT_POSITION) &&
+         column_ok(mobs.y, COMPONENT_POSITION) && column_ok(mobs.health, COMPONENT_HEALTH) &&
+         column_ok(mobs.damage, COMPONENT_DAMAGE);
+    for (size_t i = 0; ok && i < world.slot_of.size(); ++i)
+    {
+        ok = world.slot_of[i] < (int32_t)slots && (world.slot_of[i] < 0 || world.chunk_of[world.slot_of[i]] == (int32_t)i);
+    }
+    // And back: streaming writes slot_of[chunk_of[slot]], so a free slot must say so
+    for (size_t slot = 0; ok && slot < slots; ++slot)
+    {
+        int32_t chunk = world.chunk_of[slot];
+        ok = chunk == -1 || (chunk >= 0 && (size_t)chunk < world.slot_of.size() && world.slot_of[chunk] == (int32_t)slot);
+    }
+    // One mob per traversable tile, or rebuilding mob_at would lose one
+    std::vector<uint8_t> occupied(ok ? world.tiles.size() : 0, 0);
+    for (int i = 0; ok && i < mobs.count && archetype_has(mobs, COMPONENT_POSITION); ++i)
+    {
+        ok = world_resident(world, mobs.x[i], mobs.y[i]) && world_traversable(world, mobs.x[i], mobs.y[i]) &&
+             !occupied[world_index(world, mobs.x[i], mobs.y[i])]++;
+    }
+    // Free tiles are distinct resident traversable tiles without a mob, as spawn_mobs assumes
+    for (size_t i = 0; ok && i < free_tiles.size(); ++i)
+    {
+        int32_t tile = free_tiles[i];
+        ok = tile >= 0 && (size_t)tile < world.tiles.size() && world.chunk_of[tile / CHUNK_TILES] >= 0 &&
+             world_traversable(world, world_index_x(world, tile), world_index_y(world, tile)) && !occupied[tile]++;
+    }
+    // Scalars the game indexes with
+    ok = ok && (int)record.state >= PLAYING && (int)record.state <= EDITING &&
+         world_resident(world, record.player_x, record.player_y);
+    if (!ok)
+    {
+        LOG_WARN(LOG_GAME, "Snapshot sections do not match its game record");
+        return false;
+    }
+
+    if (record.streamed)
+    {
+        // The chunks that are not resident come from the level file, as when it was saved
+        if (game.world.source && game.map == map && game.world.source->width == world.width &&
+            game.world.source->height == world.height)
+        {
+            world.source = game.world.source;
+        }
+        else
+        {
+            World level;
+            if (!load_level(map, level) || !level.source || level.width != world.width || level.height != world.height)
+            {
+                LOG_WARN(LOG_GAME, "Snapshot streams from %s, which no longer matches", map);
+                return false;
+            }
+            world.source = level.source;
+        }
+    }
+
+    game.player.x = record.player_x;
+    game.player.y = record.player_y;
+    game.player.health = record.health;
+    game.player.has_key = record.has_key != 0;
+    game.player.air = record.air;
+    game.player.mobs_killed = record.mobs_killed;
+    game.player.level = record.level;
+    game.player.footstepValue = record.footstep_value;
+    game.state = (GameState)record.state;
+    game.tick_counter = record.tick_counter;
+    game.mob_move_ticks = record.mob_move_ticks;
+    game.rng.state = record.rng_state;
+    game.map = map;
+    game.world = std::move(world);
+    game.mobs = std::move(mobs);
+    game.events.clear();
+
+    // Indexes that follow from the arrays above
+    game.mob_at.assign(game.world.tiles.size(), -1);
+    for (int i = 0; i < game.mobs.count; ++i)
+    {
+        game.mob_at[world_index(game.world, game.mobs.x[i], game.mobs.y[i])] = i;
+    }
+    game.free_tiles = std::move(free_tiles);
+    game.free_slot.assign(game.world.tiles.size(), -1);
+    for (size_t i = 0; i < game.free_tiles.size(); ++i)
+    {
+        game.free_slot[game.free_tiles[i]] = (int32_t)i;
+    }
+    game.regions_x = (game.world.width + MOB_REGION_SIZE - 1) / MOB_REGION_SIZE;
+    game.regions.assign((size_t)game.regions_x * ((game.world.height + MOB_REGION_SIZE - 1) / MOB_REGION_SIZE), MobRegion());
+    game.active_regions.clear();
+    game.flow.dirty = true;
+    game.stream_chunk = record.stream_chunk;
+    return true;
+}
+
+// Writes a snapshot of game to path, through a temporary file renamed over it
+inline bool snapshot_save(const std::string &path, const Game &game)
+{
+    PROFILE_ZONE("snapshot_save");
+    static thread_local std::vector<uint8_t> bytes; // kept between saves so a quicksave does not allocate
+    snapshot_write(game, bytes);
+
+    size_t slash = path.find_last_of('/');
+    if (slash != std::string::npos)
+    {
+        mkdir(path.substr(0, slash).c_str(), 0755);
+    }
+    FILE *file = fopen((path + ".tmp").c_str(), "wb");
+    if (!file)
+    {
+        LOG_ERROR(LOG_GAME, "Could not open %s for writing", path);
+        return false;
+    }
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    ok = (fclose(file) == 0) && ok;
+    ok = ok && rename((path + ".tmp").c_str(), path.c_str()) == 0;
+    if (!ok)
+    {
+        LOG_ERROR(LOG_GAME, "Failed writing snapshot %s", path);
+    }
+    return ok;
+}
+
+// Reads the snapshot at path into game with a single read. On failure game is unchanged.
+inline bool snapshot_load(const std::string &path, Game &game)
+{
+    PROFILE_ZONE("snapshot_load");
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        return false;
+    }
+    struct stat info;
+    static thread_local std::vector<uint8_t> bytes;
+    bool ok = fstat(fileno(file), &info) == 0;
+    if (ok)
+    {
+        bytes.resize(info.st_size);
+        ok = fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    }
+    fclose(file);
+    if (!ok || !snapshot_read(bytes.data(), bytes.size(), game))
+    {
+        LOG_WARN(LOG_GAME, "Could not load snapshot %s", path);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Work-stealing thread pool for data-parallel loops. thread_pool_run hands
+out tasks 0..count-1 in contiguous runs, one run per thread, so
+neighbouring tasks stay on the same core. A thread that finishes its run
+steals from the back of another thread's run. The calling thread joins in,
+so a pool with no workers, or no pool at all, runs everything in order on
+the caller.
+
+Which thread runs a task is not fixed, so tasks must not depend on the
+order they run in.
+*/
+
+struct TaskQueue
+{
+    std::mutex mutex;
+    std::deque<int> tasks;
+};
+
+struct ThreadPool
+{
+    std::vector<std::thread> workers;
+    std::unique_ptr<TaskQueue[]> queues; // one per worker, the caller's is last
+    int num_queues = 0;
+
+    std::mutex mutex;
+    std::condition_variable wake; // a new job was posted or the pool is stopping
+    std::condition_variable done; // a worker finished its part of the job
+    std::function<void(int)> job;
+    uint64_t generation = 0; // bumped for every job so workers see each one once
+    int busy = 0;            // workers still inside the current job
+    bool stopping = false;
+};
+
+inline bool thread_pool_pop(TaskQueue &queue, bool front, int &task)
+{
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+    {
+        return false;
+    }
+    if (front)
+    {
+        task = queue.tasks.front();
+        queue.tasks.pop_front();
+    }
+    else
+    {
+        task = queue.tasks.back();
+        queue.tasks.pop_back();
+    }
+    return true;
+}
+
+// Runs tasks from queue self, then steals from the others until none are left
+inline void thread_pool_work(ThreadPool &pool, int self)
+{
+    int task;
+    while (true)
+    {
+        bool found = thread_pool_pop(pool.queues[self], true, task);
+        for (int i = 1; !found && i < pool.num_queues; ++i)
+        {
+            found = thread_pool_pop(pool.queues[(self + i) % pool.num_queues], false, task);
+        }
+        if (!found)
+        {
+            return;
+        }
+        pool.job(task);
+    }
+}
+
+inline void thread_pool_worker(ThreadPool &pool, int self)
+{
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    while (true)
+    {
+        pool.wake.wait(lock, [&] { return pool.stopping || pool.generation != seen; });
+        if (pool.stopping)
+        {
+            return;
+        }
+        seen = pool.generation;
+
+        lock.unlock();
+        thread_pool_work(pool, self);
+        lock.lock();
+
+        pool.busy--;
+        pool.done.notify_all();
+    }
+}
+
+// Starts num_workers threads besides the caller. 0 keeps everything on the caller.
+inline void thread_pool_start(ThreadPool &pool, int num_workers)
+{
+    pool.stopping = false;
+    pool.num_queues = num_workers + 1;
+    pool.queues.reset(new TaskQueue[pool.num_queues]);
+    for (int i = 0; i < num_workers; ++i)
+    {
+        pool.workers.emplace_back(thread_pool_worker, std::ref(pool), i);
+    }
+}
+
+inline void thread_pool_stop(ThreadPool &pool)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.stopping = true;
+    }
+    pool.wake.notify_all();
+    for (std::thread &worker : pool.workers)
+    {
+        worker.join();
+    }
+    pool.workers.clear();
+}
+
+// One thread per core, counting the caller
+inline int thread_pool_default_workers()
+{
+    return std::max(1, (int)std::thread::hardware_concurrency()) - 1;
+}
+
+// Calls job(i) for every i in [0, count) and returns once all have finished
+inline void thread_pool_run(ThreadPool *pool, int count, const std::function<void(int)> &job)
+{
+    if (!pool || pool->workers.empty() || count <= 1)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            job(i);
+        }
+        return;
+    }
+
+    int per_queue = (count + pool->num_queues - 1) / pool->num_queues;
+    for (int q = 0; q < pool->num_queues; ++q)
+    {
+        std::lock_guard<std::mutex> lock(pool->queues[q].mutex);
+        for (int i = q * per_queue; i < std::min(count, (q + 1) * per_queue); ++i)
+        {
+            pool->queues[q].tasks.push_back(i);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->job = job;
+        pool->busy = (int)pool->workers.size();
+        pool->generation++;
+    }
+    pool->wake.notify_all();
+
+    thread_pool_work(*pool, pool->num_queues - 1);
+
+    // Every queue is empty now, but workers may still be running a stolen task
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->done.wait(lock, [pool] { return pool->busy == 0; });
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "splashkit.h"
+#include "camera.h"
+#include "tile_types.h"
+#include "world.h"
+
+/*
+The static tile layer is drawn into offscreen bitmaps, one per block of
+LAYER_BLOCK_SIZE x LAYER_BLOCK_SIZE tiles, and only the blocks on screen
+are kept and blitted. Only tiles marked dirty are repainted: edits mark
+single tiles, a level load marks everything, and a block is repainted
+whole when its chunk was (re)loaded or the door colour changed (the
+player picking up or losing the key).
+*/
+
+const int LAYER_BLOCK_SIZE = 8;     // tiles per block side, divides CHUNK_SIZE
+const int LAYER_CACHED_BLOCKS = 48; // blocks kept; a screen needs about a dozen
+const uint32_t LAYER_UNPAINTED = 0xFFFFFFFF;
+
+struct LayerBlock
+{
+    int bx = -1; // block coordinates, -1 while unused
+    int by = -1;
+    uint32_t stamp = LAYER_UNPAINTED; // world.stamp of the chunk when painted
+    bool door_open = false;           // door colour painted
+    bitmap bmp = nullptr;
+    uint64_t last_used = 0;
+};
+
+struct TileLayer
+{
+    int tile_size = 0;
+    bool all_dirty = true;
+    vector<LayerBlock> blocks;
+    vector<int> dirty; // x, y pairs of tiles waiting to be repainted
+    uint64_t clock = 0;
+};
+
+// The type's colour from the registry; door_open picks open_color for types that need the key
+inline color tile_color(const TileTypeRegistry &types, TileType type, bool door_open)
+{
+    const TileTypeInfo &info = types.info[type];
+    uint32_t rgb = door_open && info.requires_key ? info.open_color : info.color;
+    return rgb_color((int)(rgb >> 16 & 0xFF), (int)(rgb >> 8 & 0xFF), (int)(rgb & 0xFF));
+}
+
+inline void tile_layer_mark_all(TileLayer &layer)
+{
+    layer.all_dirty = true;
+}
+
+inline void tile_layer_mark_dirty(TileLayer &layer, int x, int y)
+{
+    if (!layer.all_dirty)
+    {
+        layer.dirty.push_back(x);
+        layer.dirty.push_back(y);
+    }
+}
+
+// Stamp of the chunk holding a block, 0 if it is not loaded
+inline uint32_t tile_layer_chunk_stamp(const World &world, int bx, int by)
+{
+    int slot = world.slot_of[world_chunk(world, bx * LAYER_BLOCK_SIZE, by * LAYER_BLOCK_SIZE)];
+    return slot >= 0 ? world.stamp[slot] : 0;
+}
+
+inline void tile_layer_paint(TileLayer &layer, const World &world, const LayerBlock &block, int x, int y)
+{
+    fill_rectangle_on_bitmap(block.bmp, tile_color(tile_types(), world_tile(world, x, y), block.door_open),
+                             (x - block.bx * LAYER_BLOCK_SIZE) * layer.tile_size,
+                             (y - block.by * LAYER_BLOCK_SIZE) * layer.tile_size, layer.tile_size, layer.tile_size);
+}
+
+inline void tile_layer_paint_block(TileLayer &layer, const World &world, LayerBlock &block, bool door_open)
+{
+    block.stamp = tile_layer_chunk_stamp(world, block.bx, block.by);
+    block.door_open = door_open;
+    clear_bitmap(block.bmp, COLOR_WHITE);
+    int x0 = block.bx * LAYER_BLOCK_SIZE;
+    int y0 = block.by * LAYER_BLOCK_SIZE;
+    for (int y = y0; y < std::min(y0 + LAYER_BLOCK_SIZE, world.height); ++y)
+    {
+        for (int x = x0; x < std::min(x0 + LAYER_BLOCK_SIZE, world.width); ++x)
+        {
+            tile_layer_paint(layer, world, block, x, y);
+        }
+    }
+}
+
+inline LayerBlock *tile_layer_find(TileLayer &layer, int bx, int by)
+{
+    for (LayerBlock &block : layer.blocks)
+    {
+        if (block.bx == bx && block.by == by)
+        {
+            return &block;
+        }
+    }
+    return nullptr;
+}
+
+// Finds the cached block or takes over the least recently drawn one
+inline LayerBlock &tile_layer_block(TileLayer &layer, int bx, int by)
+{
+    LayerBlock *block = tile_layer_find(layer, bx, by);
+    if (!block)
+    {
+        if ((int)layer.blocks.size() < LAYER_CACHED_BLOCKS)
+        {
+            layer.blocks.push_back(LayerBlock());
+            block = &layer.blocks.back();
+            int size = LAYER_BLOCK_SIZE * layer.tile_size;
+            block->bmp = create_bitmap("tile_layer_" + std::to_string(layer.blocks.size()), size, size);
+        }
+        else
+        {
+            block = &layer.blocks[0];
+            for (LayerBlock &candidate : layer.blocks)
+            {
+                if (candidate.last_used < block->last_used)
+                {
+                    block = &candidate;
+                }
+            }
+        }
+        block->bx = bx;
+        block->by = by;
+        block->stamp = LAYER_UNPAINTED;
+    }
+    block->last_used = ++layer.clock;
+    return *block;
+}
+
+// Brings the blocks on screen up to date with the world, repainting only what changed
+inline void tile_layer_update(TileLayer &layer, const World &world, int tile_size, bool door_open,
+                              const Camera &camera, int view_width, int view_height)
+{
+    if (layer.tile_size != tile_size)
+    {
+        for (LayerBlock &block : layer.blocks)
+        {
+            free_bitmap(block.bmp);
+        }
+        layer.blocks.clear();
+        layer.tile_size = tile_size;
+    }
+
+    if (layer.all_dirty)
+    {
+        for (LayerBlock &block : layer.blocks)
+        {
+            block.bx = block.by = -1;
+        }
+        layer.all_dirty = false;
+    }
+    for (size_t i = 0; i < layer.dirty.size(); i += 2)
+    {
+        int x = layer.dirty[i];
+        int y = layer.dirty[i + 1];
+        LayerBlock *block = tile_layer_find(layer, x / LAYER_BLOCK_SIZE, y / LAYER_BLOCK_SIZE);
+        if (block && world_in_bounds(world, x, y))
+        {
+            tile_layer_paint(layer, world, *block, x, y);
+        }
+    }
+    layer.dirty.clear();
+    if (world.width == 0 || world.height == 0)
+    {
+        return;
+    }
+
+    int block_pixels = LAYER_BLOCK_SIZE * tile_size;
+    int bx1 = std::min((camera.x + view_width - 1) / block_pixels, (world.width - 1) / LAYER_BLOCK_SIZE);
+    int by1 = std::min((camera.y + view_height - 1) / block_pixels, (world.height - 1) / LAYER_BLOCK_SIZE);
+    for (int by = camera.y / block_pixels; by <= by1; ++by)
+    {
+        for (int bx = camera.x / block_pixels; bx <= bx1; ++bx)
+        {
+            LayerBlock &block = tile_layer_block(layer, bx, by);
+            if (block.stamp != tile_layer_chunk_stamp(world, bx, by) || block.door_open != door_open)
+            {
+                tile_layer_paint_block(layer, world, block, door_open);
+            }
+        }
+    }
+}
+
+// Blits the blocks on screen; call after tile_layer_update with the same camera
+inline void tile_layer_draw(const TileLayer &layer, const Camera &camera, int view_width, int view_height)
+{
+    int block_pixels = LAYER_BLOCK_SIZE * layer.tile_size;
+    for (const LayerBlock &block : layer.blocks)
+    {
+        if (block.bx >= 0 && camera_sees(camera, block.bx * block_pixels, block.by * block_pixels, block_pixels, block_pixels, view_width, view_height))
+        {
+            draw_bitmap(block.bmp, block.bx * block_pixels - camera.x, block.by * block_pixels - camera.y);
+        }
+    }
+}
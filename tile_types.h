@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "world.h"
+
+/*
+Tile type registry. Everything a tile type does lives in one TileTypeInfo
+indexed by the type byte stored in the world: its colour, whether the
+editor paints it traversable, what entering it does to the player and the
+rules the editor enforces when placing it. The simulation, the tile layer
+and the editor look the type up instead of switching on it, so a new type
+(lava, ice, another locked door) is a new entry in
+resources/json/tile_types.json, see tile_types_json.h, rather than a
+change to their loops.
+
+The registry starts out holding the four built-in types, so the headless
+tools and a missing tile_types.json behave as before. Type ids are what
+levels store, so the built-in ones keep their TileType values.
+*/
+
+const int TILE_TYPE_LIMIT = TILE_TYPE_MASK + 1; // type ids that fit in a tile byte
+const int TILE_MAX_PATH_COST = 15;
+const int EDITOR_LEVEL_KEYS = 3; // number keys 1 to 3 open levels in the editor, so no type can take them
+
+// What entering a tile does to the player, applied in this order
+enum TileEffect : uint8_t
+{
+    TILE_EFFECT_FOOTSTEP = 1 << 0, // footstep sound, alternating between the two
+    TILE_EFFECT_DROWN = 1 << 1,    // lose AIR_LOSS_RATE air, or health once out of air
+    TILE_EFFECT_BREATHE = 1 << 2,  // regain AIR_GAIN_RATE air
+    TILE_EFFECT_HEAL = 1 << 3,     // regain one health
+    TILE_EFFECT_EXIT = 1 << 4,     // finishes the level
+    TILE_EFFECT_SLIDE = 1 << 5     // the player keeps moving the same way while the next tile is traversable
+};
+
+// Rules the editor checks before placing a tile
+enum TileEditRule : uint8_t
+{
+    TILE_EDIT_INTERIOR_ONLY = 1 << 0, // not on the level border
+    TILE_EDIT_UNIQUE = 1 << 1         // at most one per level
+};
+
+struct TileTypeInfo
+{
+    std::string name = "UNKNOWN";
+    bool defined = false;
+    uint32_t color = 0x000000;      // 0xRRGGBB
+    uint32_t open_color = 0x000000; // colour once the player holds the key, for requires_key types
+    bool traversable = false;       // as painted by the editor
+    bool requires_key = false;      // blocks the player until the key is held, then opens
+    uint8_t effects = 0;            // TileEffect bits
+    int damage = 0;                 // health lost on entering
+    int path_cost = 1;              // cost of stepping onto it for mobs chasing the player, 1 to TILE_MAX_PATH_COST
+    int editor_key = -1;            // number key that selects the type in the editor, -1 for none
+    uint8_t edit_rules = 0;         // TileEditRule bits
+};
+
+struct TileTypeRegistry
+{
+    TileTypeInfo info[TILE_TYPE_LIMIT];
+    std::vector<uint8_t> defined; // ids of the defined types, ascending
+};
+
+// Forgets every type, then adds the built-in ones
+inline void tile_types_reset(TileTypeRegistry &types);
+
+inline TileTypeRegistry &tile_types()
+{
+    static TileTypeRegistry instance = [] {
+        TileTypeRegistry types;
+        tile_types_reset(types);
+        return types;
+    }();
+    return instance;
+}
+
+inline const TileTypeInfo &tile_type_info(int type)
+{
+    return tile_types().info[type & TILE_TYPE_MASK];
+}
+
+inline void tile_types_define(TileTypeRegistry &types, int id, const TileTypeInfo &info)
+{
+    TileTypeInfo &entry = types.info[id & TILE_TYPE_MASK];
+    if (!entry.defined)
+    {
+        types.defined.insert(std::lower_bound(types.defined.begin(), types.defined.end(), (uint8_t)id), (uint8_t)id);
+    }
+    entry = info;
+    entry.defined = true;
+}
+
+inline void tile_types_reset(TileTypeRegistry &types)
+{
+    for (TileTypeInfo &info : types.info)
+    {
+        info = TileTypeInfo();
+    }
+    types.defined.clear();
+
+    TileTypeInfo grass;
+    grass.name = "GRASS";
+    grass.color = 0x008000;
+    grass.traversable = true;
+    grass.effects = TILE_EFFECT_FOOTSTEP | TILE_EFFECT_BREATHE | TILE_EFFECT_HEAL;
+    grass.editor_key = 7;
+    tile_types_define(types, GRASS, grass);
+
+    TileTypeInfo water;
+    water.name = "WATER";
+    water.color = 0x0000FF;
+    water.traversable = true;
+    water.effects = TILE_EFFECT_DROWN;
+    water.path_cost = 3;
+    water.editor_key = 8;
+    tile_types_define(types, WATER, water);
+
+    TileTypeInfo wall;
+    wall.name = "WALL";
+    wall.color = 0x006400;
+    wall.editor_key = 9;
+    wall.edit_rules = TILE_EDIT_INTERIOR_ONLY;
+    tile_types_define(types, WALL, wall);
+
+    TileTypeInfo door;
+    door.name = "DOOR";
+    door.color = 0x000000;
+    door.open_color = 0xFFD700;
+    door.requires_key = true;
+    door.effects = TILE_EFFECT_EXIT;
+    door.editor_key = 6;
+    door.edit_rules = TILE_EDIT_UNIQUE;
+    tile_types_define(types, DOOR, door);
+}
+
+inline const std::string &tile_type_name(int type)
+{
+    return tile_type_info(type).name;
+}
+
+// Id of the type called name, -1 if there is none
+inline int tile_type_find(const TileTypeRegistry &types, const std::string &name)
+{
+    for (uint8_t id : types.defined)
+    {
+        if (types.info[id].name == name)
+        {
+            return id;
+        }
+    }
+    return -1;
+}
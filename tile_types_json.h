@@ -0,0 +1,129 @@
+#pragma once
+
+#include "splashkit.h"
+#include "tile_types.h"
+
+/*
+JSON tile types used in resources/json/tile_types.json:
+
+  { "types": [ { "id": 3, "name": "DOOR", "color": "#000000", "open_color": "#FFD700",
+                 "traversable": false, "requires_key": true, "effects": ["exit"],
+                 "damage": 0, "path_cost": 1, "editor_key": 6, "edit_rules": ["unique"] }, ... ] }
+
+Only "id" and "name" are required; other keys default as in TileTypeInfo.
+Effects are footstep, drown, breathe, heal, exit and slide; edit rules are
+interior_only and unique. Editor keys 1 to 3 open levels, so a type asking
+for one gets no key. An entry with the id of a built-in type replaces it.
+*/
+
+// "#RRGGBB" to 0xRRGGBB, fallback if the text is not a colour
+inline uint32_t tile_color_from_hex(const string &text, uint32_t fallback)
+{
+    if (text.size() != 7 || text[0] != '#')
+    {
+        return fallback;
+    }
+    char *end = nullptr;
+    unsigned long value = strtoul(text.c_str() + 1, &end, 16);
+    return *end == '\0' ? (uint32_t)value : fallback;
+}
+
+// ORs together the bits named in the key's array; unknown names are logged and ignored
+inline uint8_t tile_flags_from_json(json type_json, const string &key, const vector<string> &names)
+{
+    uint8_t flags = 0;
+    if (!json_has_key(type_json, key))
+    {
+        return flags;
+    }
+    vector<string> values;
+    json_read_array(type_json, key, values);
+    for (const string &value : values)
+    {
+        size_t i = std::find(names.begin(), names.end(), value) - names.begin();
+        if (i < names.size())
+        {
+            flags |= 1 << i;
+        }
+        else
+        {
+            LOG_WARN(LOG_LEVEL, "Unknown tile %s %s", key, value);
+        }
+    }
+    return flags;
+}
+
+// Resets types to the built-in ones, then adds or replaces the types in filename
+inline bool load_tile_types_from_json(TileTypeRegistry &types, const string &filename)
+{
+    // Bit order of TileEffect and TileEditRule
+    static const vector<string> EFFECT_NAMES = {"footstep", "drown", "breathe", "heal", "exit", "slide"};
+    static const vector<string> EDIT_RULE_NAMES = {"interior_only", "unique"};
+
+    tile_types_reset(types);
+    json types_json = json_from_file(filename);
+    if (!json_has_key(types_json, "types"))
+    {
+        LOG_WARN(LOG_LEVEL, "%s has no tile types, using the built-in ones", filename);
+        free_json(types_json);
+        return false;
+    }
+
+    vector<json> entries;
+    json_read_array(types_json, "types", entries);
+    for (json type_json : entries)
+    {
+        int id = json_read_number_as_int(type_json, "id");
+        if (id < 0 || id >= TILE_TYPE_LIMIT || !json_has_key(type_json, "name"))
+        {
+            LOG_WARN(LOG_LEVEL, "Skipped tile type %d in %s, it needs a name and an id below %d", id, filename, TILE_TYPE_LIMIT);
+            free_json(type_json);
+            continue;
+        }
+
+        TileTypeInfo info;
+        info.name = json_read_string(type_json, "name");
+        if (json_has_key(type_json, "color"))
+        {
+            info.color = tile_color_from_hex(json_read_string(type_json, "color"), info.color);
+        }
+        info.open_color = info.color;
+        if (json_has_key(type_json, "open_color"))
+        {
+            info.open_color = tile_color_from_hex(json_read_string(type_json, "open_color"), info.color);
+        }
+        if (json_has_key(type_json, "traversable"))
+        {
+            info.traversable = json_read_bool(type_json, "traversable");
+        }
+        if (json_has_key(type_json, "requires_key"))
+        {
+            info.requires_key = json_read_bool(type_json, "requires_key");
+        }
+        if (json_has_key(type_json, "damage"))
+        {
+            info.damage = json_read_number_as_int(type_json, "damage");
+        }
+        if (json_has_key(type_json, "path_cost"))
+        {
+            info.path_cost = std::max(1, std::min(TILE_MAX_PATH_COST, json_read_number_as_int(type_json, "path_cost")));
+        }
+        if (json_has_key(type_json, "editor_key"))
+        {
+            info.editor_key = json_read_number_as_int(type_json, "editor_key");
+            if (info.editor_key >= 1 && info.editor_key <= EDITOR_LEVEL_KEYS)
+            {
+                LOG_WARN(LOG_LEVEL, "Tile type %s cannot use editor key %d, it opens a level; it gets no key", info.name,
+                         info.editor_key);
+                info.editor_key = -1;
+            }
+        }
+        info.effects = tile_flags_from_json(type_json, "effects", EFFECT_NAMES);
+        info.edit_rules = tile_flags_from_json(type_json, "edit_rules", EDIT_RULE_NAMES);
+        tile_types_define(types, id, info);
+        free_json(type_json);
+    }
+    free_json(types_json);
+    LOG_INFO(LOG_LEVEL, "Loaded %d tile types from %s", (int)types.defined.size(), filename);
+    return true;
+}
@@ -0,0 +1,517 @@
+#include "splashkit.h"
+#include "../level_io.h"
+#include "../para_json.h"
+#include "../replay.h"
+#include "../sim.h"
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <sys/resource.h>
+
+/*
+Headless benchmark. Runs scenario files from resources/json/bench against
+the simulation with no window and prints one JSON object per scenario.
+Run it from the repository root:
+
+  bench                          every scenario in resources/json/bench
+  bench bench/mob_swarm.json     just the named scenarios
+  bench recordings/x.rec         replay a recorded run flat out
+  bench --out results.json ...   write the report to a file instead of stdout
+  bench --threads 4 ...          move mobs on 4 threads
+  bench --trace trace.json ...   profile and write the last scenario's zones as Chrome trace JSON
+
+Log messages, such as level loading progress, go to stderr, so stdout
+carries only the report.
+
+Scenario keys (all optional except "ticks", or "replay"):
+  "name"               label for the report, defaults to the file name
+  "level"              level in resources/json, e.g. "level_1.json"
+  "generate_width"     generate a level of this size instead of loading one
+  "generate_height"
+  "seed"               seeds the simulation and the generator (default 1)
+  "ticks"              measured ticks per repeat
+  "warmup_ticks"       ticks run before measuring (default 0)
+  "repeats"            repeats, the median repeat is reported (default 3)
+  "max_mobs"           overrides MAX_MOBS from consts.json
+  "tick_speed"         overrides TICK_SPEED
+  "mob_move_interval"  overrides MOB_MOVE_INTERVAL (0 moves mobs every tick)
+  "script"             player moves "WASD." repeated, one per tick
+  "reload_every"       reload the level from disk every N ticks
+  "threads"            threads moving mobs, counting the main one (default 1)
+  "start_x"            player start tile instead of a random one
+  "start_y"
+  "replay"             recording to replay, from the repository root; "ticks"
+                       then defaults to the whole recording and the keys that
+                       change the level, player or constants are ignored
+
+Generated levels are written to $TMPDIR (or /tmp) and opened from there,
+so levels of more than WORLD_RESIDENT_CHUNKS chunks stream chunks around
+the player. Row height / 2 + 1 has no inner walls, so a "D" script walks
+the player across the level.
+
+A replay reports the state hash it ended on. Every repeat has to end on
+the same hash, so a recording doubles as a determinism check.
+
+--threads N overrides "threads" for every scenario, e.g. to check scaling.
+*/
+
+typedef std::chrono::steady_clock bench_clock;
+FILE *report = stdout;
+int threads_override = 0;
+string trace_path;
+
+struct Scenario
+{
+    string name;
+    string level;
+    int generate_width = 0;
+    int generate_height = 0;
+    int seed = 1;
+    int ticks = 0;
+    int warmup_ticks = 0;
+    int repeats = 3;
+    int max_mobs = -1;
+    int tick_speed = -1;
+    int mob_move_interval = -1;
+    string script;
+    int reload_every = 0;
+    int threads = 1;
+    int start_x = -1;
+    int start_y = -1;
+    string replay;
+};
+
+struct RunResult
+{
+    double seconds = 0;
+    vector<uint32_t> tick_ns;   // per measured tick
+    vector<uint32_t> reload_ns; // per level reload
+    int restarts = 0;           // runs restarted after the player died or left the level
+    uint64_t state_hash = 0;    // replays only, see replay_state_hash
+    int width = 0;              // replays only, the level the replay ended on
+    int height = 0;
+};
+
+int read_int(json j, const string &key, int fallback)
+{
+    return json_has_key(j, key) ? json_read_number_as_int(j, key) : fallback;
+}
+
+bool load_scenario(const string &filename, Scenario &scenario)
+{
+    if (filename.length() > 4 && filename.substr(filename.length() - 4) == ".rec")
+    {
+        scenario.name = filename;
+        scenario.replay = filename;
+        return true;
+    }
+
+    json j = json_from_file(filename);
+    if (!json_has_key(j, "ticks") && !json_has_key(j, "replay"))
+    {
+        fprintf(stderr, "Scenario %s has no \"ticks\"\n", filename.c_str());
+        free_json(j);
+        return false;
+    }
+
+    scenario.name = json_has_key(j, "name") ? json_read_string(j, "name") : filename;
+    scenario.level = json_has_key(j, "level") ? json_read_string(j, "level") : "";
+    scenario.generate_width = read_int(j, "generate_width", 0);
+    scenario.generate_height = read_int(j, "generate_height", 0);
+    scenario.seed = read_int(j, "seed", 1);
+    scenario.ticks = read_int(j, "ticks", 0);
+    scenario.warmup_ticks = read_int(j, "warmup_ticks", 0);
+    scenario.repeats = std::max(1, read_int(j, "repeats", 3));
+    scenario.max_mobs = read_int(j, "max_mobs", -1);
+    scenario.tick_speed = read_int(j, "tick_speed", -1);
+    scenario.mob_move_interval = read_int(j, "mob_move_interval", -1);
+    scenario.script = json_has_key(j, "script") ? json_read_string(j, "script") : "";
+    scenario.reload_every = read_int(j, "reload_every", 0);
+    scenario.threads = std::max(1, read_int(j, "threads", 1));
+    scenario.start_x = read_int(j, "start_x", -1);
+    scenario.start_y = read_int(j, "start_y", -1);
+    scenario.replay = json_has_key(j, "replay") ? json_read_string(j, "replay") : "";
+    free_json(j);
+    return true;
+}
+
+// Border walls, scattered inner walls and water, one door, and a clear
+// corridor just below the door so scripted walks can cross the level.
+// Written row by row to a level file and opened from there, so levels
+// too big to hold in memory stream like they would in the game.
+bool generate_level(World &world, int width, int height, int seed)
+{
+    const char *tmp = getenv("TMPDIR");
+    string path = string(tmp && *tmp ? tmp : "/tmp") + "/bench_" + std::to_string(width) + "x" + std::to_string(height) + "_" +
+                  std::to_string(seed) + ".lvl";
+    LevelWriter writer;
+    if (!level_writer_open(writer, path, width, height))
+    {
+        return false;
+    }
+
+    Rng rng;
+    rng_seed(rng, seed);
+    vector<uint8_t> row(width);
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            int roll = rng_range(rng, 10);
+            if (x == 0 || y == 0 || x == width - 1 || y == height - 1 || (roll == 0 && y != height / 2 + 1))
+            {
+                row[x] = pack_tile(WALL, false);
+            }
+            else if (roll < 3)
+            {
+                row[x] = pack_tile(WATER, true);
+            }
+            else
+            {
+                row[x] = pack_tile(GRASS, true);
+            }
+        }
+        if (y == height / 2)
+        {
+            row[width / 2] = pack_tile(DOOR, false);
+        }
+        level_writer_row(writer, row.data(), row.size());
+    }
+    return level_writer_close(writer) && load_level_file(path, world);
+}
+
+bool load_scenario_level(const Scenario &scenario, World &world)
+{
+    if (scenario.generate_width > 0 && scenario.generate_height > 0)
+    {
+        return generate_level(world, scenario.generate_width, scenario.generate_height, scenario.seed);
+    }
+    return load_level(scenario.level, world);
+}
+
+InputCommand script_command(const string &script, long tick)
+{
+    if (script.empty())
+    {
+        return CMD_NONE;
+    }
+    switch (script[tick % script.length()])
+    {
+    case 'W':
+        return CMD_MOVE_UP;
+    case 'S':
+        return CMD_MOVE_DOWN;
+    case 'A':
+        return CMD_MOVE_LEFT;
+    case 'D':
+        return CMD_MOVE_RIGHT;
+    }
+    return CMD_NONE;
+}
+
+// Starts a fresh run on the level, as pressing ENTER on the title screen would
+void restart_run(const Scenario &scenario, const Para &p, Game &game, const World &level)
+{
+    sim_new_run(p, game);
+    if (scenario.start_x >= 0 && scenario.start_y >= 0)
+    {
+        game.player.x = scenario.start_x;
+        game.player.y = scenario.start_y;
+    }
+    game.world = level;
+    sim_start_level(p, game);
+}
+
+bool run_scenario(const Scenario &scenario, const Para &p, const World &level, ThreadPool &pool, ChunkStreamer &streamer,
+                  RunResult &result)
+{
+    Game game;
+    game.pool = &pool;
+    game.streamer = &streamer;
+    rng_seed(game.rng, scenario.seed);
+    restart_run(scenario, p, game, level);
+
+    long total = (long)scenario.warmup_ticks + scenario.ticks;
+    result.tick_ns.reserve(scenario.ticks);
+
+    bench_clock::time_point run_start = bench_clock::now();
+    for (long tick = 0; tick < total; ++tick)
+    {
+        if (tick == scenario.warmup_ticks)
+        {
+            run_start = bench_clock::now();
+        }
+
+        bench_clock::time_point start = bench_clock::now();
+        if (scenario.reload_every > 0 && tick % scenario.reload_every == 0)
+        {
+            World reloaded;
+            if (!load_scenario_level(scenario, reloaded))
+            {
+                return false;
+            }
+            std::swap(game.world, reloaded);
+            sim_world_changed(game);
+            if (game.player.has_key)
+            {
+                open_doors(game);
+            }
+            if (tick >= scenario.warmup_ticks)
+            {
+                result.reload_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start).count());
+            }
+        }
+
+        sim_tick(p, game, script_command(scenario.script, tick));
+        game.events.clear();
+        if (game.state != PLAYING)
+        {
+            restart_run(scenario, p, game, level);
+            result.restarts++;
+        }
+
+        if (tick >= scenario.warmup_ticks)
+        {
+            result.tick_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start).count());
+        }
+    }
+    result.seconds = std::chrono::duration<double>(bench_clock::now() - run_start).count();
+    return true;
+}
+
+// Replays the recording from the start, timing every tick
+bool run_replay(const Scenario &scenario, const Para &p, const Recording &recording, ThreadPool &pool, ChunkStreamer &streamer,
+                RunResult &result)
+{
+    Game game;
+    game.pool = &pool;
+    game.streamer = &streamer;
+    Replay replay;
+    replay_start(replay, recording, p, game);
+
+    long total = (long)scenario.warmup_ticks + scenario.ticks;
+    result.tick_ns.reserve(scenario.ticks);
+    bench_clock::time_point run_start = bench_clock::now();
+    for (long tick = 0; tick < total; ++tick)
+    {
+        if (tick == scenario.warmup_ticks)
+        {
+            run_start = bench_clock::now();
+        }
+        bench_clock::time_point start = bench_clock::now();
+        if (!replay_step(replay, p, game))
+        {
+            return false;
+        }
+        game.events.clear();
+        if (tick >= scenario.warmup_ticks)
+        {
+            result.tick_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start).count());
+        }
+    }
+    result.seconds = std::chrono::duration<double>(bench_clock::now() - run_start).count();
+    result.state_hash = replay_state_hash(game);
+    result.width = game.world.width;
+    result.height = game.world.height;
+    return true;
+}
+
+double percentile_us(vector<uint32_t> values, double fraction)
+{
+    if (values.empty())
+    {
+        return 0;
+    }
+    size_t index = std::min(values.size() - 1, (size_t)(fraction * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index] / 1000.0;
+}
+
+long peak_memory_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+    return usage.ru_maxrss; // kilobytes on Linux
+#endif
+}
+
+bool bench_scenario(const string &filename, Para p, bool first)
+{
+    Scenario scenario;
+    if (!load_scenario(filename, scenario))
+    {
+        return false;
+    }
+
+    World level;
+    Recording recording;
+    if (!scenario.replay.empty())
+    {
+        if (!load_recording(scenario.replay, recording))
+        {
+            return false;
+        }
+        scenario.warmup_ticks = std::min(scenario.warmup_ticks, (int)recording.ticks);
+        int left = recording.ticks - scenario.warmup_ticks;
+        scenario.ticks = scenario.ticks > 0 ? std::min(scenario.ticks, left) : left;
+    }
+    else if (!load_scenario_level(scenario, level))
+    {
+        fprintf(stderr, "Scenario %s could not load its level\n", scenario.name.c_str());
+        return false;
+    }
+
+    if (threads_override > 0)
+    {
+        scenario.threads = threads_override;
+    }
+    // A replay runs on the constants it was recorded with
+    if (scenario.replay.empty())
+    {
+        if (scenario.max_mobs >= 0)
+        {
+            p.MAX_MOBS = scenario.max_mobs;
+        }
+        if (scenario.tick_speed >= 0)
+        {
+            p.TICK_SPEED = scenario.tick_speed;
+        }
+        if (scenario.mob_move_interval >= 0)
+        {
+            p.MOB_MOVE_INTERVAL = scenario.mob_move_interval;
+        }
+        p.NUM_TILES_X = level.width;
+        p.NUM_TILES_Y = level.height;
+    }
+
+    // Report the median repeat by throughput so one noisy run does not skew the numbers
+    ThreadPool pool;
+    thread_pool_start(pool, scenario.threads - 1);
+    ChunkStreamer streamer;
+    chunk_streamer_start(streamer);
+    vector<RunResult> runs(scenario.repeats);
+    bool ok = true;
+    for (RunResult &run : runs)
+    {
+        if (!scenario.replay.empty())
+        {
+            if (!run_replay(scenario, p, recording, pool, streamer, run))
+            {
+                fprintf(stderr, "Scenario %s stopped before the end of its recording\n", scenario.name.c_str());
+                ok = false;
+                break;
+            }
+            if (run.state_hash != runs[0].state_hash)
+            {
+                fprintf(stderr, "Scenario %s ended on a different state in repeat %d\n", scenario.name.c_str(), (int)(&run - &runs[0]));
+                ok = false;
+                break;
+            }
+            level.width = run.width;
+            level.height = run.height;
+        }
+        else if (!run_scenario(scenario, p, level, pool, streamer, run))
+        {
+            fprintf(stderr, "Scenario %s failed to reload its level\n", scenario.name.c_str());
+            ok = false;
+            break;
+        }
+    }
+    chunk_streamer_stop(streamer);
+    thread_pool_stop(pool);
+    if (!ok)
+    {
+        return false;
+    }
+    std::sort(runs.begin(), runs.end(), [](const RunResult &a, const RunResult &b) { return a.seconds < b.seconds; });
+    const RunResult &median = runs[runs.size() / 2];
+
+    fprintf(report, "%s  {\"scenario\": \"%s\", \"width\": %d, \"height\": %d, \"max_mobs\": %d, \"ticks\": %d, \"repeats\": %d, \"threads\": %d,\n",
+           first ? "" : ",\n", scenario.name.c_str(), level.width, level.height, p.MAX_MOBS, scenario.ticks, scenario.repeats,
+           scenario.threads);
+    fprintf(report, "   \"seconds\": %.6f, \"ticks_per_second\": %.1f, \"tick_p50_us\": %.3f, \"tick_p99_us\": %.3f, \"tick_max_us\": %.3f,\n",
+           median.seconds, scenario.ticks / median.seconds, percentile_us(median.tick_ns, 0.50),
+           percentile_us(median.tick_ns, 0.99), percentile_us(median.tick_ns, 1.0));
+    fprintf(report, "   \"reloads\": %zu, \"reload_p50_us\": %.3f, \"reload_p99_us\": %.3f, \"restarts\": %d, \"peak_memory_kb\": %ld",
+           median.reload_ns.size(), percentile_us(median.reload_ns, 0.50), percentile_us(median.reload_ns, 0.99),
+           median.restarts, peak_memory_kb());
+    if (!scenario.replay.empty())
+    {
+        fprintf(report, ", \"state_hash\": \"%016llx\"", (unsigned long long)median.state_hash);
+    }
+    fprintf(report, "}");
+    fflush(report);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    Para p;
+    load_constants_from_json(p, "consts.json");
+
+    vector<string> scenarios;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (string(argv[i]) == "--out" && i + 1 < argc)
+        {
+            report = fopen(argv[++i], "w");
+            if (!report)
+            {
+                fprintf(stderr, "Could not open %s for writing\n", argv[i]);
+                return 2;
+            }
+        }
+        else if (string(argv[i]) == "--threads" && i + 1 < argc)
+        {
+            threads_override = std::max(1, atoi(argv[++i]));
+        }
+        else if (string(argv[i]) == "--trace" && i + 1 < argc)
+        {
+            trace_path = argv[++i];
+            profiler_set_enabled(true);
+        }
+        else
+        {
+            scenarios.push_back(argv[i]);
+        }
+    }
+    if (scenarios.empty())
+    {
+        DIR *dir = opendir("resources/json/bench");
+        if (!dir)
+        {
+            fprintf(stderr, "Run bench from the repository root\n");
+            return 2;
+        }
+        while (dirent *entry = readdir(dir))
+        {
+            string name = entry->d_name;
+            if (name.length() > 5 && name.substr(name.length() - 5) == ".json")
+            {
+                scenarios.push_back("bench/" + name);
+            }
+        }
+        closedir(dir);
+        std::sort(scenarios.begin(), scenarios.end());
+    }
+
+    bool ok = true;
+    fprintf(report, "[\n");
+    for (size_t i = 0; i < scenarios.size(); ++i)
+    {
+        ok = bench_scenario(scenarios[i], p, i == 0) && ok;
+    }
+    fprintf(report, "\n]\n");
+    if (!trace_path.empty())
+    {
+        profiler_write_trace(trace_path);
+    }
+    if (report != stdout)
+    {
+        fclose(report);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,343 @@
+#include "splashkit.h"
+#include "../level_json.h"
+#include "../para_json.h"
+#include "../thread_pool.h"
+#include "../tile_types_json.h"
+#include <chrono>
+#include <dirent.h>
+
+/*
+Level checker. Loads every level in a directory, one level per thread, and
+reports what would break the game. Run it from the repository root:
+
+  level_check                           every resources/json/level_*.json
+  level_check resources/levels          every .lvl in a directory
+  level_check path/to/level_4.json      one level
+
+Errors: a file that is not a level (bad JSON, ragged columns, a tile
+without its type or flag, a type too big for a tile byte, a bad .lvl
+header or checksum), tiles of a type tile_types.json does not define, no
+exit tile, more than one of a unique type, an exit cut off from the main
+area, fewer spawnable tiles than MAX_MOBS.
+
+Warnings: tiles whose traversable flag differs from their type's,
+traversable tiles cut off from the main area (the player or mobs can
+spawn there and never leave).
+
+Areas are joined edge to edge through traversable tiles and tiles that
+open with the key, as in the editor (connectivity.h); the main area is
+the biggest. The exit code is 1 if any level has an error.
+*/
+
+struct LevelReport
+{
+    string path;
+    int width = 0;
+    int height = 0;
+    double load_ms = 0;
+    double check_ms = 0;
+    int64_t spawnable = 0; // traversable tiles, where mobs and the player can start
+    int64_t stranded = 0;  // traversable tiles outside the main area
+    int areas = 0;
+    int64_t main_area = 0;
+    int exits = 0;
+    int reachable_exits = 0;
+    vector<string> errors;
+    vector<string> warnings;
+};
+
+double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool ends_with(const string &text, const string &suffix)
+{
+    return text.length() >= suffix.length() && text.compare(text.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+
+bool read_file(const string &path, string &text)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    text.resize(size > 0 ? size : 0);
+    bool ok = size >= 0 && fread(&text[0], 1, text.size(), file) == text.size();
+    fclose(file);
+    return ok;
+}
+
+string tile_at(int64_t index, int width)
+{
+    return std::to_string(index % width) + "," + std::to_string(index / width);
+}
+
+// Labels the areas and checks the tile rules of a level held as packed bytes
+void check_tiles(LevelReport &report, const uint8_t *tiles, int max_mobs)
+{
+    const int width = report.width;
+    const int64_t count = (int64_t)width * report.height;
+    int64_t type_count[TILE_TYPE_LIMIT] = {};
+    int64_t first_at[TILE_TYPE_LIMIT];
+    int64_t flag_mismatch[TILE_TYPE_LIMIT] = {};
+    for (int64_t i = 0; i < count; ++i)
+    {
+        int type = tile_byte_type(tiles[i]);
+        if (type_count[type]++ == 0)
+        {
+            first_at[type] = i;
+        }
+        flag_mismatch[type] += tile_byte_traversable(tiles[i]) != tile_type_info(type).traversable;
+        report.spawnable += tile_byte_traversable(tiles[i]);
+    }
+
+    for (int type = 0; type < TILE_TYPE_LIMIT; ++type)
+    {
+        if (type_count[type] == 0)
+        {
+            continue;
+        }
+        const TileTypeInfo &info = tile_type_info(type);
+        string name = info.name + " (" + std::to_string(type) + ")";
+        if (!info.defined)
+        {
+            report.errors.push_back(std::to_string(type_count[type]) + " tiles of undefined type " + std::to_string(type) +
+                                    ", first at " + tile_at(first_at[type], width));
+            continue;
+        }
+        if (info.effects & TILE_EFFECT_EXIT)
+        {
+            report.exits += type_count[type];
+        }
+        if ((info.edit_rules & TILE_EDIT_UNIQUE) && type_count[type] > 1)
+        {
+            report.errors.push_back(std::to_string(type_count[type]) + " " + name + " tiles, there can only be one");
+        }
+        if (flag_mismatch[type] > 0)
+        {
+            report.warnings.push_back(std::to_string(flag_mismatch[type]) + " " + name + " tiles are " +
+                                      (info.traversable ? "not " : "") + "traversable, unlike their type");
+        }
+    }
+    if (report.exits == 0)
+    {
+        report.errors.push_back("no exit tile (DOOR), the level cannot be finished");
+    }
+
+    // Breadth-first over each area in turn, labelling it with its number
+    auto passable = [&](int64_t i) {
+        return tile_byte_traversable(tiles[i]) || tile_type_info(tile_byte_type(tiles[i])).requires_key;
+    };
+    vector<int32_t> label(count, 0);
+    vector<int64_t> area_size(1, 0);
+    vector<int64_t> area_traversable(1, 0);
+    vector<int64_t> queue;
+    for (int64_t start = 0; start < count; ++start)
+    {
+        if (label[start] || !passable(start))
+        {
+            continue;
+        }
+        int32_t area = (int32_t)area_size.size();
+        area_size.push_back(0);
+        area_traversable.push_back(0);
+        label[start] = area;
+        queue.assign(1, start);
+        for (size_t q = 0; q < queue.size(); ++q)
+        {
+            int64_t i = queue[q];
+            area_size[area]++;
+            area_traversable[area] += tile_byte_traversable(tiles[i]);
+            int x = i % width;
+            int64_t neighbours[4] = {x > 0 ? i - 1 : -1, x < width - 1 ? i + 1 : -1, i - width, i + width < count ? i + width : -1};
+            for (int64_t n : neighbours)
+            {
+                if (n >= 0 && !label[n] && passable(n))
+                {
+                    label[n] = area;
+                    queue.push_back(n);
+                }
+            }
+        }
+    }
+    report.areas = (int)area_size.size() - 1;
+    int main_area = (int)(std::max_element(area_size.begin(), area_size.end()) - area_size.begin());
+    report.main_area = area_size[main_area];
+    int stranded_areas = 0;
+    for (int area = 1; area <= report.areas; ++area)
+    {
+        if (area != main_area && area_traversable[area] > 0)
+        {
+            report.stranded += area_traversable[area];
+            stranded_areas++;
+        }
+    }
+    for (int64_t i = 0; i < count; ++i)
+    {
+        if (tile_type_info(tile_byte_type(tiles[i])).effects & TILE_EFFECT_EXIT)
+        {
+            report.reachable_exits += main_area && label[i] == main_area;
+        }
+    }
+
+    if (report.exits > 0 && report.reachable_exits == 0)
+    {
+        report.errors.push_back("the exit is not reachable from the main area");
+    }
+    if (report.stranded > 0)
+    {
+        report.warnings.push_back(std::to_string(report.stranded) + " traversable tiles in " + std::to_string(stranded_areas) +
+                                  " areas cut off from the main area");
+    }
+    if (report.spawnable < max_mobs)
+    {
+        report.errors.push_back("only " + std::to_string(report.spawnable) + " spawnable tiles for MAX_MOBS " +
+                                std::to_string(max_mobs));
+    }
+}
+
+void check_level(LevelReport &report, int max_mobs)
+{
+    auto start = std::chrono::steady_clock::now();
+    vector<uint8_t> parsed;
+    MappedLevel mapped;
+    const uint8_t *tiles = nullptr;
+    if (ends_with(report.path, ".lvl"))
+    {
+        if (map_level_binary(report.path, mapped))
+        {
+            report.width = mapped.width;
+            report.height = mapped.height;
+            tiles = mapped.tiles;
+        }
+        else
+        {
+            report.errors.push_back("not a level file, or truncated or failing its checksum");
+        }
+    }
+    else
+    {
+        string text, error;
+        if (!read_file(report.path, text))
+        {
+            report.errors.push_back("could not be read");
+        }
+        else if (parse_level_json_text(text, report.width, report.height, parsed, error))
+        {
+            tiles = parsed.data();
+        }
+        else
+        {
+            report.errors.push_back(error);
+        }
+    }
+    report.load_ms = elapsed_ms(start);
+
+    if (tiles)
+    {
+        start = std::chrono::steady_clock::now();
+        check_tiles(report, tiles, max_mobs);
+        report.check_ms = elapsed_ms(start);
+    }
+    unmap_level(mapped);
+}
+
+// Levels to check: the path itself if it is a file, else the levels in the directory, in name order
+bool find_levels(const string &path, vector<string> &paths)
+{
+    DIR *dir = opendir(path.c_str());
+    if (!dir)
+    {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file)
+        {
+            fclose(file);
+            paths.push_back(path);
+        }
+        return file != nullptr;
+    }
+    while (dirent *entry = readdir(dir))
+    {
+        string name = entry->d_name;
+        if (ends_with(name, ".lvl") || (name.rfind("level_", 0) == 0 && ends_with(name, ".json")))
+        {
+            paths.push_back(path + (ends_with(path, "/") ? "" : "/") + name);
+        }
+    }
+    closedir(dir);
+    std::sort(paths.begin(), paths.end());
+    return true;
+}
+
+void print_report(const LevelReport &report, int max_mobs)
+{
+    printf("%s: %s\n", report.path.c_str(), !report.errors.empty() ? "FAIL" : !report.warnings.empty() ? "warnings" : "ok");
+    if (report.width > 0)
+    {
+        int64_t tiles = (int64_t)report.width * report.height;
+        printf("  %dx%d, loaded in %.2f ms, checked in %.2f ms\n", report.width, report.height, report.load_ms, report.check_ms);
+        printf("  traversable %lld (%.0f%%), %d areas, main area %lld tiles, exit %s\n", (long long)report.spawnable,
+               100.0 * report.spawnable / tiles, report.areas, (long long)report.main_area,
+               report.exits == 0 ? "missing" : report.reachable_exits > 0 ? "reachable" : "unreachable");
+        printf("  spawnable %lld tiles (%lld in the main area) for MAX_MOBS %d\n", (long long)report.spawnable,
+               (long long)(report.spawnable - report.stranded), max_mobs);
+    }
+    for (const string &error : report.errors)
+    {
+        printf("  error: %s\n", error.c_str());
+    }
+    for (const string &warning : report.warnings)
+    {
+        printf("  warning: %s\n", warning.c_str());
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2)
+    {
+        printf("Usage:\n");
+        printf("  level_check [directory or level file]\n");
+        return 2;
+    }
+    string path = argc > 1 ? argv[1] : "resources/json";
+
+    Para p;
+    load_constants_from_json(p, "consts.json");
+    load_tile_types_from_json(tile_types(), "tile_types.json");
+
+    vector<string> paths;
+    if (!find_levels(path, paths))
+    {
+        printf("%s is not a directory or level file\n", path.c_str());
+        return 2;
+    }
+
+    vector<LevelReport> reports(paths.size());
+    ThreadPool pool;
+    thread_pool_start(pool, thread_pool_default_workers());
+    auto start = std::chrono::steady_clock::now();
+    thread_pool_run(&pool, (int)reports.size(), [&](int i) {
+        reports[i].path = paths[i];
+        check_level(reports[i], p.MAX_MOBS);
+    });
+    double total_ms = elapsed_ms(start);
+    thread_pool_stop(pool);
+
+    int failed = 0;
+    int warned = 0;
+    for (const LevelReport &report : reports)
+    {
+        print_report(report, p.MAX_MOBS);
+        failed += !report.errors.empty();
+        warned += report.errors.empty() && !report.warnings.empty();
+    }
+    printf("%d levels, %d failed, %d with warnings, %.1f ms on %d threads\n", (int)reports.size(), failed, warned, total_ms,
+           thread_pool_default_workers() + 1);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,96 @@
+#include "splashkit.h"
+#include "../level_format.h"
+#include "../level_json.h"
+#include <dirent.h>
+
+/*
+Level converter between the JSON levels in resources/json and the binary
+levels in resources/levels. Run it from the repository root:
+
+  level_convert to-bin level_1.json       resources/json/level_1.json -> resources/levels/level_1.lvl
+  level_convert to-json level_1.lvl       resources/levels/level_1.lvl -> resources/json/level_1.json
+  level_convert all                       every resources/json/level_*.json -> resources/levels
+*/
+
+bool convert_to_binary(const string &json_name)
+{
+    int width, height;
+    vector<uint8_t> tiles;
+    if (!read_level_json(json_name, width, height, tiles))
+    {
+        printf("%s is not a level file\n", json_name.c_str());
+        return false;
+    }
+
+    string out_path = binary_level_path(json_name);
+    if (!write_level_binary(out_path, width, height, tiles.data()))
+    {
+        return false;
+    }
+    printf("%s -> %s (%dx%d)\n", json_name.c_str(), out_path.c_str(), width, height);
+    return true;
+}
+
+bool convert_to_json(const string &binary_name)
+{
+    MappedLevel level;
+    if (!map_level_binary(binary_level_path(binary_name), level))
+    {
+        printf("%s is not a level file\n", binary_name.c_str());
+        return false;
+    }
+
+    // json_to_file writes relative to resources/json
+    string stem = binary_level_path(binary_name).substr(LEVEL_BINARY_DIR.length());
+    string json_name = stem.substr(0, stem.rfind('.')) + ".json";
+    write_level_json(json_name, level.width, level.height, level.tiles);
+    printf("%s -> resources/json/%s (%dx%d)\n", binary_name.c_str(), json_name.c_str(), level.width, level.height);
+    unmap_level(level);
+    return true;
+}
+
+bool convert_all()
+{
+    DIR *dir = opendir("resources/json");
+    if (!dir)
+    {
+        printf("Run level_convert from the repository root\n");
+        return false;
+    }
+
+    bool ok = true;
+    while (dirent *entry = readdir(dir))
+    {
+        string name = entry->d_name;
+        if (name.rfind("level_", 0) == 0 && name.length() > 5 && name.substr(name.length() - 5) == ".json")
+        {
+            ok = convert_to_binary(name) && ok;
+        }
+    }
+    closedir(dir);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    string command = argc > 1 ? argv[1] : "";
+
+    if (command == "to-bin" && argc == 3)
+    {
+        return convert_to_binary(argv[2]) ? 0 : 1;
+    }
+    else if (command == "to-json" && argc == 3)
+    {
+        return convert_to_json(argv[2]) ? 0 : 1;
+    }
+    else if (command == "all" && argc == 2)
+    {
+        return convert_all() ? 0 : 1;
+    }
+
+    printf("Usage:\n");
+    printf("  level_convert to-bin level_1.json\n");
+    printf("  level_convert to-json level_1.lvl\n");
+    printf("  level_convert all\n");
+    return 2;
+}
@@ -0,0 +1,84 @@
+#include "splashkit.h"
+#include "../level_gen.h"
+#include <atomic>
+#include <chrono>
+
+/*
+Procedural level generator, see level_gen.h. Writes count levels named
+<name>_1 to <name>_<count> into resources/levels, level i generated from
+seed + i. Run it from the repository root:
+
+  level_gen rooms 1000 128 128               resources/levels/gen_1.lvl ... gen_1000.lvl
+  level_gen caves 3 64 48 42 level           resources/levels/level_1.lvl ... level_3.lvl, seeds 43 to 45
+  level_gen caves 1 65536 65536              one streamed level, written a band at a time
+
+Many levels are generated side by side, one per thread. Fewer levels than
+threads spread each level's sectors over the threads instead.
+*/
+
+int main(int argc, char *argv[])
+{
+    LevelGenMode mode;
+    if (argc < 5 || argc > 7 || !level_gen_parse_mode(argv[1], mode))
+    {
+        printf("Usage:\n");
+        printf("  level_gen rooms|caves count width height [seed] [name]\n");
+        return 2;
+    }
+
+    LevelGenOptions options;
+    options.mode = mode;
+    options.width = atoi(argv[3]);
+    options.height = atoi(argv[4]);
+    int count = atoi(argv[2]);
+    uint64_t seed = argc > 5 ? strtoull(argv[5], nullptr, 10) : 0;
+    string name = argc > 6 ? argv[6] : "gen";
+    if (count <= 0 || !level_gen_valid(options))
+    {
+        printf("Levels must be at least %dx%d\n", LEVEL_GEN_MIN_SIZE, LEVEL_GEN_MIN_SIZE);
+        return 2;
+    }
+
+    ThreadPool pool;
+    int workers = thread_pool_default_workers();
+    thread_pool_start(pool, workers);
+    bool level_parallel = count > workers;
+    std::atomic<int> failed(0);
+
+    auto start = std::chrono::steady_clock::now();
+    auto generate = [&](int i) {
+        LevelGenOptions level = options;
+        level.seed = seed + i + 1;
+        string path = binary_level_path(name + "_" + std::to_string(i + 1));
+        LevelGenResult result;
+        if (!level_generate_file(path, level, result, level_parallel ? nullptr : &pool))
+        {
+            printf("%s failed\n", path.c_str());
+            failed++;
+        }
+        else if (count <= 10)
+        {
+            printf("%s (%dx%d %s, seed %llu) spawn %d,%d door %d,%d\n", path.c_str(), level.width, level.height,
+                   level_gen_mode_name(level.mode), (unsigned long long)level.seed, result.spawn_x, result.spawn_y,
+                   result.door_x, result.door_y);
+        }
+    };
+    if (level_parallel)
+    {
+        thread_pool_run(&pool, count, generate);
+    }
+    else
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            generate(i);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    thread_pool_stop(pool);
+
+    double tiles = (double)options.width * options.height * count;
+    printf("%d levels, %.0f tiles in %.2f s (%.1f million tiles/s, %d threads)\n", count - failed.load(), tiles, seconds,
+           tiles / seconds / 1e6, workers + 1);
+    return failed.load() == 0 ? 0 : 1;
+}
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "level_format.h"
+
+/*
+The tile grid, stored as CHUNK_SIZE x CHUNK_SIZE chunks. Only resident
+chunks are held in memory, each in one of a fixed number of slots: tile
+types in a byte array and traversability in a bitmap, one word per chunk
+row, so collision checks touch a single word. Worlds with no more chunks
+than slots are fully resident and behave like one flat grid. Bigger
+worlds keep a LevelSource and load chunks from it as the player moves,
+see sim_stream. Tiles in chunks that are not loaded read as WALL and are
+never traversable.
+
+Tile indices (world_index) are per slot, so arrays indexed by tile stay
+the size of the resident set however big the world is.
+Pixel positions are never stored, they are tile index * TILE_SIZE.
+*/
+
+enum TileType : uint8_t
+{
+    GRASS,
+    WATER,
+    WALL,
+    DOOR
+};
+
+const int CHUNK_SHIFT = 5;
+const int CHUNK_SIZE = 1 << CHUNK_SHIFT; // tiles per chunk side
+const int CHUNK_MASK = CHUNK_SIZE - 1;
+const int CHUNK_TILES = CHUNK_SIZE * CHUNK_SIZE;
+const int WORLD_RESIDENT_CHUNKS = 1024; // slots; worlds with more chunks than this stream
+
+struct World
+{
+    int width = 0;  // in tiles
+    int height = 0; // in tiles
+    int chunks_x = 0;
+    int chunks_y = 0;
+    std::vector<int32_t> slot_of;   // slot holding each chunk, -1 if not loaded
+    std::vector<int32_t> chunk_of;  // chunk held in each slot, -1 if free
+    std::vector<uint32_t> stamp;    // per slot, changes whenever a chunk is loaded into it
+    std::vector<uint8_t> edited;    // per slot, 1 once a tile changed; edited chunks stay loaded
+    std::vector<uint8_t> tiles;     // TileType per tile, CHUNK_TILES per slot, row-major within the chunk
+    std::vector<uint32_t> walkable; // traversable bit per tile, CHUNK_SIZE words per slot
+    std::shared_ptr<const LevelSource> source; // chunks load from here; null when everything is resident
+    uint32_t next_stamp = 0;
+};
+
+inline void world_set_size(World &world, int width, int height, int slots)
+{
+    world.width = width;
+    world.height = height;
+    world.chunks_x = (width + CHUNK_MASK) >> CHUNK_SHIFT;
+    world.chunks_y = (height + CHUNK_MASK) >> CHUNK_SHIFT;
+    world.slot_of.assign((size_t)world.chunks_x * world.chunks_y, -1);
+    world.chunk_of.assign(slots, -1);
+    world.stamp.assign(slots, 0);
+    world.edited.assign(slots, 0);
+    world.tiles.assign((size_t)slots * CHUNK_TILES, WALL);
+    world.walkable.assign((size_t)slots * CHUNK_SIZE, 0);
+    world.source.reset();
+}
+
+// Makes every chunk resident in the slot matching its chunk number
+inline void world_map_all_chunks(World &world)
+{
+    for (int chunk = 0; chunk < (int)world.slot_of.size(); ++chunk)
+    {
+        world.slot_of[chunk] = chunk;
+        world.chunk_of[chunk] = chunk;
+        world.stamp[chunk] = ++world.next_stamp;
+    }
+}
+
+// A fully resident world of grass, none of it traversable yet
+inline void world_init(World &world, int width, int height)
+{
+    world_set_size(world, width, height, ((width + CHUNK_MASK) >> CHUNK_SHIFT) * ((height + CHUNK_MASK) >> CHUNK_SHIFT));
+    world_map_all_chunks(world);
+    for (size_t slot = 0; slot < world.chunk_of.size(); ++slot)
+    {
+        int x0 = (int)(slot % world.chunks_x) << CHUNK_SHIFT;
+        int y0 = (int)(slot / world.chunks_x) << CHUNK_SHIFT;
+        for (int y = y0; y < std::min(y0 + CHUNK_SIZE, height); ++y)
+        {
+            uint8_t *row = &world.tiles[slot * CHUNK_TILES + ((y & CHUNK_MASK) << CHUNK_SHIFT)];
+            std::fill(row, row + std::min(CHUNK_SIZE, width - x0), GRASS);
+        }
+    }
+}
+
+inline bool world_in_bounds(const World &world, int x, int y)
+{
+    return (unsigned)x < (unsigned)world.width && (unsigned)y < (unsigned)world.height;
+}
+
+// Whether the world streams chunks rather than holding all of them
+inline bool world_streamed(const World &world)
+{
+    return world.source != nullptr;
+}
+
+inline int world_chunk(const World &world, int x, int y)
+{
+    return (y >> CHUNK_SHIFT) * world.chunks_x + (x >> CHUNK_SHIFT);
+}
+
+// In bounds and in a loaded chunk
+inline bool world_resident(const World &world, int x, int y)
+{
+    return world_in_bounds(world, x, y) && world.slot_of[world_chunk(world, x, y)] >= 0;
+}
+
+// Index of a resident tile into tiles and any per-tile array sized like it
+inline size_t world_index(const World &world, int x, int y)
+{
+    return (size_t)world.slot_of[world_chunk(world, x, y)] * CHUNK_TILES + ((y & CHUNK_MASK) << CHUNK_SHIFT) + (x & CHUNK_MASK);
+}
+
+// Tile coordinates back from a world_index
+inline int world_index_x(const World &world, size_t index)
+{
+    return (world.chunk_of[index / CHUNK_TILES] % world.chunks_x) * CHUNK_SIZE + (int)(index & CHUNK_MASK);
+}
+
+inline int world_index_y(const World &world, size_t index)
+{
+    return (world.chunk_of[index / CHUNK_TILES] / world.chunks_x) * CHUNK_SIZE + (int)((index >> CHUNK_SHIFT) & CHUNK_MASK);
+}
+
+inline TileType world_tile(const World &world, int x, int y)
+{
+    if (!world_resident(world, x, y))
+    {
+        return WALL;
+    }
+    return (TileType)world.tiles[world_index(world, x, y)];
+}
+
+// Out of bounds and unloaded tiles are never traversable
+inline bool world_traversable(const World &world, int x, int y)
+{
+    if (!world_in_bounds(world, x, y))
+    {
+        return false;
+    }
+    int slot = world.slot_of[world_chunk(world, x, y)];
+    if (slot < 0)
+    {
+        return false;
+    }
+    return (world.walkable[(size_t)slot * CHUNK_SIZE + (y & CHUNK_MASK)] >> (x & CHUNK_MASK)) & 1;
+}
+
+// The CHUNK_SIZE traversable bits of the chunk row holding tile x, bit 0 being tile (x & ~CHUNK_MASK)
+inline uint32_t world_traversable_row(const World &world, int x, int y)
+{
+    if (!world_resident(world, x, y))
+    {
+        return 0;
+    }
+    return world.walkable[(size_t)world.slot_of[world_chunk(world, x, y)] * CHUNK_SIZE + (y & CHUNK_MASK)];
+}
+
+// The tile must be resident
+inline void world_set_traversable(World &world, int x, int y, bool traversable)
+{
+    uint32_t &word = world.walkable[(size_t)world.slot_of[world_chunk(world, x, y)] * CHUNK_SIZE + (y & CHUNK_MASK)];
+    uint32_t bit = (uint32_t)1 << (x & CHUNK_MASK);
+    word = traversable ? (word | bit) : (word & ~bit);
+}
+
+// The tile must be resident
+inline void world_set_tile(World &world, int x, int y, TileType type, bool traversable)
+{
+    size_t index = world_index(world, x, y);
+    world.tiles[index] = type;
+    world.edited[index / CHUNK_TILES] = 1;
+    world_set_traversable(world, x, y, traversable);
+}
+
+// Calls fn(x, y, index) for every tile of every loaded chunk
+template <typename Fn>
+inline void world_for_each_tile(const World &world, Fn fn)
+{
+    for (int slot = 0; slot < (int)world.chunk_of.size(); ++slot)
+    {
+        int chunk = world.chunk_of[slot];
+        if (chunk < 0)
+        {
+            continue;
+        }
+        int x0 = (chunk % world.chunks_x) << CHUNK_SHIFT;
+        int y0 = (chunk / world.chunks_x) << CHUNK_SHIFT;
+        int x1 = std::min(x0 + CHUNK_SIZE, world.width);
+        int y1 = std::min(y0 + CHUNK_SIZE, world.height);
+        for (int y = y0; y < y1; ++y)
+        {
+            size_t index = (size_t)slot * CHUNK_TILES + ((y & CHUNK_MASK) << CHUNK_SHIFT);
+            for (int x = x0; x < x1; ++x)
+            {
+                fn(x, y, index + (x - x0));
+            }
+        }
+    }
+}
+
+// Copies one chunk of a row-major packed level into out (CHUNK_TILES bytes).
+// Tiles past the edge of the level come out as untraversable walls.
+inline void level_read_chunk(const uint8_t *packed, int width, int height, int chunk, uint8_t *out)
+{
+    int chunks_x = (width + CHUNK_MASK) >> CHUNK_SHIFT;
+    int x0 = (chunk % chunks_x) << CHUNK_SHIFT;
+    int y0 = (chunk / chunks_x) << CHUNK_SHIFT;
+    int w = std::min(CHUNK_SIZE, width - x0);
+    for (int y = 0; y < CHUNK_SIZE; ++y)
+    {
+        uint8_t *row = out + (y << CHUNK_SHIFT);
+        int count = y0 + y < height ? w : 0;
+        if (count > 0)
+        {
+            memcpy(row, packed + (size_t)(y0 + y) * width + x0, count);
+        }
+        memset(row + count, pack_tile(WALL, false), CHUNK_SIZE - count);
+    }
+}
+
+// Unpacks a chunk read by level_read_chunk into slot
+inline void world_fill_slot(World &world, int slot, const uint8_t *packed_chunk)
+{
+    uint8_t *tiles = &world.tiles[(size_t)slot * CHUNK_TILES];
+    uint32_t *mask = &world.walkable[(size_t)slot * CHUNK_SIZE];
+    for (int y = 0; y < CHUNK_SIZE; ++y)
+    {
+        uint32_t bits = 0;
+        for (int x = 0; x < CHUNK_SIZE; ++x)
+        {
+            uint8_t tile = packed_chunk[(y << CHUNK_SHIFT) + x];
+            tiles[(y << CHUNK_SHIFT) + x] = tile_byte_type(tile);
+            bits |= (uint32_t)tile_byte_traversable(tile) << x;
+        }
+        mask[y] = bits;
+    }
+}
+
+// Loads a chunk into a free slot and returns the slot, or -1 if every slot is taken
+inline int world_install_chunk(World &world, int chunk, const uint8_t *packed_chunk)
+{
+    int slot = -1;
+    for (int i = 0; i < (int)world.chunk_of.size() && slot < 0; ++i)
+    {
+        if (world.chunk_of[i] < 0)
+        {
+            slot = i;
+        }
+    }
+    if (slot < 0)
+    {
+        return -1;
+    }
+    world_fill_slot(world, slot, packed_chunk);
+    world.slot_of[chunk] = slot;
+    world.chunk_of[slot] = chunk;
+    world.stamp[slot] = ++world.next_stamp;
+    world.edited[slot] = 0;
+    return slot;
+}
+
+inline void world_evict_slot(World &world, int slot)
+{
+    world.slot_of[world.chunk_of[slot]] = -1;
+    world.chunk_of[slot] = -1;
+}
+
+// Fills a fully resident world from packed level bytes (see level_format.h)
+inline void world_load_packed(World &world, int width, int height, const uint8_t *packed)
+{
+    int chunks = ((width + CHUNK_MASK) >> CHUNK_SHIFT) * ((height + CHUNK_MASK) >> CHUNK_SHIFT);
+    world_set_size(world, width, height, chunks);
+    world_map_all_chunks(world);
+    uint8_t packed_chunk[CHUNK_TILES];
+    for (int chunk = 0; chunk < chunks; ++chunk)
+    {
+        level_read_chunk(packed, width, height, chunk, packed_chunk);
+        world_fill_slot(world, chunk, packed_chunk);
+    }
+}
+
+// Takes a level. Small levels are unpacked whole; bigger ones keep the
+// source and start with nothing loaded.
+inline void world_open(World &world, std::shared_ptr<const LevelSource> source)
+{
+    int chunks = ((source->width + CHUNK_MASK) >> CHUNK_SHIFT) * ((source->height + CHUNK_MASK) >> CHUNK_SHIFT);
+    if (chunks > WORLD_RESIDENT_CHUNKS)
+    {
+        world_set_size(world, source->width, source->height, WORLD_RESIDENT_CHUNKS);
+        world.source = source;
+        return;
+    }
+    world_load_packed(world, source->width, source->height, source->tiles);
+}
+
+// Packs the world back into level bytes. Chunks that are not loaded come from the source.
+inline void world_pack(const World &world, std::vector<uint8_t> &packed)
+{
+    packed.resize((size_t)world.width * world.height);
+    if (world.source)
+    {
+        memcpy(packed.data(), world.source->tiles, packed.size());
+    }
+    world_for_each_tile(world, [&](int x, int y, size_t index) {
+        packed[(size_t)y * world.width + x] = pack_tile(world.tiles[index], world_traversable(world, x, y));
+    });
+}